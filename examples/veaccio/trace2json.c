@@ -0,0 +1,179 @@
+/*
+ * Convert a trace file of accelerated I/O written by VE_ACC_IO_TRACE
+ * to the Chrome trace event format, which can be opened by
+ * chrome://tracing or https://ui.perfetto.dev.
+ *
+ * Usage: trace2json TRACE_FILE [JSON_FILE]
+ *
+ * System calls, copies and waits for DMA are shown as slices of the
+ * thread, and DMA of each pipeline stage is shown as an async slice
+ * from the post to the completion.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <veaccio.h>
+
+#define STAGE_MAX 16
+
+struct thread_state {
+    int tid;
+    uint64_t begin[VE_ACC_IO_TRACE_TYPE_NUM];
+    int64_t begin_size[VE_ACC_IO_TRACE_TYPE_NUM];
+    uint64_t dma_post[STAGE_MAX];
+};
+
+static const char *hook_names[VE_ACC_IO_HOOK_NUM] = {
+    "read", "pread", "readv", "preadv",
+    "write", "pwrite", "writev", "pwritev",
+};
+
+static struct thread_state *threads;
+static int nthreads;
+
+static struct thread_state *get_thread(int tid)
+{
+    int i;
+    struct thread_state *p;
+
+    for (i = 0; i < nthreads; i++) {
+        if (threads[i].tid == tid)
+            return &threads[i];
+    }
+    p = realloc(threads, sizeof(*threads) * (nthreads + 1));
+    if (p == NULL) {
+        perror("realloc");
+        exit(1);
+    }
+    threads = p;
+    memset(&threads[nthreads], 0, sizeof(*threads));
+    threads[nthreads].tid = tid;
+    return &threads[nthreads++];
+}
+
+static int first = 1;
+
+static void put_slice(FILE *out, int pid,
+                      const struct ve_acc_io_trace_event *ev,
+                      const char *name, uint64_t t0, uint64_t begin,
+                      int64_t size)
+{
+    fprintf(out, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+            "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,"
+            "\"args\":{\"fd\":%d,\"stage\":%u,\"size\":%ld,\"result\":%ld}}",
+            first ? "" : ",", name, hook_names[ev->hook],
+            (begin - t0) / 1000.0, (ev->time_ns - begin) / 1000.0,
+            pid, ev->tid, ev->fd, ev->stage, (long)size, (long)ev->size);
+    first = 0;
+}
+
+static void put_dma(FILE *out, int pid,
+                    const struct ve_acc_io_trace_event *ev,
+                    uint64_t t0, uint64_t begin, unsigned long id)
+{
+    char name[32];
+
+    snprintf(name, sizeof(name), "dma stage %u", ev->stage);
+    fprintf(out, "%s\n{\"name\":\"%s\",\"cat\":\"dma\",\"ph\":\"b\","
+            "\"id\":%lu,\"ts\":%.3f,\"pid\":%d,\"tid\":%d,"
+            "\"args\":{\"fd\":%d,\"size\":%ld}}",
+            first ? "" : ",", name, id, (begin - t0) / 1000.0, pid,
+            ev->tid, ev->fd, (long)ev->size);
+    fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"dma\",\"ph\":\"e\","
+            "\"id\":%lu,\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+            name, id, (ev->time_ns - t0) / 1000.0, pid, ev->tid);
+    first = 0;
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *in;
+    FILE *out = stdout;
+    struct ve_acc_io_trace_header hdr;
+    struct ve_acc_io_trace_event ev;
+    struct thread_state *th;
+    uint64_t t0 = 0;
+    uint64_t n;
+    unsigned long dma_id = 0;
+    int type;
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s TRACE_FILE [JSON_FILE]\n", argv[0]);
+        return 1;
+    }
+    in = fopen(argv[1], "rb");
+    if (in == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, in) != 1
+        || memcmp(hdr.magic, VE_ACC_IO_TRACE_MAGIC, sizeof(hdr.magic)) != 0
+        || hdr.version != VE_ACC_IO_TRACE_VERSION
+        || hdr.event_size != sizeof(ev)) {
+        fprintf(stderr, "%s: not a trace file of accelerated I/O\n",
+                argv[1]);
+        return 1;
+    }
+    if (argc == 3) {
+        out = fopen(argv[2], "w");
+        if (out == NULL) {
+            perror(argv[2]);
+            return 1;
+        }
+    }
+    if (hdr.dropped != 0)
+        fprintf(stderr, "%s: %lu old events were overwritten\n", argv[1],
+                (unsigned long)hdr.dropped);
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"otherData\":"
+            "{\"dropped\":%lu},\"traceEvents\":[",
+            (unsigned long)hdr.dropped);
+    for (n = 0; n < hdr.nevents && fread(&ev, sizeof(ev), 1, in) == 1; n++) {
+        if (ev.hook >= VE_ACC_IO_HOOK_NUM
+            || ev.type >= VE_ACC_IO_TRACE_TYPE_NUM)
+            continue;
+        if (t0 == 0)
+            t0 = ev.time_ns;
+        th = get_thread(ev.tid);
+        type = ev.type;
+        switch (type) {
+        case VE_ACC_IO_TRACE_SYSCALL_BEGIN:
+        case VE_ACC_IO_TRACE_DMA_WAIT_BEGIN:
+        case VE_ACC_IO_TRACE_MEMCPY_BEGIN:
+            th->begin[type] = ev.time_ns;
+            th->begin_size[type] = ev.size;
+            break;
+        case VE_ACC_IO_TRACE_SYSCALL_END:
+        case VE_ACC_IO_TRACE_MEMCPY_END:
+            /* An event ending a slice follows the event beginning it */
+            if (th->begin[type - 1] != 0)
+                put_slice(out, hdr.pid, &ev,
+                          type == VE_ACC_IO_TRACE_SYSCALL_END ?
+                          "syscall" : "memcpy", t0,
+                          th->begin[type - 1], th->begin_size[type - 1]);
+            th->begin[type - 1] = 0;
+            break;
+        case VE_ACC_IO_TRACE_DMA_POST:
+            if (ev.stage < STAGE_MAX)
+                th->dma_post[ev.stage] = ev.time_ns;
+            break;
+        case VE_ACC_IO_TRACE_DMA_WAIT_END:
+            if (th->begin[type - 1] != 0)
+                put_slice(out, hdr.pid, &ev, "dma wait", t0,
+                          th->begin[type - 1], th->begin_size[type - 1]);
+            th->begin[type - 1] = 0;
+            if (ev.stage < STAGE_MAX && th->dma_post[ev.stage] != 0) {
+                put_dma(out, hdr.pid, &ev, t0, th->dma_post[ev.stage],
+                        dma_id++);
+                th->dma_post[ev.stage] = 0;
+            }
+            break;
+        }
+    }
+    fprintf(out, "\n]}\n");
+
+    fclose(in);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
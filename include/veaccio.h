@@ -0,0 +1,171 @@
+/* Copyright (C) 2018-2022 by NEC Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+/**
+ * @file    veaccio.h
+ * @brief   Header file for Accelerated I/O API.
+ */
+
+#ifndef _VEACCIO_H_
+#define _VEACCIO_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/**
+ * \addtogroup veaccio
+ *
+ * Please include "veaccio.h" to use the APIs below.
+ * Please specify "-lveaccio" option to the compiler driver to
+ * link libveaccio.
+ *
+ * Zero copy transfer registers a large user buffer to DMAATB for each
+ * request. To keep the registration of a buffer used repeatedly, add
+ * it by ve_dmaatb_cache_add() declared in "vedma.h", and call
+ * ve_dmaatb_cache_invalidate() before releasing it.
+ *
+ * Only read/write family system calls are hooked. When write-behind or
+ * writing in background is enabled, call ve_acc_io_flush() before
+ * lseek(), fsync(), close() or dup2() of the file descriptor. When
+ * read-ahead is enabled, call it before close().
+ */
+/*@{*/
+
+/* Read/write family system calls hooked by accelerated I/O */
+enum ve_acc_io_hook {
+	VE_ACC_IO_HOOK_READ,
+	VE_ACC_IO_HOOK_PREAD,
+	VE_ACC_IO_HOOK_READV,
+	VE_ACC_IO_HOOK_PREADV,
+	VE_ACC_IO_HOOK_WRITE,
+	VE_ACC_IO_HOOK_PWRITE,
+	VE_ACC_IO_HOOK_WRITEV,
+	VE_ACC_IO_HOOK_PWRITEV,
+	VE_ACC_IO_HOOK_NUM,
+};
+
+/* Statistics of accelerated I/O */
+struct ve_acc_io_stats {
+	uint64_t calls;		/*!< number of calls */
+	uint64_t bytes;		/*!< number of bytes read or written */
+	uint64_t small_io;	/*!< calls handled as normal I/O as small */
+	uint64_t nobuf;		/*!< calls handled as normal I/O due to
+				     lack of buffers */
+	uint64_t disabled;	/*!< calls handled as normal I/O due to
+				     failure of accelerated I/O */
+	uint64_t dma_wait_ns;	/*!< time waiting for DMA */
+	uint64_t syscall_ns;	/*!< time of system calls on VH */
+	uint64_t memcpy_ns;	/*!< time copying data on VE */
+	uint64_t chunk_size;	/*!< chunk size chosen by auto-tuning for
+				     the fd, 0 if not tuned */
+	uint64_t vh_chunk_ns;	/*!< time of the VH stage per chunk
+				     observed by auto-tuning for the fd */
+	uint64_t ve_chunk_ns;	/*!< time of the VE stage per chunk
+				     observed by auto-tuning for the fd */
+};
+
+/* Magic number and version of a trace file of accelerated I/O */
+#define VE_ACC_IO_TRACE_MAGIC "VEACCTRC"
+#define VE_ACC_IO_TRACE_VERSION 1
+
+/* Events recorded in a trace of accelerated I/O */
+enum ve_acc_io_trace_type {
+	VE_ACC_IO_TRACE_SYSCALL_BEGIN,	/*!< system call on VH is issued */
+	VE_ACC_IO_TRACE_SYSCALL_END,	/*!< system call on VH returned */
+	VE_ACC_IO_TRACE_DMA_POST,	/*!< DMA is posted */
+	VE_ACC_IO_TRACE_DMA_WAIT_BEGIN,	/*!< waiting for DMA is started */
+	VE_ACC_IO_TRACE_DMA_WAIT_END,	/*!< DMA is completed */
+	VE_ACC_IO_TRACE_MEMCPY_BEGIN,	/*!< copy on VE is started */
+	VE_ACC_IO_TRACE_MEMCPY_END,	/*!< copy on VE is finished */
+	VE_ACC_IO_TRACE_TYPE_NUM,
+};
+
+/* Header of a trace file, followed by nevents events */
+struct ve_acc_io_trace_header {
+	char magic[8];		/*!< VE_ACC_IO_TRACE_MAGIC */
+	uint32_t version;	/*!< VE_ACC_IO_TRACE_VERSION */
+	uint32_t event_size;	/*!< size of struct ve_acc_io_trace_event */
+	uint64_t nevents;	/*!< number of events in the file */
+	uint64_t dropped;	/*!< number of events overwritten */
+	int32_t pid;		/*!< process ID */
+	uint32_t reserved;	/*!< reserved */
+};
+
+/* Event of a trace file, in order of recording */
+struct ve_acc_io_trace_event {
+	uint64_t time_ns;	/*!< time in nanoseconds (CLOCK_MONOTONIC) */
+	int64_t size;		/*!< size of data, or result of system call */
+	int32_t tid;		/*!< thread ID */
+	int32_t fd;		/*!< file descriptor */
+	uint16_t type;		/*!< enum ve_acc_io_trace_type */
+	uint16_t hook;		/*!< enum ve_acc_io_hook */
+	uint32_t stage;		/*!< pipeline stage */
+};
+
+/* Algorithms of checksums computed by accelerated I/O */
+enum ve_acc_io_csum_algorithm {
+	VE_ACC_IO_CSUM_NONE,	/*!< no checksum */
+	VE_ACC_IO_CSUM_CRC32C,	/*!< CRC-32C (Castagnoli) */
+	VE_ACC_IO_CSUM_XXH64,	/*!< xxHash64 with seed 0 */
+};
+
+/* Running checksums of data read from and written to a fd */
+struct ve_acc_io_checksum {
+	int algorithm;		/*!< enum ve_acc_io_csum_algorithm */
+	uint64_t read_digest;	/*!< digest of data read */
+	uint64_t read_bytes;	/*!< number of bytes read */
+	uint64_t write_digest;	/*!< digest of data written */
+	uint64_t write_bytes;	/*!< number of bytes written */
+};
+
+/* Direction of data passed to a transform of accelerated I/O */
+enum ve_acc_io_transform_direction {
+	VE_ACC_IO_TRANSFORM_READ,	/*!< data read, before copied to user */
+	VE_ACC_IO_TRANSFORM_WRITE,	/*!< data to write, after copied from
+					     user */
+};
+
+/* Transform applied in place to each chunk of data of a fd,
+ * returns 0 on success, or -1 and sets errno on failure */
+typedef int (*ve_acc_io_transform_t)(void *buf, size_t size, int direction,
+		void *arg);
+
+int ve_acc_io_set_pipeline(int depth, size_t chunk_size);
+int ve_acc_io_get_pipeline(int *depth, size_t *chunk_size);
+uint64_t ve_acc_io_get_nobuf_count(void);
+int ve_acc_io_get_stats(int hook, struct ve_acc_io_stats *stats);
+int ve_acc_io_get_fd_stats(int fd, struct ve_acc_io_stats *stats);
+int ve_acc_io_set_checksum(int fd, int algorithm);
+int ve_acc_io_get_checksum(int fd, struct ve_acc_io_checksum *csum);
+int ve_acc_io_set_transform(int fd, ve_acc_io_transform_t func, void *arg);
+int ve_acc_io_prewarm(int nthreads);
+int ve_acc_io_flush(int fd);
+
+/*@}*/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _VEACCIO_H_ */
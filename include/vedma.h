@@ -47,7 +47,17 @@ extern "C" {
  *       address, you need to register memory to DMAATB.
  * @note A source and a destination of DMA data transfer needs to be
  *       aligned on a 4 byte boundary.
- * @note Data transfer size needs to be a multiple of 4 and less than 128MB.
+ * @note Data transfer size needs to be a multiple of 4 and less than 128MB,
+ *       except ve_dma_post_large() which splits a transfer of any size.
+ * @note By default, threads posting DMA and polling its completion are
+ *       serialized by a spin lock of the DMA descriptor table. Set
+ *       the environment variable VE_DMA_LOCK_FREE=1 before ve_dma_init()
+ *       to claim DMA descriptors by atomic fetch-and-add of a ticket and
+ *       to poll the completion without the lock instead, which scales
+ *       better when many threads use VE DMA at the same time. In this
+ *       mode, ve_dma_post() can wait according to the wait policy while
+ *       a thread which took the previous ticket of the descriptor writes
+ *       it, because the DMA engine processes descriptors in order.
  */
 /*@{*/
 
@@ -62,6 +72,70 @@ typedef struct ve_dma_handle {
 	int	index;
 } ve_dma_handle_t;
 
+/* Maximum number of DMA descriptors used by ve_dma_post_large() */
+#define VE_DMA_XFER_NDESC	128
+
+/**
+ * @struct ve_dma_xfer_t
+ * @brief This structure holds the state of an asynchronous DMA issued by
+ *        ve_dma_post_large().
+ * @note This structure holds internal data. Please do not access
+ *       member variables directly.
+ * @note DMA descriptors refer to the handles in this structure, so do not
+ *       move or free it until the transfer is completed.
+ */
+typedef struct ve_dma_xfer {
+	uint64_t	dst;
+	uint64_t	src;
+	uint64_t	size;
+	uint64_t	posted;
+	uint64_t	done;
+	int		status;
+	int		head;
+	int		count;
+	int		chunk[VE_DMA_XFER_NDESC];
+	ve_dma_handle_t	handle[VE_DMA_XFER_NDESC];
+} ve_dma_xfer_t;
+
+/**
+ * @brief Policies of waiting for DMA completion
+ */
+enum ve_dma_wait_policy {
+	VE_DMA_WAIT_SPIN,	/*!< Poll continuously (default) */
+	VE_DMA_WAIT_BACKOFF,	/*!< Poll with exponentially increasing
+				     intervals of busy loop */
+	VE_DMA_WAIT_YIELD,	/*!< Sleep for most of the time expected from
+				     the transfer size, and poll calling
+				     sched_yield() after polling for 20us */
+};
+
+/**
+ * @struct ve_dma_wait_stats
+ * @brief This structure holds counters of waits for DMA completion.
+ */
+struct ve_dma_wait_stats {
+	uint64_t	waits;	/*!< Number of waits not completed at the
+				     first poll */
+	uint64_t	polls;	/*!< Number of polls in the waits */
+	uint64_t	spins;	/*!< Iterations of busy loop between polls */
+	uint64_t	yields;	/*!< Number of calls of sched_yield() */
+	uint64_t	sleeps;	/*!< Number of calls of nanosleep() */
+};
+
+/**
+ * @struct ve_dma_req
+ * @brief This structure holds a DMA transfer request issued by
+ *        ve_dma_post_batch().
+ */
+struct ve_dma_req {
+	uint64_t	dst;	/*!< 4 byte aligned VE host virtual address
+				     of destination */
+	uint64_t	src;	/*!< 4 byte aligned VE host virtual address
+				     of source */
+	int		size;	/*!< Transfer size which is a multiple of 4
+				     and less than 128MB */
+};
+
 /**
  * @brief This function initializes VE DMA feature
  *
@@ -93,6 +167,81 @@ int ve_dma_init(void);
  */
 int ve_dma_post(uint64_t dst, uint64_t src, int size, ve_dma_handle_t *handle);
 
+/**
+ * @brief This function issues multiple asynchronous DMA
+ *
+ * @note This function writes the DMA transfer requests to consecutive DMA
+ *       descriptors while acquiring the lock of the DMA descriptor table
+ *       once, which costs less than calling ve_dma_post() for each request.
+ * @note When the DMA descriptor to be used next is not free, the
+ *       requests from it are not issued. Need to issue them again.
+ * @note Up to 128 requests are issued at once.
+ *
+ * @param[in] reqs DMA transfer requests
+ * @param[in] n Number of requests
+ * @param[out] handles Array of n handles used to inquire DMA completion
+ *             of each request by ve_dma_poll() or ve_dma_wait()
+ *
+ * @retval 1-n Number of requests issued from reqs[0]
+ * @retval 0 n is 0
+ * @retval -EAGAIN The DMA using the DMA descriptor to be used next is not
+ *	yet completed, so no request is issued @n
+ *	Need to call ve_dma_post_batch() again.
+ * @retval -EINVAL Invalid argument
+ */
+int ve_dma_post_batch(const struct ve_dma_req *reqs, int n,
+		ve_dma_handle_t *handles);
+
+/**
+ * @brief This function issues asynchronous DMA of any size
+ *
+ * @note The transfer is split into requests of up to 64MB, which are
+ *       written to as many DMA descriptors as available, up to the
+ *       value of the environment variable VE_DMA_XFER_MAX_DESC (1-128,
+ *       default 64). The rest is issued by ve_dma_xfer_poll() and
+ *       ve_dma_xfer_wait() when requests issued before are completed.
+ *       The limit leaves descriptors to other threads posting DMA
+ *       during a large transfer.
+ *
+ * @param[in] dst 4 byte aligned VE host virtual address of destination
+ * @param[in] src 4 byte aligned VE host virtual address of source
+ * @param[in] size Transfer size which is a multiple of 4
+ * @param[out] xfer State of the transfer used to inquire DMA completion
+ *
+ * @retval 0 On success
+ * @retval -EINVAL Invalid argument
+ */
+int ve_dma_post_large(uint64_t dst, uint64_t src, uint64_t size,
+		ve_dma_xfer_t *xfer);
+
+/**
+ * @brief This function inquiries the completion of asynchronous DMA
+ *        issued by ve_dma_post_large(), and issues the rest of the
+ *        transfer to free DMA descriptors
+ *
+ * @param[in] xfer DMA transfer issued by ve_dma_post_large()
+ *
+ * @retval 0 DMA completed normally
+ * @retval 1-65535 DMA failed @n
+ *	Exception value of DMA descriptor is returned. See ve_dma_poll().
+ *	The rest of the transfer is not issued.
+ * @retval -EAGAIN DMA has not completed yet @n
+ *	Need to call ve_dma_xfer_poll() again
+ */
+int ve_dma_xfer_poll(ve_dma_xfer_t *xfer);
+
+/**
+ * @brief This function iterates over ve_dma_xfer_poll() until it
+ *        completes the asynchronous DMA issued by ve_dma_post_large()
+ *
+ * @param[in] xfer DMA transfer issued by ve_dma_post_large()
+ *
+ * @retval 0 DMA completed normally
+ * @retval 1-65535 DMA failed @n
+ *	Exception value of DMA descriptor is returned. See ve_dma_poll().
+ */
+int ve_dma_xfer_wait(ve_dma_xfer_t *xfer);
+
 /**
  * @brief This function inquiries the completion of asynchronous DMA
  *
@@ -134,6 +283,69 @@ int ve_dma_poll(ve_dma_handle_t *handle);
  */
 int ve_dma_wait(ve_dma_handle_t *handle);
 
+/**
+ * @brief This function inquiries the completion of multiple asynchronous
+ *        DMA
+ *
+ * @note This function checks DMA descriptors of all handles in one pass,
+ *       acquiring the lock of the DMA descriptor table once.
+ * @note A handle whose DMA is completed keeps the result, so it is
+ *       reported again by the next call. Remove it from handles before
+ *       the next call. ve_dma_poll() and ve_dma_wait() for the handle
+ *       also return the result, and a handle whose result has been
+ *       returned by them is reported as completed with the result.
+ *
+ * @param[in,out] handles Array of n handles of DMA issued by ve_dma_post()
+ *                or ve_dma_post_batch()
+ * @param[in] n Number of handles
+ * @param[out] indices Indices in handles of DMA completed, in ascending
+ *             order. Array of n elements.
+ * @param[out] statuses Results of DMA completed, 0 or exception value of
+ *             DMA descriptor as ve_dma_poll() returns, in the same order
+ *             as indices. Array of n elements, or NULL if not needed.
+ *
+ * @retval 0-n Number of handles whose DMA is completed
+ * @retval -EINVAL Invalid argument
+ */
+int ve_dma_test_some(ve_dma_handle_t *handles, int n, int *indices,
+		int *statuses);
+
+/**
+ * @brief This function waits until any of multiple asynchronous DMA is
+ *        completed
+ *
+ * @note A handle whose DMA is completed keeps the result. See
+ *       ve_dma_test_some().
+ *
+ * @param[in,out] handles Array of n handles of DMA issued by ve_dma_post()
+ *                or ve_dma_post_batch()
+ * @param[in] n Number of handles
+ * @param[out] index Index in handles of DMA completed. The lowest index is
+ *             stored when multiple DMA are completed.
+ *
+ * @retval 0 DMA completed normally
+ * @retval 1-65535 DMA failed @n
+ *	Exception value of DMA descriptor is returned. See ve_dma_poll().
+ * @retval -EINVAL Invalid argument
+ */
+int ve_dma_wait_any(ve_dma_handle_t *handles, int n, int *index);
+
+/**
+ * @brief This function waits until all of multiple asynchronous DMA are
+ *        completed
+ *
+ * @param[in,out] handles Array of n handles of DMA issued by ve_dma_post()
+ *                or ve_dma_post_batch()
+ * @param[in] n Number of handles
+ *
+ * @retval 0 All DMA completed normally
+ * @retval 1-65535 Some DMA failed @n
+ *	Exception values of DMA descriptors are bitwise ORed. The result of
+ *	each DMA can be obtained by ve_dma_poll().
+ * @retval -EINVAL Invalid argument
+ */
+int ve_dma_wait_all(ve_dma_handle_t *handles, int n);
+
 /**
  * @brief This function issues synchronous DMA
  *
@@ -155,6 +367,45 @@ int ve_dma_wait(ve_dma_handle_t *handle);
  */
 int ve_dma_post_wait(uint64_t dst, uint64_t src, int size);
 
+/**
+ * @brief This function sets the policy of waiting for DMA completion
+ *
+ * @note The policy is used by ve_dma_wait(), ve_dma_wait_any(),
+ *       ve_dma_wait_all(), ve_dma_xfer_wait() and ve_dma_post_wait().
+ *       The initial policy can be also set by the environment variable
+ *       VE_DMA_WAIT_POLICY, "spin", "backoff" or "yield".
+ * @note VE_DMA_WAIT_SPIN has the lowest latency. VE_DMA_WAIT_BACKOFF
+ *       reduces the memory traffic of polling. VE_DMA_WAIT_YIELD lets
+ *       other threads use the core during long transfers, which delays
+ *       the return by the time of a system call.
+ *
+ * @param[in] policy enum ve_dma_wait_policy
+ *
+ * @retval 0 On success
+ * @retval -EINVAL Invalid argument
+ */
+int ve_dma_set_wait_policy(int policy);
+
+/**
+ * @brief This function gets the policy of waiting for DMA completion
+ *
+ * @return enum ve_dma_wait_policy
+ */
+int ve_dma_get_wait_policy(void);
+
+/**
+ * @brief This function gets counters of waits for DMA completion of the
+ *        process
+ *
+ * @param[out] stats Counters
+ */
+void ve_dma_get_wait_stats(struct ve_dma_wait_stats *stats);
+
+/**
+ * @brief This function resets counters of waits for DMA completion to 0
+ */
+void ve_dma_reset_wait_stats(void);
+
 /**
  * @brief This function gets the value of DMA Control Register
  *
@@ -167,6 +418,11 @@ void ve_dma_read_ctrl_reg(uint64_t *regs);
 uint64_t ve_register_mem_to_dmaatb(void *vemva, size_t size);
 int ve_unregister_mem_from_dmaatb(uint64_t vehva);
 
+uint64_t ve_register_mem_to_dmaatb_cached(void *vemva, size_t size);
+int ve_unregister_mem_from_dmaatb_cached(uint64_t vehva);
+int ve_dmaatb_cache_add(void *vemva, size_t size);
+void ve_dmaatb_cache_invalidate(void *vemva, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -52,9 +52,210 @@
  * ~~~
  * @note A VE process uses 32 huge pages (64MB huge pages memory),
  *       when Accelerated I/O is enabled.
- * @note Data is transferred every 4MB when accelerated I/O is
- *       enabled. So, read/write family system calls will not be
- *       atomic when the size is more than 4MB.
+ * @note Data is transferred every 4MB (VE_ACC_IO_CHUNK_SIZE) when
+ *       accelerated I/O is enabled. So, read/write family system calls
+ *       will not be atomic when the size is more than 4MB.
+ * @note For a file descriptor opened with O_DIRECT, read/pread/write/
+ *       pwrite always transfer data via the internal VH buffer with
+ *       file offsets and sizes aligned to 4KB. The unaligned head and
+ *       tail of a request are read in 4KB blocks, and written by
+ *       read-modify-write of 4KB blocks, which is not atomic with other
+ *       writes to the same blocks. O_DIRECT set by fcntl() after the
+ *       first IO of the file descriptor is not detected.
+ *
+ * Users can set the following environment variables to change the
+ * pipeline of accelerated I/O. A read/write request is divided into
+ * chunks, and the system call on VH and the DMA on VE of different
+ * chunks are processed in parallel.
+ *   - VE_ACC_IO_DEPTH The number of chunks processed in parallel.
+ *     2-16 can be specified. Default is 2.
+ *   - VE_ACC_IO_CHUNK_SIZE The size of a chunk in bytes. A suffix
+ *     "K", "M" or "G" can be added. The size needs to be a multiple
+ *     of 4KB, 64KB or more and 8MB or less. Default is 4MB.
+ *   - VE_ACC_IO_ZERO_COPY Set this to 0 to disable zero copy
+ *     transfer. When a read/write buffer is VE_ACC_IO_ZERO_COPY_MIN
+ *     bytes or more, it is registered to DMAATB and data is
+ *     transferred by DMA directly between the buffer and VH, without
+ *     copying on VE. Unaligned head and tail are copied via the
+ *     internal buffer. The buffer is registered and unregistered by
+ *     each request unless the application adds it by
+ *     ve_dmaatb_cache_add() declared in "vedma.h". The registration of
+ *     a buffer added is cached and reused by later requests for the
+ *     same buffer, so please add arrays read or written repeatedly,
+ *     and call ve_dmaatb_cache_invalidate() before releasing them. See
+ *     ve_register_mem_to_dmaatb_cached() for the environment variable
+ *     to limit the number of DMAATB entries used by the cache. Default
+ *     is 1.
+ *   - VE_ACC_IO_ZERO_COPY_MIN The minimum size in bytes of a
+ *     read/write buffer to be transferred by zero copy. Default is 16MB.
+ *   - VE_ACC_IO_ZERO_COPY_IOV_MIN The minimum size in bytes of an
+ *     element of iovec of readv/preadv/writev/pwritev to be transferred
+ *     by zero copy. Large parts of such elements are transferred by DMA
+ *     directly between the elements and VH, and the other parts are
+ *     copied via the internal buffer. Up to 16 elements per request are
+ *     transferred by zero copy. Default is 1MB.
+ *   - VE_ACC_IO_POOL_SIZE The number of buffer sets shared by all
+ *     threads. By default, each thread which requests IO allocates its
+ *     own buffer set. When this is set, threads borrow a buffer set from
+ *     the shared pool for each request instead, so the memory usage is
+ *     bounded regardless of the number of threads. 1-1024 can be
+ *     specified.
+ *   - VE_ACC_IO_POOL_WAIT The maximum time in microseconds to wait for
+ *     a buffer set when all buffer sets in the pool are used. When the
+ *     time passes, the request is handled as a normal IO. Default is
+ *     1000.
+ *   - VE_ACC_IO_POOL_IDLE_TIMEOUT A buffer set in the pool which is not
+ *     used for this time in seconds is released. It is allocated again
+ *     when needed. 0 disables releasing. Default is 10.
+ *   - VE_ACC_IO_HUGEPAGE_SIZE The page size in bytes of memory
+ *     holding the internal VE buffers. VE buffers are allocated from
+ *     areas mapped by mmap() and aligned to this size, so that each VE
+ *     buffer is in one page and VE buffers of threads share pages,
+ *     which reduces DMAATB entries and TLB misses. An area is released
+ *     when no VE buffer in it is used. 2MB-512MB (a power of 2) can be
+ *     specified. 0 allocates each VE buffer by malloc(). Default is
+ *     64MB.
+ *   - VE_ACC_IO_STREAMS The number of threads which read a large
+ *     read/pread request in parallel. The request is divided into parts,
+ *     and each part is read by pread at its own offset by a helper
+ *     thread or the calling thread. The size read and the file offset
+ *     are the same as a single read. Requests of multiple threads are
+ *     queued and share the helper threads, which are stopped at exit
+ *     and are not inherited by a child process. Requests of a file
+ *     descriptor checksummed by ve_acc_io_set_checksum() are not read
+ *     in parallel. 1-16 can be specified. Default is 1, which disables reading in
+ *     parallel.
+ *   - VE_ACC_IO_STREAM_MIN The minimum size in bytes of a read/pread
+ *     request read in parallel. Default is 256MB.
+ *   - VE_ACC_IO_READ_AHEAD The size in bytes of the read-ahead buffer
+ *     of each file descriptor. When pread() is called repeatedly for a
+ *     regular file at the offset where the previous pread() ended, the
+ *     following data is read into the buffer in advance by pread(), and
+ *     small pread() requests are served from the buffer without system
+ *     call. The file offset is never changed by read-ahead, and read()
+ *     is not read ahead because the offset it uses can be changed
+ *     without a hooked call. The data read ahead is discarded by
+ *     ve_acc_io_flush(), read(), readv(), preadv() and write family
+ *     system calls for the file descriptor. close() is not hooked, so
+ *     please call ve_acc_io_flush() before closing the file descriptor,
+ *     otherwise data read ahead for the closed file can be returned for
+ *     another file reusing the file descriptor. 0 disables read-ahead.
+ *     128MB or less can be specified. Default is 0.
+ *   - VE_ACC_IO_WRITE_BEHIND The size in bytes of the write-behind
+ *     buffer of each file descriptor. Data written to a regular file by
+ *     write() is stored in the buffer, and written by one system call
+ *     when the buffer becomes full, when the file descriptor is used by
+ *     other read/write family system calls or ve_acc_io_flush(), at
+ *     fork() and exit, or when VE_ACC_IO_WRITE_BEHIND_TIMEOUT passes.
+ *     lseek(), fsync(), fdatasync() and close() are not hooked, so
+ *     please call ve_acc_io_flush() before them, dup2() or any other
+ *     use of the file descriptor. An error of writing the buffer is
+ *     reported by the next write family system call or
+ *     ve_acc_io_flush() for the file descriptor, and displayed to
+ *     standard error at exit. The file stays open while its data is in
+ *     the buffer, so the data is written to it even if the file
+ *     descriptor is closed without ve_acc_io_flush(), e.g. by fclose().
+ *     But data written to the file descriptor reused for another file
+ *     before the buffer is written goes to the old file, so please do
+ *     not use write-behind for file descriptors of stdio streams. 0
+ *     disables write-behind. 128MB or less can be specified. Default
+ *     is 0.
+ *   - VE_ACC_IO_WRITE_BEHIND_TIMEOUT The maximum time in milliseconds
+ *     data is kept in the write-behind buffer. 0 means no limit.
+ *     Default is 1000.
+ *   - VE_ACC_IO_ASYNC_WRITE The maximum size in bytes of data written
+ *     in background. When this is set, write() and pwrite() to a
+ *     regular file copy the data and return without waiting for the
+ *     completion of writing, and a thread writes the data in the
+ *     order of requests. When the size of data being written in
+ *     background exceeds this size, write() and pwrite() wait. Other
+ *     read/write family system calls for the file descriptor and
+ *     ve_acc_io_flush() wait for the completion. Please call
+ *     ve_acc_io_flush() before lseek(), fsync(), fdatasync() or close()
+ *     of the file descriptor, which are not hooked. An error is
+ *     reported by the next write family system call or
+ *     ve_acc_io_flush() for the file descriptor, and displayed to
+ *     standard error at exit. The file stays open until the data is
+ *     written, even if the file descriptor is closed without
+ *     ve_acc_io_flush(), e.g. by fclose(). 0 disables writing in
+ *     background. Default is 0.
+ *   - VE_ACC_IO_SMALL_IO_MAX The maximum size in bytes of a read/write
+ *     request which is handled as a normal IO. The DMA transfer of
+ *     accelerated IO costs more than it saves for a small request, e.g.
+ *     a line written by stdio. By default, the size is 4096 unless
+ *     ve_acc_io_prewarm() or VE_ACC_IO_PREWARM at startup determines it
+ *     by timing reads of /dev/zero by normal IO and accelerated IO. The
+ *     threshold is never measured by a read/write request. 0 makes all
+ *     requests except empty ones handled by accelerated IO.
+ *   - VE_ACC_IO_STATS Set this to 1 to collect statistics of each
+ *     read/write family system call and each file descriptor: the
+ *     number of calls and bytes, the number of requests handled as a
+ *     normal IO and why, and the time spent waiting for DMA, in system
+ *     calls on VH and copying on VE. They can be obtained by
+ *     ve_acc_io_get_stats() and ve_acc_io_get_fd_stats(). Default is 0.
+ *   - VE_ACC_IO_STATS_FILE The path of a file the statistics are
+ *     written to in JSON at exit. "%p" in the path is replaced with the
+ *     process ID. Setting this also enables VE_ACC_IO_STATS.
+ *   - VE_ACC_IO_AUTO_TUNE Set this to 1 to tune the chunk size for each
+ *     file descriptor at run time. The time of system calls on VH and
+ *     the time of DMA and copies on VE per chunk are measured, and the
+ *     chunk size is doubled or halved while the throughput improves.
+ *     The chunk size is between 64KB and VE_ACC_IO_CHUNK_SIZE, so please
+ *     set VE_ACC_IO_CHUNK_SIZE to the largest size to try. The chosen
+ *     size can be obtained by ve_acc_io_get_fd_stats(). Default is 0.
+ *   - VE_ACC_IO_TRACE The path of a file events of the pipeline are
+ *     written to at exit: system calls on VH, posts of DMA, waits for
+ *     DMA and copies on VE, with the time, the thread and the pipeline
+ *     stage. "%p" in the path is replaced with the process ID.
+ *     examples/veaccio/trace2json converts the file to the Chrome trace
+ *     format to see how the stages overlap. The events are recorded in
+ *     a ring buffer, and the oldest ones are overwritten when it is
+ *     full.
+ *   - VE_ACC_IO_TRACE_SIZE The number of events the ring buffer of
+ *     VE_ACC_IO_TRACE can hold. Each event uses 32 bytes. Default is
+ *     262144.
+ *   - VE_ACC_IO_PREWARM The number of threads whose buffer sets are
+ *     allocated at startup by ve_acc_io_prewarm(): the main thread and
+ *     spare buffer sets taken by other threads at their first
+ *     read/write request, or buffer sets of the pool when
+ *     VE_ACC_IO_POOL_SIZE is set. DMA is also initialized and the
+ *     threshold of VE_ACC_IO_SMALL_IO_MAX is measured, so the first
+ *     request does not pay for them. A failure is displayed to standard
+ *     error at startup, and accelerated I/O is disabled if DMA cannot
+ *     be initialized. Default is 0, which allocates a buffer set at the
+ *     first read/write request of each thread.
+ *
+ * ~~~
+ * $ export VE_ACC_IO=1
+ * $ export VE_ACC_IO_DEPTH=4
+ * $ export VE_ACC_IO_CHUNK_SIZE=8M
+ * $ ./a.out
+ * ~~~
+ * @note VE and VH memory of "VE_ACC_IO_DEPTH * VE_ACC_IO_CHUNK_SIZE"
+ *       bytes, rounded up to a multiple of 8MB, is used per thread, or
+ *       per buffer set of the pool when VE_ACC_IO_POOL_SIZE is set.
+ * @note While data is kept in the write-behind buffer or written in
+ *       background, the file offset of the file descriptor in the
+ *       kernel differs from the offset seen by the user. Only read/write
+ *       family system calls are hooked, so please call ve_acc_io_flush()
+ *       declared in "veaccio.h" before other ways to see or change the
+ *       offset or close the file descriptor, e.g. lseek(), close(),
+ *       dup2() or a file descriptor duplicated by dup(). Please do not
+ *       set VE_ACC_IO_WRITE_BEHIND or VE_ACC_IO_ASYNC_WRITE if it cannot
+ *       be called, e.g. for stdio streams. Data read ahead does not
+ *       change the offset, but it has to be discarded by
+ *       ve_acc_io_flush() before the file descriptor is closed.
+ * @note The pipeline can be also changed by ve_acc_io_set_pipeline()
+ *       declared in "veaccio.h".
+ * @note When a read/write family system call is invoked while
+ *       another one is processed by the same thread, e.g. from a signal
+ *       handler, the nested request uses a secondary buffer set of the
+ *       thread, or a free buffer set of the pool when VE_ACC_IO_POOL_SIZE
+ *       is set. The secondary buffer set is allocated by the next
+ *       request after the first nested request, which is handled as a
+ *       normal IO. The number of requests handled as a normal IO because
+ *       no buffer was available can be obtained by
+ *       ve_acc_io_get_nobuf_count().
  *
  * Users can set the environment variable VE_ACC_IO_VERBOSE=1 to display
  * whether accelerated IO is enabled or disabled to standard error when
@@ -75,7 +276,13 @@
 
 #ifdef HAVE_IO_HOOK_H
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	/* O_DIRECT */
+#endif
 #include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sysve.h>
@@ -87,15 +294,23 @@
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
 #include <veshm.h>
 #include "vedma.h"
 #include <io_hook.h>
 #include <veacc_io_defs.h>
 #include "libsysve.h"
 #include "libsysve_utils.h"
+#include "veaccio.h"
+#include "accelerated_io_csum.h"
 #include <signal.h>
 
 #define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
 #define GET_DMA_SIZE(a) ((a + 0x3) & 0xfffffffffffffffc)
 
 #define SYSCALL_CANCEL(a,...) \
@@ -115,14 +330,98 @@
 #define ENV_KEY_ATOMIC "VE_ATOMIC_IO"
 #define ENV_KEY_VE_ACC_IO "VE_ACC_IO"
 
+#define ENV_KEY_DEPTH "VE_ACC_IO_DEPTH"
+#define ENV_KEY_CHUNK_SIZE "VE_ACC_IO_CHUNK_SIZE"
+#define ENV_KEY_ZERO_COPY "VE_ACC_IO_ZERO_COPY"
+#define ENV_KEY_ZERO_COPY_MIN "VE_ACC_IO_ZERO_COPY_MIN"
+#define ENV_KEY_ZERO_COPY_IOV_MIN "VE_ACC_IO_ZERO_COPY_IOV_MIN"
+#define ENV_KEY_POOL_SIZE "VE_ACC_IO_POOL_SIZE"
+#define ENV_KEY_POOL_WAIT "VE_ACC_IO_POOL_WAIT"
+#define ENV_KEY_POOL_IDLE_TIMEOUT "VE_ACC_IO_POOL_IDLE_TIMEOUT"
+#define ENV_KEY_SMALL_IO_MAX "VE_ACC_IO_SMALL_IO_MAX"
+#define ENV_KEY_READ_AHEAD "VE_ACC_IO_READ_AHEAD"
+#define ENV_KEY_WRITE_BEHIND "VE_ACC_IO_WRITE_BEHIND"
+#define ENV_KEY_WRITE_BEHIND_TIMEOUT "VE_ACC_IO_WRITE_BEHIND_TIMEOUT"
+#define ENV_KEY_ASYNC_WRITE "VE_ACC_IO_ASYNC_WRITE"
+#define ENV_KEY_STREAMS "VE_ACC_IO_STREAMS"
+#define ENV_KEY_STREAM_MIN "VE_ACC_IO_STREAM_MIN"
+#define ENV_KEY_STATS "VE_ACC_IO_STATS"
+#define ENV_KEY_STATS_FILE "VE_ACC_IO_STATS_FILE"
+#define ENV_KEY_TRACE "VE_ACC_IO_TRACE"
+#define ENV_KEY_TRACE_SIZE "VE_ACC_IO_TRACE_SIZE"
+#define ENV_KEY_AUTO_TUNE "VE_ACC_IO_AUTO_TUNE"
+#define ENV_KEY_HUGEPAGE_SIZE "VE_ACC_IO_HUGEPAGE_SIZE"
+#define ENV_KEY_PREWARM "VE_ACC_IO_PREWARM"
+
+/* Size of a buffer registered by VE_SYSVE_ACCELERATED_IO_INIT2 */
 #define VE_BUFF_SIZE (8*1024*1024)
 
+/* Page size of areas holding VE buffers */
+#define ACC_IO_HUGEPAGE_SIZE_DEFAULT (64*1024*1024)
+#define ACC_IO_HUGEPAGE_SIZE_MIN (2*1024*1024)
+#define ACC_IO_HUGEPAGE_SIZE_MAX (512*1024*1024)
+
 #define VE_BUFF_USING 1
 #define VE_BUFF_NOT_USING 0
 
 #define BUFF_NPARAS 2
 #define PARAS_SIZE VE_BUFF_SIZE/BUFF_NPARAS
 
+#define BUFF_NPARAS_MIN 2
+#define BUFF_NPARAS_MAX 16
+#define PARAS_SIZE_MIN (64*1024)
+#define PARAS_SIZE_MAX VE_BUFF_SIZE
+#define PARAS_SIZE_ALIGN (4*1024)
+
+#define ZERO_COPY_MIN (16*1024*1024)
+#define ZERO_COPY_IOV_MIN (1024*1024)
+
+#define ACC_IO_IOV_REG_MAX 16	/* registered iovec elements per request */
+#define ACC_IO_SG_PART_MIN (64*1024)	/* minimum size of direct transfer */
+#define ACC_IO_SG_DIRECT_MAX 8	/* direct transfers per pipeline stage */
+#define ACC_IO_SG_HANDLE_MAX (ACC_IO_SG_DIRECT_MAX*2+1)
+
+#define ACC_IO_SG_READ_POST 0	/* post DMA from VH buffer */
+#define ACC_IO_SG_READ_COPY 1	/* copy from VE buffer to iovec */
+#define ACC_IO_SG_WRITE_COPY 2	/* copy from iovec to VE buffer */
+#define ACC_IO_SG_WRITE_POST 3	/* post DMA to VH buffer */
+
+#define ACC_IO_POOL_MAX 1024
+#define ACC_IO_POOL_WAIT_DEFAULT 1000	/* microseconds */
+#define ACC_IO_POOL_WAIT_STEP 10	/* microseconds */
+#define ACC_IO_POOL_IDLE_TIMEOUT_DEFAULT 10	/* seconds */
+#define ACC_IO_POOL_RECLAIM_INTERVAL 1	/* seconds */
+
+#define SMALL_IO_MAX_DEFAULT (4*1024)
+#define SMALL_IO_CALIB_MIN 512
+#define SMALL_IO_CALIB_MAX (256*1024)
+#define SMALL_IO_CALIB_ITERS 8
+
+#define ACC_IO_CALIB_NONE 0
+#define ACC_IO_CALIB_RUNNING 1
+#define ACC_IO_CALIB_DONE 2
+
+#define ACC_IO_FD_MAX 65536
+#define READ_AHEAD_MAX (128*1024*1024)
+#define READ_AHEAD_SEQ_MIN 2	/* consecutive preads to start read-ahead */
+#define WRITE_BEHIND_MAX (128*1024*1024)
+#define WRITE_BEHIND_TIMEOUT_DEFAULT 1000	/* milliseconds */
+
+#define ACC_IO_STREAMS_MAX 16
+#define ACC_IO_STREAM_MIN_DEFAULT (256*1024*1024)
+
+#define ACC_IO_TRACE_SIZE_DEFAULT (256*1024)	/* events */
+
+#define ACC_IO_DIRECT_ALIGN 4096	/* alignment of IO of O_DIRECT fd */
+#define ACC_IO_DIRECT_ALIGNED(a) \
+	(((uint64_t)(a) & (ACC_IO_DIRECT_ALIGN - 1)) == 0)
+#define ACC_IO_FD_UNKNOWN 0	/* open flags of fd are not checked yet */
+#define ACC_IO_FD_BUFFERED 1	/* fd is opened without O_DIRECT */
+#define ACC_IO_FD_DIRECT 2	/* fd is opened with O_DIRECT */
+
+#define ACC_IO_TUNE_WINDOW 4	/* requests measured per step */
+#define ACC_IO_TUNE_HOLD 16	/* windows to keep the chosen chunk size */
+
 #define SUCCESS 0
 #define FAIL -1
 #define NOBUF 1
@@ -131,26 +430,189 @@
 #define SIZE_BY_CORE 2
 
 typedef struct {
-	uint64_t vh_buff_and_flag[BUFF_NPARAS];	/*!< VH buffer adress and bit flag */
-	uint64_t ve_buff[BUFF_NPARAS];	/*!< VE buffer */
-	uint64_t vh_vehva[BUFF_NPARAS];	/*!< vehva of VH buffer */
-	uint64_t ve_vehva[BUFF_NPARAS];	/*!< vehva of VE buffer */
+	uint64_t vh_buff_and_flag[BUFF_NPARAS_MAX];	/*!< VH buffer adress and bit flag */
+	uint64_t ve_buff[BUFF_NPARAS_MAX];	/*!< VE buffer */
+	uint64_t vh_vehva[BUFF_NPARAS_MAX];	/*!< vehva of VH buffer */
+	uint64_t ve_vehva[BUFF_NPARAS_MAX];	/*!< vehva of VE buffer */
+	int nparas;	/*!< number of pipeline stages */
+	ssize_t paras_size;	/*!< size of each pipeline stage */
 	int vh_mask;	/*!< mask for get flag status of VH buffer */
+	struct acc_io_pool_slot *slot;	/*!< slot of the pool, NULL if not borrowed */
+	int nested;	/*!< 1 if this is a nested IO request */
+	ssize_t chunk_max;	/*!< size of each pipeline stage in buffers */
+	uint64_t tune_start;	/*!< start time of request, 0 if not tuned */
 } acc_io_info;
 
+/* A user buffer registered to DMAATB for zero copy transfer */
+typedef struct {
+	uint64_t vehva;	/*!< vehva of addr, 0 if not registered */
+	uint64_t addr;	/*!< start address of user buffer */
+} acc_io_user_reg;
+
+/* iovec elements registered to DMAATB for scatter-gather transfer */
+typedef struct {
+	int nregs;	/*!< number of registered elements */
+	int idx[ACC_IO_IOV_REG_MAX];	/*!< index of iovec element */
+	acc_io_user_reg reg[ACC_IO_IOV_REG_MAX];
+} acc_io_iov_regs;
+
+/* Position in iovec */
+typedef struct {
+	int n;	/*!< index of iovec element */
+	ssize_t done;	/*!< size of data processed in the element */
+} acc_io_iov_pos;
+
+/* Check whether data can be transferred directly to/from user buffer */
+#define ACC_IO_CAN_DIRECT(reg, buf, size) \
+	((reg)->vehva != 0 && ((uint64_t)(buf) & 0x3) == 0 \
+	 && ((size) & 0x3) == 0)
+
+/* Get vehva of user buffer */
+#define ACC_IO_USER_VEHVA(reg, buf) \
+	((reg)->vehva + ((uint64_t)(buf) - (reg)->addr))
+
+/* Get the start time of a statistic, 0 if nothing needs the time */
+#define ACC_IO_STATS_NOW() \
+	(acc_io_timing ? ve_accelerated_io_now_nsec() : 0)
+
+/* Add a value to a field of statistics of a hook and a file descriptor */
+#define ACC_IO_STATS_ADD(syscall_num, fd, field, val) \
+	do { \
+		if (acc_io_stats_enabled) { \
+			ve_accelerated_io_stats_add((syscall_num), (fd), \
+				offsetof(struct ve_acc_io_stats, field), \
+				(val)); \
+		} \
+	} while (0)
+
+/* Add the time since ACC_IO_STATS_NOW() to a field of statistics, and
+ * to the time of the request for auto-tuning */
+#define ACC_IO_STATS_TIME(syscall_num, fd, field, t) \
+	do { \
+		if ((t) != 0) { \
+			uint64_t d_stats = ve_accelerated_io_now_nsec() - (t); \
+			acc_io_req_stats.field += d_stats; \
+			ACC_IO_STATS_ADD(syscall_num, fd, field, d_stats); \
+		} \
+	} while (0)
+
+/* Record an event of a pipeline stage to the trace */
+#define ACC_IO_TRACE(syscall_num, fd, type, stage, size) \
+	do { \
+		if (acc_io_trace != NULL) { \
+			ve_accelerated_io_trace((syscall_num), (fd), \
+				VE_ACC_IO_TRACE_##type, (stage), \
+				(int64_t)(size)); \
+		} \
+	} while (0)
+
+/* Count a call of a hook and the number of bytes read or written */
+#define ACC_IO_STATS_CALL(syscall_num, fd, ret) \
+	do { \
+		ACC_IO_STATS_ADD(syscall_num, fd, calls, 1); \
+		if ((ret) > 0) { \
+			ACC_IO_STATS_ADD(syscall_num, fd, bytes, \
+					(uint64_t)(ret)); \
+		} \
+	} while (0)
+
 static int constructor_result = ACCELERATED_IO;
 
+/* Configuration of zero copy transfer */
+static int acc_io_zero_copy = 1;
+static ssize_t acc_io_zero_copy_min = ZERO_COPY_MIN;
+static ssize_t acc_io_zero_copy_iov_min = ZERO_COPY_IOV_MIN;
+
+/* IO requests of this size or less are handled as normal IO */
+static ssize_t acc_io_small_io_max = SMALL_IO_MAX_DEFAULT;
+
+/* State of calibration of acc_io_small_io_max */
+static volatile int acc_io_calib_state = ACC_IO_CALIB_NONE;
+
+/* Set while this thread calibrates acc_io_small_io_max */
+static __thread int acc_io_calibrating = 0;
+
+/* Pipeline configuration of this process */
+static struct {
+	int nparas;	/*!< number of pipeline stages */
+	ssize_t paras_size;	/*!< size of each pipeline stage */
+	int generation;	/*!< incremented when the configuration changes */
+} acc_io_conf = {
+	.nparas = BUFF_NPARAS,
+	.paras_size = PARAS_SIZE,
+	.generation = 0,
+};
+
+static pthread_mutex_t acc_io_conf_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* An area of huge pages which holds VE buffers */
+typedef struct acc_io_staging_area {
+	char *addr;	/*!< start address aligned to the page size */
+	size_t size;	/*!< size of the area */
+	uint64_t used;	/*!< bit mask of VE buffers in use */
+	struct acc_io_staging_area *next;
+} acc_io_staging_area;
+
+/* List of areas holding VE buffers, and the page size of them.
+ * The page size is 0 if VE buffers are allocated by malloc() */
+static acc_io_staging_area *acc_io_staging = NULL;
+static size_t acc_io_hugepage_size = ACC_IO_HUGEPAGE_SIZE_DEFAULT;
+static pthread_mutex_t acc_io_staging_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* A VE buffer and a VH buffer registered by VE_SYSVE_ACCELERATED_IO_INIT2 */
 typedef struct {
 	uint64_t local_vehva;
 	uint64_t vehva;
 	uint64_t vh_buff;
-	uint64_t ve_io_buff[VE_BUFF_SIZE/sizeof(uint64_t)];
+	void *ve_io_buff;	/*!< VE buffer of VE_BUFF_SIZE bytes */
+	acc_io_staging_area *area;	/*!< area of ve_io_buff, NULL if
+					     allocated by malloc() */
+} acc_io_buffer;
+
+typedef struct acc_io_resources {
+	int nparas;	/*!< number of pipeline stages */
+	ssize_t paras_size;	/*!< size of each pipeline stage */
+	int generation;	/*!< generation of acc_io_conf used to allocate */
+	int fork_gen;	/*!< acc_io_fork_gen when allocated */
+	int nbuffs;	/*!< number of registered buffers */
+	acc_io_buffer *buff[BUFF_NPARAS_MAX];
+	struct acc_io_resources *nested;	/*!< secondary resources for nested IO request */
 	void *next;
 	void *prev;
 } acc_io_resources;
 
 static pthread_key_t acc_io_resources_key;
 
+/* The number of fork() in the history of this process. Resources
+ * allocated before fork() are released lazily in the child. */
+static volatile int acc_io_fork_gen = 0;
+
+/* acc_io_fork_gen when resources of exited threads were released */
+static volatile int acc_io_fork_swept = 0;
+
+/* Resources of the thread which called fork(), released by the thread */
+static acc_io_resources *acc_io_fork_own = NULL;
+
+/* Resources allocated by ve_acc_io_prewarm() for threads which have not
+ * requested IO yet, linked by next and protected by
+ * acc_io_resources_list_lock */
+static acc_io_resources *acc_io_spare = NULL;
+static int acc_io_nspares = 0;
+
+/* A slot of the pool of accelerated IO resources shared by threads */
+typedef struct acc_io_pool_slot {
+	volatile int busy;	/*!< VE_BUFF_USING while borrowed */
+	acc_io_resources *res;	/*!< resources, NULL if not allocated */
+	uint64_t last_used;	/*!< time in seconds when returned */
+} acc_io_pool_slot;
+
+static acc_io_pool_slot *acc_io_pool = NULL;
+static int acc_io_pool_size = 0;
+static uint64_t acc_io_pool_wait = ACC_IO_POOL_WAIT_DEFAULT;
+static uint64_t acc_io_pool_idle_timeout = ACC_IO_POOL_IDLE_TIMEOUT_DEFAULT;
+static uint64_t acc_io_pool_last_reclaim = 0;
+static __thread int acc_io_pool_hint = 0;
+
 static pthread_mutex_t acc_io_resources_list_lock = PTHREAD_MUTEX_INITIALIZER;
 static acc_io_resources list_head = {
        .next = NULL,
@@ -158,9 +620,218 @@ static acc_io_resources list_head = {
 };
 
 static void ve_accelerated_io_release_resource(acc_io_resources *, int);
+static ssize_t ve_accelerated_io_read_pread(int, int, void *, size_t, off_t);
+static ssize_t ve_accelerated_io_write_pwrite(int, int, const void *, size_t,
+		off_t);
 
 static __thread int ve_buff_using_flag = VE_BUFF_NOT_USING;
 
+/* Flag of the secondary buffer used by a nested IO request */
+static __thread int ve_nested_buff_using_flag = VE_BUFF_NOT_USING;
+
+/* Set when a nested IO request needs the secondary buffer */
+static __thread int acc_io_nested_wanted = 0;
+
+/* The number of IO requests handled as normal IO due to lack of buffer */
+static uint64_t acc_io_nobuf_count = 0;
+
+/* State of auto-tuning of the chunk size for a file descriptor */
+typedef struct {
+	volatile int lock;	/*!< VE_BUFF_USING while updated */
+	ssize_t chunk;	/*!< chunk size chosen, 0 if not tuned yet */
+	ssize_t prev;	/*!< chunk size before the last step */
+	int dir;	/*!< 1 if growing, -1 if shrinking, 0 if not probing */
+	int hold;	/*!< number of windows to keep the chunk size */
+	uint64_t rate;	/*!< throughput of the last window */
+	int reqs;	/*!< number of requests in the current window */
+	uint64_t bytes;	/*!< bytes transferred in the current window */
+	uint64_t ns;	/*!< time of requests in the current window */
+	uint64_t vh_ns;	/*!< time of VH stage in the current window */
+	uint64_t ve_ns;	/*!< time of VE stage in the current window */
+	uint64_t chunks;	/*!< number of chunks in the current window */
+} acc_io_tune;
+
+/* State of accelerated IO for each file descriptor */
+typedef struct {
+	volatile int lock;	/*!< VE_BUFF_USING while locked */
+	int is_reg;	/*!< 1 if regular file, 0 if not, -1 if unknown */
+	int seq;	/*!< number of consecutive pread() */
+	char *ra_buff;	/*!< read-ahead buffer */
+	off_t ra_off;	/*!< file offset of ra_buff */
+	ssize_t ra_len;	/*!< size of data in ra_buff */
+	ssize_t ra_pos;	/*!< end of the last pread() from ra_off */
+	char *wb_buff;	/*!< write-behind buffer */
+	ssize_t wb_len;	/*!< size of data in wb_buff */
+	uint64_t wb_time;	/*!< time in milliseconds when wb_buff got data */
+	int wb_pin;	/*!< duplicate of the fd + 1 while wb_buff has data, 0 if none */
+	dev_t wb_dev;	/*!< device of the file data in wb_buff is written to */
+	ino_t wb_ino;	/*!< inode of the file data in wb_buff is written to */
+	volatile int err;	/*!< errno of write failed after returning, 0 if none */
+	volatile int async_pending;	/*!< number of writes in background,
+					     changed under acc_io_async.lock */
+	int prev_locked;	/*!< acc_io_fd_locked before this is locked */
+	struct ve_acc_io_stats stats;	/*!< statistics of the fd */
+	acc_io_tune tune;	/*!< auto-tuning of the chunk size */
+	volatile int csum_lock;	/*!< VE_BUFF_USING while checksummed */
+	int csum_algorithm;	/*!< enum ve_acc_io_csum_algorithm */
+	acc_io_csum csum_read;	/*!< checksum of data read */
+	acc_io_csum csum_write;	/*!< checksum of data written */
+	ve_acc_io_transform_t xform;	/*!< transform of data, NULL if none */
+	void *xform_arg;	/*!< argument of xform */
+} acc_io_fd_state;
+
+/* Transform of data of a request */
+typedef struct {
+	ve_acc_io_transform_t func;	/*!< transform, NULL if none */
+	void *arg;	/*!< argument of func */
+} acc_io_xform;
+
+/* Table of acc_io_fd_state indexed by file descriptor,
+ * NULL if no feature needs the state of file descriptors */
+static acc_io_fd_state * volatile *acc_io_fds = NULL;
+static int acc_io_fd_max = 0;
+
+/* File descriptor + 1 whose state is locked by this thread, 0 if none */
+static __thread int acc_io_fd_locked = 0;
+
+/* ACC_IO_FD_* of each file descriptor, NULL if not available */
+static unsigned char *acc_io_fd_mode = NULL;
+
+/* 1 while this thread processes an aligned part of O_DIRECT IO */
+static __thread int acc_io_direct_part = 0;
+
+/* The number of file descriptors whose data is checksummed */
+static volatile int acc_io_csum_fds = 0;
+
+/* Checksum updated by copies of the request of this thread, and bytes
+ * added to it from the start of the user buffer, NULL if none */
+static __thread acc_io_csum *acc_io_csum_cur = NULL;
+static __thread size_t acc_io_csum_done = 0;
+
+/* The number of file descriptors whose data is transformed */
+static volatile int acc_io_xform_fds = 0;
+
+/* 1 while this thread processes a request of a checksummed fd */
+static __thread int acc_io_csum_busy = 0;
+
+/* Checksum of a request saved by ve_accelerated_io_csum_begin() */
+typedef struct {
+	acc_io_fd_state *st;	/*!< state of the fd, NULL if not checksummed */
+	acc_io_csum *cs;	/*!< checksum updated by the request */
+	acc_io_csum saved;	/*!< cs before the request, to remove data
+				     copied but not read or written */
+	acc_io_csum *prev_cur;	/*!< acc_io_csum_cur of the outer request */
+	size_t prev_done;	/*!< acc_io_csum_done of the outer request */
+	int prev_busy;	/*!< acc_io_csum_busy of the outer request */
+} acc_io_csum_ctx;
+
+/* 1 if statistics are collected */
+static int acc_io_stats_enabled = 0;
+
+/* Statistics of each hook */
+static struct ve_acc_io_stats acc_io_hook_stats[VE_ACC_IO_HOOK_NUM];
+
+/* Path of the file statistics are written to at exit, NULL if none */
+static const char *acc_io_stats_file = NULL;
+
+/* 1 if the chunk size is tuned for each file descriptor */
+static int acc_io_auto_tune = 0;
+
+/* 1 if statistics or auto-tuning needs the time of pipeline stages */
+static int acc_io_timing = 0;
+
+/* Time of pipeline stages of the current request of this thread */
+static __thread struct ve_acc_io_stats acc_io_req_stats;
+
+/* Ring buffer of trace events, NULL if tracing is disabled */
+static struct ve_acc_io_trace_event *acc_io_trace = NULL;
+static uint64_t acc_io_trace_size = 0;	/* number of events in the ring */
+static uint64_t acc_io_trace_next = 0;	/* number of events recorded */
+static const char *acc_io_trace_file = NULL;
+
+/* Thread ID recorded in trace events, 0 if not got yet */
+static __thread int acc_io_trace_tid = 0;
+
+/* Size of read-ahead buffer, 0 if read-ahead is disabled */
+static ssize_t acc_io_read_ahead = 0;
+
+/* Size of write-behind buffer, 0 if write-behind is disabled */
+static ssize_t acc_io_write_behind = 0;
+static uint64_t acc_io_write_behind_timeout = WRITE_BEHIND_TIMEOUT_DEFAULT;
+static int acc_io_flusher_started = 0;
+
+/* A write request processed in background */
+typedef struct acc_io_async_req {
+	struct acc_io_async_req *next;
+	int syscall_num;	/*!< SYS_write or SYS_pwrite64 */
+	int fd;	/*!< duplicate of the fd, closed when written */
+	off_t ofs;
+	size_t count;
+	acc_io_fd_state *st;	/*!< state of fd */
+	char data[];	/*!< copy of data to write */
+} acc_io_async_req;
+
+/* Queue of write requests processed in background */
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;	/*!< signaled when a request is queued */
+	pthread_cond_t done;	/*!< signaled when a request is written */
+	acc_io_async_req *head;
+	acc_io_async_req *tail;
+	int started;	/*!< 1 if the writer thread is started */
+} acc_io_async = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+	.head = NULL,
+	.tail = NULL,
+	.started = 0,
+};
+
+/* Maximum size of data written in background, 0 if disabled */
+static ssize_t acc_io_async_write = 0;
+/* Size of data queued or being written, protected by acc_io_async.lock */
+static ssize_t acc_io_async_bytes = 0;
+
+/* A read request divided into parts processed by multiple threads. It is
+ * on the stack of the requesting thread, and the fields changed by other
+ * threads are protected by acc_io_stream.lock. */
+typedef struct acc_io_stream_job {
+	struct acc_io_stream_job *next;	/*!< next job with parts not taken */
+	int fd;
+	char *buf;
+	off_t ofs;
+	size_t count;
+	size_t part_size;
+	int nparts;
+	int next_part;	/*!< next part to be taken */
+	int ndone;	/*!< number of parts processed */
+	ssize_t result[ACC_IO_STREAMS_MAX];	/*!< size read for each part */
+	int err[ACC_IO_STREAMS_MAX];	/*!< errno for each part */
+} acc_io_stream_job;
+
+/* Queue of read requests processed by helper threads */
+static struct {
+	pthread_mutex_t lock;	/*!< lock of the fields below and jobs */
+	pthread_cond_t cond;	/*!< signaled when a job is queued */
+	pthread_cond_t done;	/*!< signaled when a job is completed */
+	acc_io_stream_job *head;	/*!< jobs with parts not taken */
+	int nworkers;	/*!< number of helper threads started */
+	int shutdown;	/*!< 1 when helper threads are stopped */
+	pthread_t workers[ACC_IO_STREAMS_MAX];	/*!< helper threads */
+} acc_io_stream = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+};
+
+/* Number of threads which process a large read request, 1 if disabled */
+static int acc_io_streams = 1;
+static ssize_t acc_io_stream_min = ACC_IO_STREAM_MIN_DEFAULT;
+
+/* Set while this thread processes a part of a read request */
+static __thread int acc_io_stream_part = 0;
+
 /* Mask all signal while locking acc_io_resources_list_lock */
 static sigset_t acc_io_sigset;
 
@@ -204,227 +875,3007 @@ static int ve_accelerated_io_chk_env_init_dma(void)
 }
 
 /**
- * @brief This function get following information of accelerated IO resources
- * from Libsysve global variable vh_resources.
- * VH IO buffer
- * VE IO buffer
- * VEHVA of VH IO buffer
- * VEHVA of VE IO buffer
+ * @brief This function validates the pipeline configuration.
+ *
+ * @param[in] nparas Number of pipeline stages
+ * @param[in] paras_size Size of each pipeline stage
  *
  * @retval 0 on success, -1 on failure.
  */
+static int ve_accelerated_io_check_pipeline(int nparas, ssize_t paras_size)
+{
+	if (nparas < BUFF_NPARAS_MIN || nparas > BUFF_NPARAS_MAX) {
+		return FAIL;
+	}
+	if (paras_size < PARAS_SIZE_MIN || paras_size > PARAS_SIZE_MAX
+			|| (paras_size % PARAS_SIZE_ALIGN) != 0) {
+		return FAIL;
+	}
+	return SUCCESS;
+}
 
 /**
- * @brief This function handle pre-processing of IO request.
- * 
- * @param [out] struct acc_io_info
+ * @brief This function gets a size from environment variable.
+ * The size can have a suffix "K", "M" or "G".
  *
- * @retval 0 on success, -1 on failure.
+ * @param[in] name Name of environment variable
+ * @param[out] size Size specified by environment variable
+ *
+ * @retval 0 on success, -1 on failure or when it is not set.
  */
-static int ve_accelerated_io_pre(acc_io_info *io_info)
+static int ve_accelerated_io_getenv_size(const char *name, ssize_t *size)
 {
-	int i;
-	int ret = SUCCESS;
-	int retval = SUCCESS;
-	int errno_bak = errno;
-	uint64_t vh_buff;
-	io_info->vh_mask = 1;
-
-	void *vhva;
-	uint64_t vehva = 0;
-	uint64_t local_vehva = 0;
+	char *env_val;
+	char *ptr;
+	long long val;
+	long long mult = 1;
 
-	acc_io_resources* acc_io_res;
-
-	pthread_testcancel();
-
-	if (PDMA_IO == constructor_result) {
+	env_val = getenv(name);
+	if (env_val == NULL || *env_val == '\0') {
 		return FAIL;
 	}
-
-	/* Checks VE IO buffer is using or not by flag ve_buff_using_flag */
-	retval = __libsysve_a_swap(&ve_buff_using_flag,VE_BUFF_USING);
-	if(retval != VE_BUFF_NOT_USING){
-		errno = errno_bak;
-		return NOBUF;
+	errno = 0;
+	val = strtoll(env_val, &ptr, 10);
+	if (errno != 0 || val < 0) {
+		return FAIL;
 	}
-
-	acc_io_res = pthread_getspecific(acc_io_resources_key);
-	if(acc_io_res == NULL){
-		/* When first IO request, check environment */
-		if(ACCELERATED_IO != ve_accelerated_io_chk_env_init_dma()){
-			retval = FAIL;
-			goto error_unlock_ve;
-		}
-		acc_io_res = (acc_io_resources *)malloc(sizeof(acc_io_resources));
-		if(acc_io_res == NULL){
-			retval = FAIL;
-			goto error_unlock_ve;
-		}
-		ret = (int)syscall(SYS_sysve,
-				VE_SYSVE_ACCELERATED_IO_INIT2,&vhva, &vehva,
-			&(acc_io_res->ve_io_buff), &local_vehva);
-		if (SUCCESS != ret) {
-			free(acc_io_res);
-			retval = NOBUF;
-			goto error_unlock_ve;
-		}
-
-		acc_io_res->vh_buff =(uint64_t) vhva;
-                acc_io_res->vehva = vehva;
-                acc_io_res->local_vehva = local_vehva;
-
-		acc_io_res->next = NULL;
-		acc_io_res->prev = NULL;
-		if(pthread_setspecific(acc_io_resources_key, (void *) acc_io_res)){
-			retval = FAIL;
-			ve_accelerated_io_release_resource(acc_io_res, 0);
-			goto error_unlock_ve;
-		}
-
-		pthread_sigmask(SIG_BLOCK, &acc_io_sigset, &acc_io_sigset_old);
-		pthread_mutex_lock(&acc_io_resources_list_lock);
-
-		acc_io_res->next = list_head.next;
-		acc_io_res->prev = &list_head;
-		if(list_head.next != NULL){
-			((acc_io_resources *)list_head.next)->prev = acc_io_res;
-		}
-		list_head.next = acc_io_res;
-		pthread_mutex_unlock(&acc_io_resources_list_lock);
-		pthread_sigmask(SIG_SETMASK, &acc_io_sigset_old, NULL);
-
-		ret = SUCCESS;
+	switch (*ptr) {
+	case 'K': case 'k':
+		mult = 1024;
+		ptr++;
+		break;
+	case 'M': case 'm':
+		mult = 1024 * 1024;
+		ptr++;
+		break;
+	case 'G': case 'g':
+		mult = 1024 * 1024 * 1024;
+		ptr++;
+		break;
 	}
+	if (strlen(ptr) != 0 || val > LLONG_MAX / mult) {
+		return FAIL;
+	}
+	*size = (ssize_t)(val * mult);
+	return SUCCESS;
+}
 
-	vh_buff = acc_io_res->vh_buff;
+/**
+ * @brief This function gets a non-negative integer from environment
+ * variable. Unlike ve_accelerated_io_getenv_size(), no suffix is allowed.
+ *
+ * @param[in] name Name of environment variable
+ * @param[out] num Integer specified by environment variable
+ *
+ * @retval 0 on success, -1 on failure or when it is not set.
+ */
+static int ve_accelerated_io_getenv_int(const char *name, int *num)
+{
+	char *env_val;
+	char *ptr;
+	long val;
 
-	for (i = 0; i < BUFF_NPARAS; i++) {
-		io_info->ve_buff[i] = (uint64_t)(acc_io_res->ve_io_buff)
-			+ PARAS_SIZE * i;
-		io_info->vh_vehva[i] = acc_io_res->vehva
-			+ PARAS_SIZE * i;
-		io_info->ve_vehva[i] = acc_io_res->local_vehva
-			+ PARAS_SIZE * i;
+	env_val = getenv(name);
+	if (env_val == NULL || *env_val == '\0') {
+		return FAIL;
 	}
-
-	/* Set accelerated io bit flag to VHVA */
-	for (i = 0; i < BUFF_NPARAS; i++) {
-		io_info->vh_buff_and_flag[i]
-			= (vh_buff | VE_ACCELERATED_IO_FLAG)
-			+ PARAS_SIZE * i;
+	errno = 0;
+	val = strtol(env_val, &ptr, 10);
+	if (errno != 0 || val < 0 || val > INT_MAX || *ptr != '\0') {
+		return FAIL;
 	}
+	*num = (int)val;
 	return SUCCESS;
-
-error_unlock_ve:
-	/* Free flag ve_buff_using_flag */
-	__libsysve_a_swap(&ve_buff_using_flag,
-			VE_BUFF_NOT_USING);
-	errno = errno_bak;
-	return retval;
 }
 
 /**
- * @brief This function is register to pthread_atfork() and called before fork.
- * */
-static void ve_accelerated_io_atfork_prepare(){
-	pthread_sigmask(SIG_BLOCK, &acc_io_sigset, &acc_io_sigset_old);
-	pthread_mutex_lock(&acc_io_resources_list_lock);
+ * @brief This function reads the pipeline configuration from
+ * environment variables VE_ACC_IO_DEPTH, VE_ACC_IO_CHUNK_SIZE,
+ * VE_ACC_IO_ZERO_COPY, VE_ACC_IO_ZERO_COPY_MIN,
+ * VE_ACC_IO_ZERO_COPY_IOV_MIN, VE_ACC_IO_STREAMS, VE_ACC_IO_STREAM_MIN
+ * and VE_ACC_IO_SMALL_IO_MAX.
+ * Invalid values are ignored.
+ */
+static void ve_accelerated_io_init_pipeline(void)
+{
+	int nparas = acc_io_conf.nparas;
+	ssize_t paras_size = acc_io_conf.paras_size;
+	ssize_t val;
+	int num;
+
+	if (SUCCESS == ve_accelerated_io_getenv_int(ENV_KEY_DEPTH, &num)
+			&& num <= BUFF_NPARAS_MAX) {
+		nparas = num;
+	}
+	if (SUCCESS == ve_accelerated_io_getenv_size(ENV_KEY_CHUNK_SIZE,
+				&val)) {
+		paras_size = val;
+	}
+	if (SUCCESS == ve_accelerated_io_getenv_size(ENV_KEY_ZERO_COPY, &val)) {
+		acc_io_zero_copy = (val != 0);
+	}
+	if (SUCCESS == ve_accelerated_io_getenv_size(ENV_KEY_ZERO_COPY_MIN,
+				&val)) {
+		acc_io_zero_copy_min = val;
+	}
+	if (SUCCESS == ve_accelerated_io_getenv_size(ENV_KEY_ZERO_COPY_IOV_MIN,
+				&val)) {
+		acc_io_zero_copy_iov_min = val;
+	}
+	if (SUCCESS == ve_accelerated_io_getenv_size(ENV_KEY_STREAMS, &val)
+			&& val >= 1 && val <= ACC_IO_STREAMS_MAX) {
+		acc_io_streams = (int)val;
+	}
+	if (SUCCESS == ve_accelerated_io_getenv_size(ENV_KEY_STREAM_MIN,
+				&val)) {
+		acc_io_stream_min = val;
+	}
+	if (SUCCESS == ve_accelerated_io_getenv_size(ENV_KEY_SMALL_IO_MAX,
+				&val)) {
+		acc_io_small_io_max = val;
+		acc_io_calib_state = ACC_IO_CALIB_DONE;
+	}
+	if (SUCCESS == ve_accelerated_io_check_pipeline(nparas, paras_size)) {
+		acc_io_conf.nparas = nparas;
+		acc_io_conf.paras_size = paras_size;
+	} else if (SUCCESS == ve_accelerated_io_check_pipeline(
+				acc_io_conf.nparas, paras_size)) {
+		acc_io_conf.paras_size = paras_size;
+	} else if (SUCCESS == ve_accelerated_io_check_pipeline(
+				nparas, acc_io_conf.paras_size)) {
+		acc_io_conf.nparas = nparas;
+	}
 }
 
 /**
- * @brief This function is register to pthread_atfork() and called at parent after fork.
+ * @brief This function reads the configuration of the pool of accelerated IO
+ * resources from environment variables VE_ACC_IO_POOL_SIZE,
+ * VE_ACC_IO_POOL_WAIT and VE_ACC_IO_POOL_IDLE_TIMEOUT, and allocates
+ * the pool.
+ * Invalid values are ignored.
  */
-static void ve_accelerated_io_atfork_parent(){
-	pthread_mutex_unlock(&acc_io_resources_list_lock);
-	pthread_sigmask(SIG_SETMASK, &acc_io_sigset_old, NULL);
+static void ve_accelerated_io_init_pool(void)
+{
+	ssize_t val;
+
+	if (SUCCESS == ve_accelerated_io_getenv_size(ENV_KEY_POOL_WAIT, &val)) {
+		acc_io_pool_wait = (uint64_t)val;
+	}
+	if (SUCCESS == ve_accelerated_io_getenv_size(ENV_KEY_POOL_IDLE_TIMEOUT,
+				&val)) {
+		acc_io_pool_idle_timeout = (uint64_t)val;
+	}
+	if (SUCCESS != ve_accelerated_io_getenv_size(ENV_KEY_POOL_SIZE, &val)
+		|| val == 0 || val > ACC_IO_POOL_MAX) {
+		return;
+	}
+	acc_io_pool = (acc_io_pool_slot *)calloc(val, sizeof(acc_io_pool_slot));
+	if (acc_io_pool == NULL) {
+		return;
+	}
+	acc_io_pool_size = (int)val;
 }
 
 /**
- * @brief This function clear all accelerated IO resources copied from parent. 
- * The global variable list_head is the head of “ve_acc_io_ve_resource” list. 
- * This function is register to pthread_atfork() and called at child after fork.
+ * @brief This function reads the page size of areas holding VE buffers
+ * from environment variable VE_ACC_IO_HUGEPAGE_SIZE.
+ * Invalid values are ignored.
  */
- static void ve_accelerated_io_atfork_child(){
-	pthread_mutex_unlock(&acc_io_resources_list_lock);
-
-	pthread_setspecific(acc_io_resources_key, NULL);
+static void ve_accelerated_io_init_staging(void)
+{
+	ssize_t val;
 
-	acc_io_resources *temp = (&list_head)->next;
-	while(temp != NULL){
-		acc_io_resources *tem = temp;
-		temp = tem->next;
-		ve_accelerated_io_release_resource(tem, 1);
+	if (SUCCESS != ve_accelerated_io_getenv_size(ENV_KEY_HUGEPAGE_SIZE,
+				&val)) {
+		return;
+	}
+	if (val == 0 || (val >= ACC_IO_HUGEPAGE_SIZE_MIN
+				&& val <= ACC_IO_HUGEPAGE_SIZE_MAX
+				&& (val & (val - 1)) == 0)) {
+		acc_io_hugepage_size = (size_t)val;
 	}
-	list_head.next = NULL;
-	ve_buff_using_flag = VE_BUFF_NOT_USING;
-
-	pthread_sigmask(SIG_SETMASK, &acc_io_sigset_old, NULL);
 }
 
 /**
- * @brief This function is destructor registered by pthread_key_create with acc_io_resources_key. 
- * The global variable list_head is the head of “ve_acc_io_ve_resource” list. 
- * This function removes accelerated IO resource from the list and call ve_accelerated_io_release_resource.
- * 
- * @param [in] param
+ * @brief This function maps anonymous memory aligned to a page size.
+ * When the memory mapped is not aligned, a larger area is mapped and the
+ * unaligned head and tail are unmapped.
+ *
+ * @param[in] size Size of memory, a multiple of align
+ * @param[in] align Page size
+ *
+ * @return The address on success, NULL on failure.
  */
-static void ve_accelerated_io_dstfunc(void* param){
-	pthread_sigmask(SIG_BLOCK, &acc_io_sigset, &acc_io_sigset_old);
-	pthread_mutex_lock(&acc_io_resources_list_lock);
+static void *ve_accelerated_io_map_aligned(size_t size, size_t align)
+{
+	char *addr;
+	char *aligned;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
 
-	if(((acc_io_resources *)param)->prev != NULL){
-		((acc_io_resources *)((acc_io_resources *)param)->prev)->next
-			= ((acc_io_resources *)param)->next;
+#ifdef MAP_64MB
+	if (align == 64*1024*1024) {
+		flags |= MAP_64MB;
 	}
-	if(((acc_io_resources *)param)->next != NULL){
-		((acc_io_resources *)((acc_io_resources *)param)->next)->prev 
-			= ((acc_io_resources *)param)->prev;
+#endif
+	addr = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (addr == MAP_FAILED) {
+		return NULL;
 	}
+	if (((uint64_t)addr & (align - 1)) == 0) {
+		return addr;
+	}
+	munmap(addr, size);
 
-	pthread_mutex_unlock(&acc_io_resources_list_lock);
-	pthread_sigmask(SIG_SETMASK, &acc_io_sigset_old, NULL);
-
-	ve_accelerated_io_release_resource(param, 0);
+	addr = mmap(NULL, size + align, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (addr == MAP_FAILED) {
+		return NULL;
+	}
+	aligned = (char *)(((uint64_t)addr + align - 1) & ~(align - 1));
+	if (aligned != addr) {
+		munmap(addr, aligned - addr);
+	}
+	munmap(aligned + size, addr + align - aligned);
+	return aligned;
 }
 
 /**
- * @brief This function release VE/VH memory and DMAATB.
- *  Unregistering DMAATB is skipped when this function is called from pthread_atfork handler.
- * 
- * @param [in] VE accelerated io resource to be released. 
- * This includes some resources for user DMA such as VEHVA, VH address. 
- * @param [in] Set to 1 when this function called from pthread_atfork handler. Otherwise 0.
+ * @brief This function allocates a VE buffer of VE_BUFF_SIZE bytes.
+ * VE buffers are carved from areas of huge pages aligned to
+ * VE_ACC_IO_HUGEPAGE_SIZE, so that a VE buffer never crosses a page
+ * boundary and VE buffers of threads share pages. An area is unmapped
+ * when all VE buffers in it are freed.
+ *
+ * @param[out] buff Buffer whose ve_io_buff and area are set
+ *
+ * @retval SUCCESS on success
+ * @retval FAIL on failure of memory allocation
  */
-static void ve_accelerated_io_release_resource(acc_io_resources *res, int is_fork){
-	syscall(SYS_sysve,
-			VE_SYSVE_ACCELERATED_IO_FREE_VH_BUF,
-			res->vh_buff);
-	if(is_fork == 0){
-		syscall(SYS_sysve,
-				VE_SYSVE_ACCELERATED_IO_UNREGISTER_DMAATB,
-				res->local_vehva, res->vehva);
+static int ve_accelerated_io_alloc_staging(acc_io_buffer *buff)
+{
+	int i;
+	int nbuffs;
+	size_t size;
+	sigset_t sigset_old;
+	acc_io_staging_area *area;
+
+	if (acc_io_hugepage_size == 0) {
+		buff->ve_io_buff = malloc(VE_BUFF_SIZE);
+		buff->area = NULL;
+		return (buff->ve_io_buff != NULL) ? SUCCESS : FAIL;
 	}
-	free(res);
-}
 
+	pthread_sigmask(SIG_BLOCK, &acc_io_sigset, &sigset_old);
+	pthread_mutex_lock(&acc_io_staging_lock);
+	for (area = acc_io_staging; area != NULL; area = area->next) {
+		nbuffs = (int)(area->size / VE_BUFF_SIZE);
+		if (area->used != (nbuffs == 64 ? UINT64_MAX
+					: ((uint64_t)1 << nbuffs) - 1)) {
+			break;
+		}
+	}
+	if (area == NULL) {
+		size = (VE_BUFF_SIZE + acc_io_hugepage_size - 1)
+			& ~(acc_io_hugepage_size - 1);
+		area = calloc(1, sizeof(acc_io_staging_area));
+		if (area != NULL) {
+			area->addr = ve_accelerated_io_map_aligned(size,
+					acc_io_hugepage_size);
+			if (area->addr == NULL) {
+				free(area);
+				area = NULL;
+			}
+		}
+		if (area == NULL) {
+			pthread_mutex_unlock(&acc_io_staging_lock);
+			pthread_sigmask(SIG_SETMASK, &sigset_old, NULL);
+			return FAIL;
+		}
+		area->size = size;
+		area->next = acc_io_staging;
+		acc_io_staging = area;
+	}
+	for (i = 0; area->used & ((uint64_t)1 << i); i++) {
+		;
+	}
+	area->used |= (uint64_t)1 << i;
+	buff->ve_io_buff = area->addr + (size_t)VE_BUFF_SIZE * i;
+	buff->area = area;
+	pthread_mutex_unlock(&acc_io_staging_lock);
+	pthread_sigmask(SIG_SETMASK, &sigset_old, NULL);
+	return SUCCESS;
+}
 
 /**
- * @brief This function handle post-processing of IO request.
+ * @brief This function frees a VE buffer allocated by
+ * ve_accelerated_io_alloc_staging().
  *
- * @param [in] mask for get flag status of VH buffer
+ * @param[in] buff Buffer whose ve_io_buff is freed
  */
-static void ve_accelerated_io_post(int mask)
+static void ve_accelerated_io_free_staging(acc_io_buffer *buff)
 {
-	/* Free flag ve_buff_using_flag */
-	__libsysve_a_swap(&ve_buff_using_flag,
-			VE_BUFF_NOT_USING);
+	sigset_t sigset_old;
+	acc_io_staging_area **prev;
+	acc_io_staging_area *area = buff->area;
 
-	pthread_testcancel();
+	if (area == NULL) {
+		free(buff->ve_io_buff);
+		return;
+	}
+
+	pthread_sigmask(SIG_BLOCK, &acc_io_sigset, &sigset_old);
+	pthread_mutex_lock(&acc_io_staging_lock);
+	area->used &= ~((uint64_t)1 << (((char *)buff->ve_io_buff
+					- area->addr) / VE_BUFF_SIZE));
+	if (area->used == 0) {
+		for (prev = &acc_io_staging; *prev != area;
+				prev = &(*prev)->next) {
+			;
+		}
+		*prev = area->next;
+		munmap(area->addr, area->size);
+		free(area);
+	}
+	pthread_mutex_unlock(&acc_io_staging_lock);
+	pthread_sigmask(SIG_SETMASK, &sigset_old, NULL);
 }
 
 /**
- * @brief This function free the io hook
+ * @brief This function allocates accelerated IO resources for the current
+ * pipeline configuration.
+ * Each buffer registered by VE_SYSVE_ACCELERATED_IO_INIT2 holds
+ * "VE_BUFF_SIZE / paras_size" stages, so as many buffers as needed to hold
+ * all stages are registered.
+ *
+ * @param[out] res Allocated resources
+ * @param[in] nested Set to 1 to allocate the secondary resources used by
+ *            nested IO requests. They always have the default pipeline,
+ *            which fits in one registered buffer.
+ *
+ * @retval SUCCESS on success
+ * @retval FAIL on failure of memory allocation
+ * @retval NOBUF on failure of registration
+ */
+static int ve_accelerated_io_alloc_resource(acc_io_resources **res,
+		int nested)
+{
+	int i;
+	int ret;
+	int paras_per_buff;
+	void *vhva;
+	uint64_t vehva = 0;
+	uint64_t local_vehva = 0;
+	acc_io_resources *acc_io_res;
+	acc_io_buffer *buff;
+
+	acc_io_res = (acc_io_resources *)calloc(1, sizeof(acc_io_resources));
+	if (acc_io_res == NULL) {
+		return FAIL;
+	}
+	if (nested) {
+		acc_io_res->nparas = BUFF_NPARAS;
+		acc_io_res->paras_size = PARAS_SIZE;
+	} else {
+		pthread_mutex_lock(&acc_io_conf_lock);
+		acc_io_res->nparas = acc_io_conf.nparas;
+		acc_io_res->paras_size = acc_io_conf.paras_size;
+		acc_io_res->generation = acc_io_conf.generation;
+		pthread_mutex_unlock(&acc_io_conf_lock);
+	}
+	acc_io_res->fork_gen = acc_io_fork_gen;
+
+	paras_per_buff = VE_BUFF_SIZE / acc_io_res->paras_size;
+	acc_io_res->nbuffs = (acc_io_res->nparas + paras_per_buff - 1)
+		/ paras_per_buff;
+
+	for (i = 0; i < acc_io_res->nbuffs; i++) {
+		buff = (acc_io_buffer *)malloc(sizeof(acc_io_buffer));
+		if (buff == NULL) {
+			ret = FAIL;
+			goto error;
+		}
+		if (SUCCESS != ve_accelerated_io_alloc_staging(buff)) {
+			free(buff);
+			ret = FAIL;
+			goto error;
+		}
+		ret = (int)syscall(SYS_sysve,
+				VE_SYSVE_ACCELERATED_IO_INIT2, &vhva, &vehva,
+				buff->ve_io_buff, &local_vehva);
+		if (SUCCESS != ret) {
+			ve_accelerated_io_free_staging(buff);
+			free(buff);
+			ret = NOBUF;
+			goto error;
+		}
+		buff->vh_buff = (uint64_t)vhva;
+		buff->vehva = vehva;
+		buff->local_vehva = local_vehva;
+		acc_io_res->buff[i] = buff;
+	}
+	*res = acc_io_res;
+	return SUCCESS;
+
+error:
+	acc_io_res->nbuffs = i;
+	ve_accelerated_io_release_resource(acc_io_res, 0);
+	return ret;
+}
+
+/**
+ * @brief This function links accelerated IO resources to the list.
+ * The global variable list_head is the head of the list.
+ *
+ * @param [in] acc_io_res Accelerated IO resources to be linked
+ */
+static void ve_accelerated_io_link_resource(acc_io_resources *acc_io_res)
+{
+	pthread_sigmask(SIG_BLOCK, &acc_io_sigset, &acc_io_sigset_old);
+	pthread_mutex_lock(&acc_io_resources_list_lock);
+
+	acc_io_res->next = list_head.next;
+	acc_io_res->prev = &list_head;
+	if(list_head.next != NULL){
+		((acc_io_resources *)list_head.next)->prev = acc_io_res;
+	}
+	list_head.next = acc_io_res;
+	pthread_mutex_unlock(&acc_io_resources_list_lock);
+	pthread_sigmask(SIG_SETMASK, &acc_io_sigset_old, NULL);
+}
+
+/**
+ * @brief This function unlinks accelerated IO resources from the list.
+ *
+ * @param [in] acc_io_res Accelerated IO resources to be unlinked
+ */
+static void ve_accelerated_io_unlink_resource(acc_io_resources *acc_io_res)
+{
+	pthread_sigmask(SIG_BLOCK, &acc_io_sigset, &acc_io_sigset_old);
+	pthread_mutex_lock(&acc_io_resources_list_lock);
+
+	if(acc_io_res->prev != NULL){
+		((acc_io_resources *)acc_io_res->prev)->next = acc_io_res->next;
+	}
+	if(acc_io_res->next != NULL){
+		((acc_io_resources *)acc_io_res->next)->prev = acc_io_res->prev;
+	}
+
+	pthread_mutex_unlock(&acc_io_resources_list_lock);
+	pthread_sigmask(SIG_SETMASK, &acc_io_sigset_old, NULL);
+}
+
+/**
+ * @brief This function releases resources inherited from the parent by
+ * fork() which belong to threads not existing in the child.
+ * Resources of the thread calling fork() are released when the thread
+ * requests IO, and resources in the pool are released when the slot is
+ * used.
+ */
+static void ve_accelerated_io_release_forked(void)
+{
+	int gen = acc_io_fork_gen;
+	acc_io_resources *res;
+	acc_io_resources *next;
+	sigset_t sigset_old;
+
+	pthread_sigmask(SIG_BLOCK, &acc_io_sigset, &sigset_old);
+	pthread_mutex_lock(&acc_io_resources_list_lock);
+	for (res = list_head.next; res != NULL; res = next) {
+		next = res->next;
+		if (res == acc_io_fork_own || res->fork_gen == gen) {
+			continue;
+		}
+		((acc_io_resources *)res->prev)->next = res->next;
+		if (res->next != NULL) {
+			((acc_io_resources *)res->next)->prev = res->prev;
+		}
+		ve_accelerated_io_release_resource(res, 1);
+	}
+	while (acc_io_spare != NULL) {
+		res = acc_io_spare;
+		acc_io_spare = res->next;
+		ve_accelerated_io_release_resource(res, 1);
+	}
+	acc_io_nspares = 0;
+	acc_io_fork_swept = gen;
+	pthread_mutex_unlock(&acc_io_resources_list_lock);
+	pthread_sigmask(SIG_SETMASK, &sigset_old, NULL);
+}
+
+/**
+ * @brief This function adds resources to the spare resources.
+ *
+ * @param[in] res Resources not used by any thread
+ */
+static void ve_accelerated_io_put_spare(acc_io_resources *res)
+{
+	sigset_t sigset_old;
+
+	pthread_sigmask(SIG_BLOCK, &acc_io_sigset, &sigset_old);
+	pthread_mutex_lock(&acc_io_resources_list_lock);
+	res->next = acc_io_spare;
+	res->prev = NULL;
+	acc_io_spare = res;
+	acc_io_nspares++;
+	pthread_mutex_unlock(&acc_io_resources_list_lock);
+	pthread_sigmask(SIG_SETMASK, &sigset_old, NULL);
+}
+
+/**
+ * @brief This function takes resources from the spare resources.
+ * Resources allocated for the previous pipeline configuration are
+ * released.
+ *
+ * @return Resources, or NULL if no spare resources are available.
+ */
+static acc_io_resources *ve_accelerated_io_get_spare(void)
+{
+	acc_io_resources *res;
+	sigset_t sigset_old;
+
+	if (acc_io_spare == NULL) {
+		return NULL;
+	}
+	pthread_sigmask(SIG_BLOCK, &acc_io_sigset, &sigset_old);
+	pthread_mutex_lock(&acc_io_resources_list_lock);
+	while ((res = acc_io_spare) != NULL) {
+		acc_io_spare = res->next;
+		acc_io_nspares--;
+		res->next = NULL;
+		if (res->generation == acc_io_conf.generation
+				&& res->fork_gen == acc_io_fork_gen) {
+			break;
+		}
+		ve_accelerated_io_release_resource(res,
+				res->fork_gen != acc_io_fork_gen);
+	}
+	pthread_mutex_unlock(&acc_io_resources_list_lock);
+	pthread_sigmask(SIG_SETMASK, &sigset_old, NULL);
+	return res;
+}
+
+/**
+ * @brief This function gets accelerated IO resources of the calling thread.
+ * The resources are allocated at the first IO request of the thread.
+ *
+ * @param [out] res Accelerated IO resources
+ *
+ * @retval SUCCESS on success
+ * @retval FAIL on failure
+ * @retval NOBUF on failure of registration
+ */
+static int ve_accelerated_io_get_thread_resource(acc_io_resources **res)
+{
+	int ret;
+	acc_io_resources* acc_io_res;
+
+	if (acc_io_fork_swept != acc_io_fork_gen) {
+		ve_accelerated_io_release_forked();
+	}
+	acc_io_res = pthread_getspecific(acc_io_resources_key);
+	if (acc_io_res != NULL
+		&& acc_io_res->fork_gen != acc_io_fork_gen) {
+		/* Inherited from the parent, so reallocate */
+		pthread_setspecific(acc_io_resources_key, NULL);
+		ve_accelerated_io_unlink_resource(acc_io_res);
+		ve_accelerated_io_release_resource(acc_io_res, 1);
+		acc_io_res = NULL;
+	}
+	if (acc_io_res != NULL
+		&& acc_io_res->generation != acc_io_conf.generation) {
+		/* Pipeline configuration is changed, so reallocate */
+		pthread_setspecific(acc_io_resources_key, NULL);
+		ve_accelerated_io_unlink_resource(acc_io_res);
+		ve_accelerated_io_release_resource(acc_io_res, 0);
+		acc_io_res = NULL;
+	}
+	if(acc_io_res == NULL){
+		/* When first IO request, check environment */
+		if(ACCELERATED_IO != ve_accelerated_io_chk_env_init_dma()){
+			return FAIL;
+		}
+		acc_io_res = ve_accelerated_io_get_spare();
+		if (acc_io_res == NULL) {
+			ret = ve_accelerated_io_alloc_resource(&acc_io_res, 0);
+			if (SUCCESS != ret) {
+				return ret;
+			}
+		}
+
+		if(pthread_setspecific(acc_io_resources_key, (void *) acc_io_res)){
+			ve_accelerated_io_release_resource(acc_io_res, 0);
+			return FAIL;
+		}
+
+		ve_accelerated_io_link_resource(acc_io_res);
+	}
+	if (acc_io_nested_wanted && acc_io_res->nested == NULL) {
+		/* A nested IO request has been handled as a normal IO.
+		 * Allocate the secondary resources here, not in the nested
+		 * request which may be called from a signal handler.
+		 */
+		acc_io_nested_wanted = 0;
+		if (SUCCESS != ve_accelerated_io_alloc_resource(
+					&acc_io_res->nested, 1)) {
+			acc_io_res->nested = NULL;
+		}
+	}
+	*res = acc_io_res;
+	return SUCCESS;
+}
+
+/**
+ * @brief This function gets the current time in seconds.
+ */
+static inline uint64_t ve_accelerated_io_now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec;
+}
+
+/**
+ * @brief This function gets the current time in nanoseconds.
+ */
+static inline uint64_t ve_accelerated_io_now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief This function releases resources of the pool which have not been
+ * used for VE_ACC_IO_POOL_IDLE_TIMEOUT seconds.
+ * Slots being used by other threads are skipped.
+ *
+ * @param [in] now Current time in seconds
+ */
+static void ve_accelerated_io_pool_reclaim(uint64_t now)
+{
+	int i;
+	acc_io_pool_slot *slot;
+
+	if (acc_io_pool_idle_timeout == 0
+		|| now - acc_io_pool_last_reclaim < ACC_IO_POOL_RECLAIM_INTERVAL) {
+		return;
+	}
+	acc_io_pool_last_reclaim = now;
+	for (i = 0; i < acc_io_pool_size; i++) {
+		slot = &acc_io_pool[i];
+		if (slot->res == NULL || slot->busy
+			|| now - slot->last_used < acc_io_pool_idle_timeout) {
+			continue;
+		}
+		if (__libsysve_a_swap(&slot->busy, VE_BUFF_USING)
+			!= VE_BUFF_NOT_USING) {
+			continue;
+		}
+		if (slot->res != NULL
+			&& now - slot->last_used >= acc_io_pool_idle_timeout) {
+			ve_accelerated_io_release_resource(slot->res, 0);
+			slot->res = NULL;
+		}
+		__libsysve_a_swap(&slot->busy, VE_BUFF_NOT_USING);
+	}
+}
+
+/**
+ * @brief This function borrows accelerated IO resources from the pool
+ * shared by all threads.
+ * A free slot is taken by an atomic swap, starting from the slot used
+ * by the calling thread last time. If all slots are used, this function
+ * waits for VE_ACC_IO_POOL_WAIT microseconds at most.
+ *
+ * @param [out] res Accelerated IO resources
+ * @param [out] slot_out Borrowed slot, to be returned to the pool
+ *              by ve_accelerated_io_pool_put()
+ * @param [in] wait Maximum time in microseconds to wait for a free slot
+ *
+ * @retval SUCCESS on success
+ * @retval FAIL on failure
+ * @retval NOBUF when no slot is available or on failure of registration
+ */
+static int ve_accelerated_io_pool_get(acc_io_resources **res,
+		acc_io_pool_slot **slot_out, uint64_t wait)
+{
+	int i;
+	int n;
+	int ret;
+	uint64_t waited = 0;
+	acc_io_pool_slot *slot = NULL;
+	struct timespec ts = {0, ACC_IO_POOL_WAIT_STEP * 1000};
+
+	for (;;) {
+		for (n = 0; n < acc_io_pool_size; n++) {
+			i = (acc_io_pool_hint + n) % acc_io_pool_size;
+			if (acc_io_pool[i].busy) {
+				continue;
+			}
+			if (__libsysve_a_swap(&acc_io_pool[i].busy,
+					VE_BUFF_USING) == VE_BUFF_NOT_USING) {
+				slot = &acc_io_pool[i];
+				acc_io_pool_hint = i;
+				break;
+			}
+		}
+		if (slot != NULL) {
+			break;
+		}
+		if (waited >= wait) {
+			return NOBUF;
+		}
+		if (waited == 0) {
+			sched_yield();
+		} else {
+			nanosleep(&ts, NULL);
+		}
+		waited += ACC_IO_POOL_WAIT_STEP;
+	}
+
+	if (slot->res != NULL && slot->res->fork_gen != acc_io_fork_gen) {
+		/* Inherited from the parent, so reallocate */
+		ve_accelerated_io_release_resource(slot->res, 1);
+		slot->res = NULL;
+	}
+	if (slot->res != NULL
+		&& slot->res->generation != acc_io_conf.generation) {
+		/* Pipeline configuration is changed, so reallocate */
+		ve_accelerated_io_release_resource(slot->res, 0);
+		slot->res = NULL;
+	}
+	if (slot->res == NULL) {
+		if(ACCELERATED_IO != ve_accelerated_io_chk_env_init_dma()){
+			__libsysve_a_swap(&slot->busy, VE_BUFF_NOT_USING);
+			return FAIL;
+		}
+		ret = ve_accelerated_io_alloc_resource(&slot->res, 0);
+		if (SUCCESS != ret) {
+			slot->res = NULL;
+			__libsysve_a_swap(&slot->busy, VE_BUFF_NOT_USING);
+			return ret;
+		}
+	}
+	*res = slot->res;
+	*slot_out = slot;
+	return SUCCESS;
+}
+
+/**
+ * @brief This function returns resources borrowed by
+ * ve_accelerated_io_pool_get() to the pool.
+ *
+ * @param [in] slot Borrowed slot
+ */
+static void ve_accelerated_io_pool_put(acc_io_pool_slot *slot)
+{
+	uint64_t now;
+
+	if (acc_io_pool_idle_timeout != 0) {
+		now = ve_accelerated_io_now_sec();
+		slot->last_used = now;
+		__libsysve_a_swap(&slot->busy, VE_BUFF_NOT_USING);
+		ve_accelerated_io_pool_reclaim(now);
+	} else {
+		__libsysve_a_swap(&slot->busy, VE_BUFF_NOT_USING);
+	}
+}
+
+/**
+ * @brief This function reads the configuration of features which need the
+ * state of each file descriptor from environment variables
+ * VE_ACC_IO_READ_AHEAD, VE_ACC_IO_WRITE_BEHIND,
+ * VE_ACC_IO_WRITE_BEHIND_TIMEOUT, VE_ACC_IO_ASYNC_WRITE, VE_ACC_IO_STATS,
+ * VE_ACC_IO_STATS_FILE and VE_ACC_IO_AUTO_TUNE, and allocates the table
+ * of the states.
+ * Invalid values are ignored.
+ */
+static void ve_accelerated_io_init_fd_state(void)
+{
+	ssize_t val;
+	struct rlimit rlim;
+
+	if (SUCCESS == ve_accelerated_io_getenv_size(ENV_KEY_READ_AHEAD, &val)
+			&& val <= READ_AHEAD_MAX) {
+		acc_io_read_ahead = val;
+	}
+	if (SUCCESS == ve_accelerated_io_getenv_size(ENV_KEY_WRITE_BEHIND,
+				&val) && val <= WRITE_BEHIND_MAX) {
+		acc_io_write_behind = val;
+	}
+	if (SUCCESS == ve_accelerated_io_getenv_size(
+				ENV_KEY_WRITE_BEHIND_TIMEOUT, &val)) {
+		acc_io_write_behind_timeout = val;
+	}
+	if (SUCCESS == ve_accelerated_io_getenv_size(ENV_KEY_ASYNC_WRITE,
+				&val)) {
+		acc_io_async_write = val;
+	}
+	if (SUCCESS == ve_accelerated_io_getenv_size(ENV_KEY_STATS, &val)) {
+		acc_io_stats_enabled = (val != 0);
+	}
+	acc_io_stats_file = getenv(ENV_KEY_STATS_FILE);
+	if (acc_io_stats_file != NULL && *acc_io_stats_file != '\0') {
+		acc_io_stats_enabled = 1;
+	} else {
+		acc_io_stats_file = NULL;
+	}
+	if (SUCCESS == ve_accelerated_io_getenv_size(ENV_KEY_AUTO_TUNE, &val)) {
+		acc_io_auto_tune = (val != 0);
+	}
+
+	/* The table is allocated later if checksums are enabled by API */
+	acc_io_fd_max = ACC_IO_FD_MAX;
+	if (getrlimit(RLIMIT_NOFILE, &rlim) == 0
+			&& rlim.rlim_cur < ACC_IO_FD_MAX) {
+		acc_io_fd_max = (int)rlim.rlim_cur;
+	}
+	acc_io_fd_mode = calloc(acc_io_fd_max, sizeof(unsigned char));
+	if (acc_io_read_ahead == 0 && acc_io_write_behind == 0
+			&& acc_io_async_write == 0 && !acc_io_stats_enabled
+			&& !acc_io_auto_tune) {
+		return;
+	}
+
+	acc_io_fds = calloc(acc_io_fd_max, sizeof(acc_io_fd_state *));
+	if (acc_io_fds == NULL) {
+		acc_io_fd_max = 0;
+		acc_io_read_ahead = 0;
+		acc_io_write_behind = 0;
+		acc_io_async_write = 0;
+		acc_io_stats_enabled = 0;
+		acc_io_stats_file = NULL;
+		acc_io_auto_tune = 0;
+	}
+	acc_io_timing = acc_io_stats_enabled || acc_io_auto_tune;
+}
+
+/**
+ * @brief This function reads the configuration of tracing from
+ * environment variables VE_ACC_IO_TRACE and VE_ACC_IO_TRACE_SIZE, and
+ * allocates the trace ring buffer.
+ * Invalid values are ignored.
+ */
+static void ve_accelerated_io_init_trace(void)
+{
+	ssize_t val;
+
+	acc_io_trace_file = getenv(ENV_KEY_TRACE);
+	if (acc_io_trace_file == NULL || *acc_io_trace_file == '\0') {
+		acc_io_trace_file = NULL;
+		return;
+	}
+	acc_io_trace_size = ACC_IO_TRACE_SIZE_DEFAULT;
+	if (SUCCESS == ve_accelerated_io_getenv_size(ENV_KEY_TRACE_SIZE, &val)
+			&& val > 0) {
+		acc_io_trace_size = val;
+	}
+	acc_io_trace = calloc(acc_io_trace_size,
+			sizeof(struct ve_acc_io_trace_event));
+	if (acc_io_trace == NULL) {
+		acc_io_trace_file = NULL;
+	}
+}
+
+/**
+ * @brief This function gets the state of a file descriptor.
+ *
+ * @param [in] fd File descriptor
+ * @param [in] create 1 to allocate the state if not allocated yet
+ *
+ * @return The state on success, NULL if not available.
+ */
+static acc_io_fd_state *ve_accelerated_io_get_fd_state(int fd, int create)
+{
+	acc_io_fd_state *st;
+
+	if (acc_io_fds == NULL || fd < 0 || fd >= acc_io_fd_max) {
+		return NULL;
+	}
+	st = acc_io_fds[fd];
+	if (st == NULL && create) {
+		st = calloc(1, sizeof(acc_io_fd_state));
+		if (st == NULL) {
+			return NULL;
+		}
+		st->is_reg = -1;
+		if (!__sync_bool_compare_and_swap(&acc_io_fds[fd], NULL, st)) {
+			free(st);
+			st = acc_io_fds[fd];
+		}
+	}
+	return st;
+}
+
+/**
+ * @brief This function gets the state of a file descriptor for an API
+ * which enables a feature of the file descriptor. The table of states is
+ * allocated if no feature enabled by environment variables needs it.
+ *
+ * @param [in] fd File descriptor
+ * @param [in] create 1 to allocate the state if not allocated yet
+ *
+ * @return The state on success, NULL if not available.
+ */
+static acc_io_fd_state *ve_accelerated_io_alloc_fd_state(int fd, int create)
+{
+	acc_io_fd_state **fds;
+
+	if (acc_io_fds == NULL && create) {
+		fds = calloc(acc_io_fd_max, sizeof(acc_io_fd_state *));
+		if (fds == NULL) {
+			return NULL;
+		}
+		if (!__sync_bool_compare_and_swap(&acc_io_fds, NULL, fds)) {
+			free(fds);
+		}
+	}
+	return ve_accelerated_io_get_fd_state(fd, create);
+}
+
+/**
+ * @brief This function gets and locks the state of a file descriptor.
+ * The state is not available when it is already locked by this thread,
+ * e.g. IO from a signal handler.
+ *
+ * @param [in] fd File descriptor
+ * @param [in] create 1 to allocate the state if not allocated yet
+ *
+ * @return The state on success, NULL if not available.
+ */
+static acc_io_fd_state *ve_accelerated_io_lock_fd_state(int fd, int create)
+{
+	acc_io_fd_state *st;
+
+	if (acc_io_fd_locked == fd + 1) {
+		return NULL;
+	}
+	st = ve_accelerated_io_get_fd_state(fd, create);
+	if (st == NULL) {
+		return NULL;
+	}
+	while (__libsysve_a_swap(&st->lock, VE_BUFF_USING)
+			!= VE_BUFF_NOT_USING) {
+		sched_yield();
+	}
+	st->prev_locked = acc_io_fd_locked;
+	acc_io_fd_locked = fd + 1;
+	return st;
+}
+
+/**
+ * @brief This function unlocks the state of a file descriptor.
+ *
+ * @param [in] st State locked by ve_accelerated_io_lock_fd_state()
+ */
+static void ve_accelerated_io_unlock_fd_state(acc_io_fd_state *st)
+{
+	acc_io_fd_locked = st->prev_locked;
+	__libsysve_a_swap(&st->lock, VE_BUFF_NOT_USING);
+}
+
+/**
+ * @brief This function starts checksumming a request of a file descriptor
+ * whose checksum is enabled. Data is added to the checksum in order of
+ * requests, so requests of the fd are serialized until
+ * ve_accelerated_io_csum_end() is called.
+ * A request nested in another one, e.g. IO from a signal handler, is not
+ * checksummed.
+ *
+ * @param [out] ctx Checksum of the request
+ * @param [in] fd File descriptor
+ * @param [in] is_write 1 for a write family system call
+ * @param [in] fused 1 if copies of the request update the checksum
+ */
+static void ve_accelerated_io_csum_begin(acc_io_csum_ctx *ctx, int fd,
+		int is_write, int fused)
+{
+	acc_io_fd_state *st;
+
+	ctx->st = NULL;
+	ctx->prev_cur = acc_io_csum_cur;
+	ctx->prev_done = acc_io_csum_done;
+	ctx->prev_busy = acc_io_csum_busy;
+	acc_io_csum_cur = NULL;
+	if (acc_io_csum_fds == 0 || acc_io_csum_busy) {
+		return;
+	}
+	st = ve_accelerated_io_get_fd_state(fd, 0);
+	if (st == NULL || st->csum_algorithm == VE_ACC_IO_CSUM_NONE) {
+		return;
+	}
+	/* Set before locking not to deadlock by IO from a signal handler */
+	acc_io_csum_busy = 1;
+	while (__libsysve_a_swap(&st->csum_lock, VE_BUFF_USING)
+			!= VE_BUFF_NOT_USING) {
+		sched_yield();
+	}
+	if (st->csum_algorithm == VE_ACC_IO_CSUM_NONE) {
+		/* Disabled while waiting */
+		__libsysve_a_swap(&st->csum_lock, VE_BUFF_NOT_USING);
+		return;
+	}
+	ctx->st = st;
+	ctx->cs = is_write ? &st->csum_write : &st->csum_read;
+	acc_io_csum_done = 0;
+	if (fused) {
+		ctx->saved = *ctx->cs;
+		acc_io_csum_cur = ctx->cs;
+	}
+}
+
+/**
+ * @brief This function adds data of a request not added by copies to the
+ * checksum, and finishes checksumming the request.
+ * Data copied is the head of the user buffer, and the rest of data is
+ * added here in a separate pass. Only the ret bytes read or written count:
+ * when copies added more, e.g. data of a write which failed or wrote
+ * partially, the checksum is restored to the state before the request and
+ * the ret bytes are added again from the user buffer.
+ *
+ * @param [in] ctx Checksum started by ve_accelerated_io_csum_begin()
+ * @param [in] buf User buffer, NULL for readv family system calls
+ * @param [in] iov User buffers of readv family system calls
+ * @param [in] iovcnt Number of iov
+ * @param [in] ret Result of the request
+ */
+static void ve_accelerated_io_csum_end(acc_io_csum_ctx *ctx, const void *buf,
+		const struct iovec *iov, int iovcnt, ssize_t ret)
+{
+	int i;
+	size_t size;
+	size_t skip = acc_io_csum_done;
+
+	if (ctx->st != NULL && skip > 0 && (ret < 0 || (size_t)ret < skip)) {
+		*ctx->cs = ctx->saved;
+		skip = 0;
+	}
+	if (ctx->st != NULL && ret > 0 && (size_t)ret > skip) {
+		if (buf != NULL) {
+			ve_accelerated_io_csum_update(ctx->cs,
+					(const char *)buf + skip, ret - skip);
+		}
+		for (i = 0; buf == NULL && i < iovcnt && ret > 0; i++) {
+			size = MIN(iov[i].iov_len, (size_t)ret);
+			ve_accelerated_io_csum_update(ctx->cs,
+					iov[i].iov_base, size);
+			ret -= size;
+		}
+	}
+	if (ctx->st != NULL) {
+		__libsysve_a_swap(&ctx->st->csum_lock, VE_BUFF_NOT_USING);
+	}
+	acc_io_csum_cur = ctx->prev_cur;
+	acc_io_csum_done = ctx->prev_done;
+	acc_io_csum_busy = ctx->prev_busy;
+}
+
+/**
+ * @brief This function sets the algorithm of checksums of a file
+ * descriptor, and clears the checksums.
+ * This must not be called while this thread checksums a request.
+ *
+ * @param [in] st State of the file descriptor
+ * @param [in] algorithm enum ve_acc_io_csum_algorithm
+ */
+static void ve_accelerated_io_set_csum(acc_io_fd_state *st, int algorithm)
+{
+	while (__libsysve_a_swap(&st->csum_lock, VE_BUFF_USING)
+			!= VE_BUFF_NOT_USING) {
+		sched_yield();
+	}
+	if (st->csum_algorithm == VE_ACC_IO_CSUM_NONE
+			&& algorithm != VE_ACC_IO_CSUM_NONE) {
+		__sync_fetch_and_add(&acc_io_csum_fds, 1);
+	} else if (st->csum_algorithm != VE_ACC_IO_CSUM_NONE
+			&& algorithm == VE_ACC_IO_CSUM_NONE) {
+		__sync_fetch_and_sub(&acc_io_csum_fds, 1);
+	}
+	st->csum_algorithm = algorithm;
+	ve_accelerated_io_csum_init(&st->csum_read, algorithm);
+	ve_accelerated_io_csum_init(&st->csum_write, algorithm);
+	__libsysve_a_swap(&st->csum_lock, VE_BUFF_NOT_USING);
+}
+
+/**
+ * @brief This function sets the transform of data of a file descriptor.
+ *
+ * @param [in] st Locked state of the file descriptor
+ * @param [in] func Transform, NULL if none
+ * @param [in] arg Argument of func
+ */
+static void ve_accelerated_io_set_xform(acc_io_fd_state *st,
+		ve_acc_io_transform_t func, void *arg)
+{
+	if (st->xform == NULL && func != NULL) {
+		__sync_fetch_and_add(&acc_io_xform_fds, 1);
+	} else if (st->xform != NULL && func == NULL) {
+		__sync_fetch_and_sub(&acc_io_xform_fds, 1);
+	}
+	st->xform_arg = arg;
+	__sync_synchronize();
+	st->xform = func;
+}
+
+/**
+ * @brief This function copies data of a request on VE, and adds it to the
+ * checksum of the request while it is in the cache if it is checksummed.
+ *
+ * @param [out] dst Destination
+ * @param [in] src Source
+ * @param [in] size Size of data
+ */
+static void ve_accelerated_io_copy(void *dst, const void *src, size_t size)
+{
+	if (acc_io_csum_cur != NULL) {
+		ve_accelerated_io_csum_copy(acc_io_csum_cur, dst, src, size);
+		acc_io_csum_done += size;
+	} else {
+		__libsysve_vec_memcpy(dst, (void *)src, size);
+	}
+}
+
+/**
+ * @brief This function is the same as ve_accelerated_io_copy() but uses
+ * memcpy(), for copies from and to buffers of the file descriptor which
+ * are usually small.
+ *
+ * @param [out] dst Destination
+ * @param [in] src Source
+ * @param [in] size Size of data
+ */
+static void ve_accelerated_io_copy_small(void *dst, const void *src,
+		size_t size)
+{
+	if (acc_io_csum_cur != NULL) {
+		ve_accelerated_io_csum_copy(acc_io_csum_cur, dst, src, size);
+		acc_io_csum_done += size;
+	} else {
+		memcpy(dst, src, size);
+	}
+}
+
+/**
+ * @brief This function adds data of a request transferred without copy on
+ * VE to the checksum of the request, so that the checksum is in order of
+ * data.
+ *
+ * @param [in] buf Data
+ * @param [in] size Size of data
+ */
+static void ve_accelerated_io_csum_direct(const void *buf, size_t size)
+{
+	if (acc_io_csum_cur != NULL) {
+		ve_accelerated_io_csum_update(acc_io_csum_cur, buf, size);
+		acc_io_csum_done += size;
+	}
+}
+
+/**
+ * @brief This function gets the transform of data of a file descriptor.
+ *
+ * @param [in] fd File descriptor
+ * @param [out] xf Transform, whose func is NULL if none
+ *
+ * @retval 1 if data of fd is transformed, 0 otherwise.
+ */
+static int ve_accelerated_io_get_xform(int fd, acc_io_xform *xf)
+{
+	acc_io_fd_state *st;
+
+	xf->func = NULL;
+	xf->arg = NULL;
+	if (acc_io_xform_fds == 0) {
+		return 0;
+	}
+	st = ve_accelerated_io_get_fd_state(fd, 0);
+	if (st == NULL || st->xform == NULL) {
+		return 0;
+	}
+	xf->arg = st->xform_arg;
+	xf->func = st->xform;
+	return 1;
+}
+
+/**
+ * @brief This function transforms data in place.
+ *
+ * @param [in] xf Transform, nothing is done if xf->func is NULL
+ * @param [in,out] buf Data
+ * @param [in] size Size of data
+ * @param [in] direction VE_ACC_IO_TRANSFORM_READ or
+ *             VE_ACC_IO_TRANSFORM_WRITE
+ *
+ * @return 0 on success, errno of the failure on failure.
+ */
+static int ve_accelerated_io_transform(acc_io_xform *xf, void *buf,
+		size_t size, int direction)
+{
+	int errno_bak = errno;
+	int err = 0;
+
+	if (xf->func == NULL || size == 0) {
+		return 0;
+	}
+	errno = 0;
+	if (xf->func(buf, size, direction, xf->arg) != 0) {
+		err = (errno != 0) ? errno : EIO;
+	}
+	errno = errno_bak;
+	return err;
+}
+
+/**
+ * @brief This function checks whether a file descriptor is opened with
+ * O_DIRECT. close() is not hooked, so the file descriptor can be reused
+ * for another file without notice. The result is cached for small
+ * requests, which cannot afford fcntl(), and refreshed for others.
+ *
+ * @param [in] fd File descriptor
+ * @param [in] refresh 1 to get the flags again instead of the cache
+ *
+ * @retval 1 if fd is opened with O_DIRECT, 0 otherwise.
+ */
+static int ve_accelerated_io_is_direct(int fd, int refresh)
+{
+	int errno_bak;
+	int flags;
+
+	if (acc_io_fd_mode == NULL || fd < 0 || fd >= acc_io_fd_max) {
+		return 0;
+	}
+	if (acc_io_fd_mode[fd] == ACC_IO_FD_UNKNOWN || refresh) {
+		errno_bak = errno;
+		flags = syscall(SYS_fcntl, fd, F_GETFL);
+		errno = errno_bak;
+		if (flags < 0) {
+			return 0;
+		}
+		acc_io_fd_mode[fd] = (flags & O_DIRECT) ?
+			ACC_IO_FD_DIRECT : ACC_IO_FD_BUFFERED;
+	}
+	return acc_io_fd_mode[fd] == ACC_IO_FD_DIRECT;
+}
+
+/**
+ * @brief This function reads a block of an O_DIRECT file descriptor
+ * into a temporary buffer. Data in it is not checksummed.
+ *
+ * @param [in] fd File descriptor
+ * @param [out] blk Buffer of ACC_IO_DIRECT_ALIGN bytes
+ * @param [in] ofs File offset aligned to ACC_IO_DIRECT_ALIGN
+ *
+ * @return Number of bytes read on success, -1 on failure.
+ */
+static ssize_t ve_accelerated_io_read_block(int fd, char *blk, off_t ofs)
+{
+	ssize_t ret;
+	acc_io_csum *cs = acc_io_csum_cur;
+
+	acc_io_csum_cur = NULL;
+	ret = ve_accelerated_io_read_pread(SYS_pread64, fd, blk,
+			ACC_IO_DIRECT_ALIGN, ofs);
+	acc_io_csum_cur = cs;
+	return ret;
+}
+
+/**
+ * @brief This function reads data from an O_DIRECT file descriptor.
+ * The system calls on VH use aligned file offsets and sizes, and the
+ * unaligned head and tail are read in blocks and copied partially.
+ *
+ * @param [in] syscall_num SYS_read or SYS_pread64
+ * @param [in] fd File descriptor
+ * @param [out] buf Buffer
+ * @param [in] count Size of buf
+ * @param [in] ofs File offset, it is 0 when read
+ *
+ * @return Total number of read bytes on Success, -1 on Failure.
+ */
+static ssize_t ve_accelerated_io_read_direct(int syscall_num, int fd,
+		char *buf, size_t count, off_t ofs)
+{
+	char blk[ACC_IO_DIRECT_ALIGN];
+	ssize_t ret;
+	ssize_t done = 0;
+	size_t skip;
+	size_t size;
+	off_t end;
+
+	acc_io_direct_part = 1;
+	if (SYS_read == syscall_num) {
+		if (ACC_IO_DIRECT_ALIGNED(count)) {
+			/* The file offset is usually aligned */
+			ret = ve_accelerated_io_read_pread(SYS_read, fd, buf,
+					count, 0);
+			if (ret >= 0 || errno != EINVAL) {
+				goto out;
+			}
+		}
+		ofs = syscall(SYS_lseek, fd, 0, SEEK_CUR);
+		if (ofs < 0) {
+			ret = FAIL;
+			goto out;
+		}
+	}
+	end = ofs + count;
+
+	skip = ofs & (ACC_IO_DIRECT_ALIGN - 1);
+	if (skip != 0) {
+		ret = ve_accelerated_io_read_block(fd, blk, ofs - skip);
+		if (ret < 0) {
+			goto out;
+		}
+		if (ret <= (ssize_t)skip) {
+			goto done;
+		}
+		size = MIN((size_t)ret - skip, count);
+		ve_accelerated_io_copy_small(buf, blk + skip, size);
+		done = size;
+		if (ret < ACC_IO_DIRECT_ALIGN) {
+			goto done;
+		}
+	}
+	size = (end & ~(off_t)(ACC_IO_DIRECT_ALIGN - 1)) - (ofs + done);
+	if (ofs + done < end && (ssize_t)size > 0) {
+		ret = ve_accelerated_io_read_pread(SYS_pread64, fd,
+				buf + done, size, ofs + done);
+		if (ret < 0) {
+			if (done == 0) {
+				goto out;
+			}
+			goto done;
+		}
+		done += ret;
+		if (ret < (ssize_t)size) {
+			goto done;
+		}
+	}
+	if (done < (ssize_t)count) {
+		ret = ve_accelerated_io_read_block(fd, blk, ofs + done);
+		if (ret < 0) {
+			if (done == 0) {
+				goto out;
+			}
+			goto done;
+		}
+		size = MIN((size_t)ret, count - done);
+		ve_accelerated_io_copy_small(buf + done, blk, size);
+		done += size;
+	}
+
+done:
+	ret = done;
+	if (SYS_read == syscall_num && done > 0) {
+		syscall(SYS_lseek, fd, ofs + done, SEEK_SET);
+	}
+out:
+	acc_io_direct_part = 0;
+	return ret;
+}
+
+/**
+ * @brief This function writes a part of a block of an O_DIRECT file
+ * descriptor by read-modify-write. The block is read, the part is
+ * replaced, and the whole block is written.
+ *
+ * @param [in] fd File descriptor
+ * @param [in] buf Data of the part
+ * @param [in] size Size of the part
+ * @param [in] ofs File offset of the part
+ *
+ * @return size on success, -1 on failure.
+ */
+static ssize_t ve_accelerated_io_write_block(int fd, const char *buf,
+		size_t size, off_t ofs)
+{
+	char blk[ACC_IO_DIRECT_ALIGN];
+	size_t skip = ofs & (ACC_IO_DIRECT_ALIGN - 1);
+	ssize_t ret;
+	acc_io_csum *cs;
+
+	ret = ve_accelerated_io_read_block(fd, blk, ofs - skip);
+	if (ret < 0) {
+		return FAIL;
+	}
+	if (ret < ACC_IO_DIRECT_ALIGN) {
+		/* Beyond the end of the file */
+		memset(blk + ret, 0, ACC_IO_DIRECT_ALIGN - ret);
+	}
+	ve_accelerated_io_copy_small(blk + skip, buf, size);
+	cs = acc_io_csum_cur;
+	acc_io_csum_cur = NULL;
+	ret = ve_accelerated_io_write_pwrite(SYS_pwrite64, fd, blk,
+			ACC_IO_DIRECT_ALIGN, ofs - skip);
+	acc_io_csum_cur = cs;
+	if (ret < 0) {
+		return FAIL;
+	}
+	if (ret < ACC_IO_DIRECT_ALIGN) {
+		errno = EIO;
+		return FAIL;
+	}
+	return size;
+}
+
+/**
+ * @brief This function writes data to an O_DIRECT file descriptor.
+ * The system calls on VH use aligned file offsets and sizes, and the
+ * unaligned head and tail are written by read-modify-write of blocks.
+ * The size of the file is restored when a block written exceeds both the
+ * old end of the file and the end of data.
+ *
+ * @note Read-modify-write is not atomic with other writes to the blocks.
+ *
+ * @param [in] syscall_num SYS_write or SYS_pwrite64
+ * @param [in] fd File descriptor
+ * @param [in] buf Buffer
+ * @param [in] count Size of data
+ * @param [in] ofs File offset, it is 0 when write
+ *
+ * @return Total number of write bytes on Success, -1 on Failure.
+ */
+static ssize_t ve_accelerated_io_write_direct(int syscall_num, int fd,
+		const char *buf, size_t count, off_t ofs)
+{
+	ssize_t ret;
+	ssize_t done = 0;
+	size_t size;
+	off_t end;
+	off_t blk_end;
+	struct stat stbuf;
+	int errno_bak;
+
+	acc_io_direct_part = 1;
+	if (SYS_write == syscall_num) {
+		if (ACC_IO_DIRECT_ALIGNED(count)) {
+			/* The file offset is usually aligned */
+			ret = ve_accelerated_io_write_pwrite(SYS_write, fd,
+					buf, count, 0);
+			if (ret >= 0 || errno != EINVAL) {
+				goto out;
+			}
+		}
+		ret = syscall(SYS_fcntl, fd, F_GETFL);
+		if (ret < 0 || (ret & O_APPEND)) {
+			/* The offset of O_APPEND is not known until written */
+			acc_io_direct_part = 0;
+			SYSCALL_CANCEL(ret, syscall_num, fd, buf, count, ofs);
+			return ret;
+		}
+		ofs = syscall(SYS_lseek, fd, 0, SEEK_CUR);
+		if (ofs < 0) {
+			ret = FAIL;
+			goto out;
+		}
+	}
+	if (syscall(SYS_fstat, fd, &stbuf) != 0) {
+		ret = FAIL;
+		goto out;
+	}
+	end = ofs + count;
+
+	if (!ACC_IO_DIRECT_ALIGNED(ofs)) {
+		size = MIN(ACC_IO_DIRECT_ALIGN
+				- (ofs & (ACC_IO_DIRECT_ALIGN - 1)), count);
+		ret = ve_accelerated_io_write_block(fd, buf, size, ofs);
+		if (ret < 0) {
+			goto out;
+		}
+		done = size;
+	}
+	size = (end & ~(off_t)(ACC_IO_DIRECT_ALIGN - 1)) - (ofs + done);
+	if (ofs + done < end && (ssize_t)size > 0) {
+		ret = ve_accelerated_io_write_pwrite(SYS_pwrite64, fd,
+				buf + done, size, ofs + done);
+		if (ret < 0) {
+			if (done == 0) {
+				goto out;
+			}
+			goto done;
+		}
+		done += ret;
+		if (ret < (ssize_t)size) {
+			goto done;
+		}
+	}
+	if (done < (ssize_t)count) {
+		ret = ve_accelerated_io_write_block(fd, buf + done,
+				count - done, ofs + done);
+		if (ret < 0) {
+			if (done == 0) {
+				goto out;
+			}
+			goto done;
+		}
+		done += ret;
+	}
+
+done:
+	ret = done;
+	errno_bak = errno;
+	/* Remove the padding of the last block written, which can be the
+	 * head block, beyond both the old end of the file and the data */
+	blk_end = (ofs + done + ACC_IO_DIRECT_ALIGN - 1)
+		& ~(off_t)(ACC_IO_DIRECT_ALIGN - 1);
+	if (blk_end > MAX(stbuf.st_size, ofs + done)) {
+		syscall(SYS_ftruncate, fd, MAX(stbuf.st_size, ofs + done));
+	}
+	if (SYS_write == syscall_num && done > 0) {
+		syscall(SYS_lseek, fd, ofs + done, SEEK_SET);
+	}
+	errno = errno_bak;
+out:
+	acc_io_direct_part = 0;
+	return ret;
+}
+
+/**
+ * @brief This function reads data by the system call without accelerated
+ * IO, and transforms the data read.
+ *
+ * @param [in] syscall_num SYS_read or SYS_pread64
+ * @param [in] fd File descriptor
+ * @param [out] buf Buffer
+ * @param [in] count Size of buf
+ * @param [in] ofs File offset, it is 0 when read
+ * @param [in] xf Transform of fd
+ *
+ * @return Total number of read bytes on Success, -1 on Failure.
+ */
+static ssize_t ve_accelerated_io_read_normal(int syscall_num, int fd,
+		void *buf, size_t count, off_t ofs, acc_io_xform *xf)
+{
+	ssize_t ret;
+	int err;
+
+	SYSCALL_CANCEL(ret, syscall_num, fd, buf, count, ofs);
+	if (ret > 0) {
+		err = ve_accelerated_io_transform(xf, buf, ret,
+				VE_ACC_IO_TRANSFORM_READ);
+		if (err != 0) {
+			errno = err;
+			ret = FAIL;
+		}
+	}
+	return ret;
+}
+
+/**
+ * @brief This function writes data by the system call without accelerated
+ * IO. Data to be transformed is transformed in a temporary buffer not to
+ * change the user buffer.
+ *
+ * @param [in] syscall_num SYS_write or SYS_pwrite64
+ * @param [in] fd File descriptor
+ * @param [in] buf Buffer
+ * @param [in] count Size of data
+ * @param [in] ofs File offset, it is 0 when write
+ * @param [in] xf Transform of fd
+ *
+ * @return Total number of write bytes on Success, -1 on Failure.
+ */
+static ssize_t ve_accelerated_io_write_normal(int syscall_num, int fd,
+		const void *buf, size_t count, off_t ofs, acc_io_xform *xf)
+{
+	ssize_t ret;
+	int err;
+	int errno_bak;
+	void *tmp;
+
+	if (xf->func == NULL) {
+		SYSCALL_CANCEL(ret, syscall_num, fd, buf, count, ofs);
+		return ret;
+	}
+	tmp = malloc(count);
+	if (tmp == NULL) {
+		errno = ENOMEM;
+		return FAIL;
+	}
+	memcpy(tmp, buf, count);
+	err = ve_accelerated_io_transform(xf, tmp, count,
+			VE_ACC_IO_TRANSFORM_WRITE);
+	if (err != 0) {
+		errno = err;
+		ret = FAIL;
+	} else {
+		SYSCALL_CANCEL(ret, syscall_num, fd, tmp, count, ofs);
+	}
+	errno_bak = errno;
+	free(tmp);
+	errno = errno_bak;
+	return ret;
+}
+
+/**
+ * @brief This function gets the index of the statistics of a hook.
+ *
+ * @param [in] syscall_num The number of system call
+ *
+ * @return The index of the hook, -1 if the system call is not hooked.
+ */
+static int ve_accelerated_io_hook_index(int syscall_num)
+{
+	switch (syscall_num) {
+	case SYS_read:
+		return VE_ACC_IO_HOOK_READ;
+	case SYS_pread64:
+		return VE_ACC_IO_HOOK_PREAD;
+	case SYS_readv:
+		return VE_ACC_IO_HOOK_READV;
+	case SYS_preadv:
+		return VE_ACC_IO_HOOK_PREADV;
+	case SYS_write:
+		return VE_ACC_IO_HOOK_WRITE;
+	case SYS_pwrite64:
+		return VE_ACC_IO_HOOK_PWRITE;
+	case SYS_writev:
+		return VE_ACC_IO_HOOK_WRITEV;
+	case SYS_pwritev:
+		return VE_ACC_IO_HOOK_PWRITEV;
+	}
+	return -1;
+}
+
+/**
+ * @brief This function adds a value to a field of the statistics of a
+ * hook and a file descriptor. Use ACC_IO_STATS_ADD() instead of calling
+ * this directly.
+ *
+ * @param [in] syscall_num The number of system call
+ * @param [in] fd File descriptor
+ * @param [in] field Offset of the field in struct ve_acc_io_stats
+ * @param [in] val Value to add
+ */
+static void ve_accelerated_io_stats_add(int syscall_num, int fd, size_t field,
+		uint64_t val)
+{
+	int hook;
+	int errno_bak = errno;
+	acc_io_fd_state *st;
+
+	/* Requests issued by the calibration are not counted */
+	hook = ve_accelerated_io_hook_index(syscall_num);
+	if (hook < 0 || acc_io_calibrating) {
+		return;
+	}
+	__sync_fetch_and_add((uint64_t *)((char *)&acc_io_hook_stats[hook]
+				+ field), val);
+	st = ve_accelerated_io_get_fd_state(fd, 1);
+	if (st != NULL) {
+		__sync_fetch_and_add((uint64_t *)((char *)&st->stats + field),
+				val);
+	}
+	errno = errno_bak;
+}
+
+/**
+ * @brief This function records an event to the trace ring buffer. The
+ * oldest event is overwritten when the ring buffer is full. Use
+ * ACC_IO_TRACE() instead of calling this directly.
+ *
+ * @param [in] syscall_num The number of system call
+ * @param [in] fd File descriptor
+ * @param [in] type Type of event (enum ve_acc_io_trace_type)
+ * @param [in] stage Pipeline stage
+ * @param [in] size Size of data, or result of system call
+ */
+static void ve_accelerated_io_trace(int syscall_num, int fd, int type,
+		int stage, int64_t size)
+{
+	int hook;
+	struct ve_acc_io_trace_event *ev;
+
+	hook = ve_accelerated_io_hook_index(syscall_num);
+	if (hook < 0 || acc_io_calibrating) {
+		return;
+	}
+	if (acc_io_trace_tid == 0) {
+		acc_io_trace_tid = (int)syscall(SYS_gettid);
+	}
+	ev = &acc_io_trace[__sync_fetch_and_add(&acc_io_trace_next, 1)
+		% acc_io_trace_size];
+	ev->time_ns = ve_accelerated_io_now_nsec();
+	ev->size = size;
+	ev->tid = acc_io_trace_tid;
+	ev->fd = fd;
+	ev->type = (uint16_t)type;
+	ev->hook = (uint16_t)hook;
+	ev->stage = (uint32_t)stage;
+}
+
+/**
+ * @brief This function applies the chunk size tuned for a file descriptor
+ * to an IO request, and starts measuring the request.
+ * The chunk size is not larger than the size of each pipeline stage in
+ * buffers.
+ *
+ * @param [in] fd File descriptor
+ * @param [in,out] io_info Pipeline of the request
+ */
+static void ve_accelerated_io_tune_begin(int fd, acc_io_info *io_info)
+{
+	acc_io_fd_state *st;
+
+	io_info->chunk_max = io_info->paras_size;
+	io_info->tune_start = 0;
+	if (!acc_io_auto_tune || acc_io_calibrating) {
+		return;
+	}
+	st = ve_accelerated_io_get_fd_state(fd, 1);
+	if (st == NULL) {
+		return;
+	}
+	if (st->tune.chunk > 0) {
+		io_info->paras_size = MIN(st->tune.chunk, io_info->chunk_max);
+	}
+	memset(&acc_io_req_stats, 0, sizeof(acc_io_req_stats));
+	io_info->tune_start = ve_accelerated_io_now_nsec();
+}
+
+/**
+ * @brief This function gets the next chunk size to try.
+ *
+ * @param [in] chunk Current chunk size
+ * @param [in] dir 1 to grow, -1 to shrink
+ * @param [in] chunk_max Maximum chunk size
+ *
+ * @return The next chunk size, which is the same as chunk at the bound.
+ */
+static ssize_t ve_accelerated_io_tune_next(ssize_t chunk, int dir,
+		ssize_t chunk_max)
+{
+	if (dir > 0) {
+		chunk = MIN(chunk * 2, chunk_max);
+	} else {
+		chunk = MAX(chunk / 2, PARAS_SIZE_MIN);
+	}
+	return chunk & ~(ssize_t)(PARAS_SIZE_ALIGN - 1);
+}
+
+/**
+ * @brief This function finishes measuring an IO request, and changes the
+ * chunk size of the file descriptor every ACC_IO_TUNE_WINDOW requests.
+ *
+ * The time of the VH stage (system calls) and of the VE stage (waiting
+ * for DMA and copying) per chunk is measured. A new probe starts by
+ * growing chunks if the VH stage is longer, to amortize the cost of each
+ * system call, or by shrinking them otherwise, to hide more of the VE
+ * stage behind system calls. The chunk size is doubled or halved while
+ * the throughput improves. When it gets worse or the size reaches a
+ * bound, the best size is kept for ACC_IO_TUNE_HOLD windows before the
+ * next probe, so that changes of the file system are followed.
+ *
+ * @param [in] fd File descriptor
+ * @param [in] io_info Pipeline of the request
+ * @param [in] result Total number of bytes transferred by the request
+ */
+static void ve_accelerated_io_tune_end(int fd, acc_io_info *io_info,
+		ssize_t result)
+{
+	acc_io_fd_state *st;
+	acc_io_tune *t;
+	uint64_t rate;
+
+	if (io_info->tune_start == 0 || result <= 0) {
+		return;
+	}
+	st = ve_accelerated_io_get_fd_state(fd, 0);
+	if (st == NULL) {
+		return;
+	}
+	/* Skip the update if another thread is updating */
+	if (__libsysve_a_swap(&st->tune.lock, VE_BUFF_USING)
+			!= VE_BUFF_NOT_USING) {
+		return;
+	}
+	t = &st->tune;
+	t->bytes += result;
+	t->ns += ve_accelerated_io_now_nsec() - io_info->tune_start;
+	t->vh_ns += acc_io_req_stats.syscall_ns;
+	t->ve_ns += acc_io_req_stats.dma_wait_ns + acc_io_req_stats.memcpy_ns;
+	t->chunks += (result + io_info->paras_size - 1) / io_info->paras_size;
+	if (++t->reqs < ACC_IO_TUNE_WINDOW) {
+		__libsysve_a_swap(&t->lock, VE_BUFF_NOT_USING);
+		return;
+	}
+
+	rate = t->bytes * 1000 / MAX(t->ns, 1);
+	st->stats.vh_chunk_ns = t->vh_ns / t->chunks;
+	st->stats.ve_chunk_ns = t->ve_ns / t->chunks;
+	if (t->chunk == 0) {
+		t->chunk = io_info->paras_size;
+	}
+	if (t->hold > 0) {
+		t->hold--;
+	} else if (t->dir == 0 || rate >= t->rate) {
+		/* Start a probe, or continue it because it was better */
+		if (t->dir == 0) {
+			t->dir = (st->stats.vh_chunk_ns >= st->stats.ve_chunk_ns)
+				? 1 : -1;
+		}
+		t->rate = rate;
+		t->prev = t->chunk;
+		t->chunk = ve_accelerated_io_tune_next(t->chunk, t->dir,
+				io_info->chunk_max);
+		if (t->chunk == t->prev) {
+			t->dir = 0;
+			t->hold = ACC_IO_TUNE_HOLD;
+		}
+	} else {
+		/* The last step made it worse */
+		t->chunk = t->prev;
+		t->dir = 0;
+		t->hold = ACC_IO_TUNE_HOLD;
+	}
+	st->stats.chunk_size = t->chunk;
+	t->reqs = 0;
+	t->bytes = 0;
+	t->ns = 0;
+	t->vh_ns = 0;
+	t->ve_ns = 0;
+	t->chunks = 0;
+	__libsysve_a_swap(&t->lock, VE_BUFF_NOT_USING);
+}
+
+/**
+ * @brief This function discards data read ahead. The file offset is not
+ * changed, because data is read ahead by pread().
+ *
+ * @param [in] st Locked state of a file descriptor
+ */
+static void ve_accelerated_io_invalidate_locked(acc_io_fd_state *st)
+{
+	st->ra_len = 0;
+	st->ra_pos = 0;
+	st->seq = 0;
+}
+
+/**
+ * @brief This function checks whether a file descriptor refers to a
+ * regular file.
+ *
+ * @param [in] fd File descriptor
+ * @param [in] st Locked state of fd
+ *
+ * @retval 1 if fd refers to a regular file, 0 otherwise.
+ */
+static int ve_accelerated_io_is_reg_locked(int fd, acc_io_fd_state *st)
+{
+	int errno_bak = errno;
+	struct stat stbuf;
+
+	if (st->is_reg < 0) {
+		st->is_reg = (syscall(SYS_fstat, fd, &stbuf) == 0
+				&& S_ISREG(stbuf.st_mode));
+		errno = errno_bak;
+	}
+	return st->is_reg;
+}
+
+/**
+ * @brief This function writes all data of a buffer, which has been
+ * reported to the user as written.
+ * errno of a failure is saved to st->err to be reported later.
+ *
+ * @param [in] syscall_num SYS_write or SYS_pwrite64
+ * @param [in] fd File descriptor
+ * @param [in] st State of fd
+ * @param [in] buf Buffer
+ * @param [in] count Size of data
+ * @param [in] ofs File offset, it is 0 when write
+ */
+static void ve_accelerated_io_write_all(int syscall_num, int fd,
+		acc_io_fd_state *st, const char *buf, size_t count, off_t ofs)
+{
+	int errno_bak = errno;
+	ssize_t ret;
+	size_t done = 0;
+	acc_io_csum *cs = acc_io_csum_cur;
+
+	/* Data buffered has been checksummed when it was written */
+	acc_io_csum_cur = NULL;
+	while (done < count) {
+		ret = ve_accelerated_io_write_pwrite(syscall_num, fd,
+				buf + done, count - done, ofs + done);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+		if (ret <= 0) {
+			__sync_bool_compare_and_swap(&st->err, 0,
+					(ret < 0) ? errno : EIO);
+			break;
+		}
+		done += ret;
+	}
+	acc_io_csum_cur = cs;
+	errno = errno_bak;
+}
+
+/**
+ * @brief This function waits for completion of writes of a file
+ * descriptor processed in background. The writer thread signals
+ * acc_io_async.done when it completes a request.
+ *
+ * @param [in] st Locked state of fd
+ */
+static void ve_accelerated_io_async_wait_locked(acc_io_fd_state *st)
+{
+	sigset_t sigset_old;
+
+	if (st->async_pending == 0) {
+		return;
+	}
+	/* Mask signals not to deadlock by IO from a signal handler */
+	pthread_sigmask(SIG_BLOCK, &acc_io_sigset, &sigset_old);
+	pthread_mutex_lock(&acc_io_async.lock);
+	while (st->async_pending != 0) {
+		pthread_cond_wait(&acc_io_async.done, &acc_io_async.lock);
+	}
+	pthread_mutex_unlock(&acc_io_async.lock);
+	pthread_sigmask(SIG_SETMASK, &sigset_old, NULL);
+}
+
+/**
+ * @brief This function releases the size of a write request from the
+ * size of data written in background, and wakes up threads waiting for
+ * the completion of the request or for the size to decrease.
+ *
+ * @param [in] st State of fd of the request, NULL if it was not queued
+ * @param [in] count Size of data of the request
+ */
+static void ve_accelerated_io_async_done(acc_io_fd_state *st, size_t count)
+{
+	sigset_t sigset_old;
+
+	pthread_sigmask(SIG_BLOCK, &acc_io_sigset, &sigset_old);
+	pthread_mutex_lock(&acc_io_async.lock);
+	acc_io_async_bytes -= count;
+	if (st != NULL) {
+		st->async_pending--;
+	}
+	pthread_cond_broadcast(&acc_io_async.done);
+	pthread_mutex_unlock(&acc_io_async.lock);
+	pthread_sigmask(SIG_SETMASK, &sigset_old, NULL);
+}
+
+/**
+ * @brief This function duplicates a file descriptor to keep the file it
+ * refers to open while data for the file is buffered. The duplicate is
+ * taken from the upper half of file descriptors not to take the number
+ * open() of the user is expected to return.
+ *
+ * @param [in] fd File descriptor
+ * @param [out] stbuf Status of the file, NULL if not needed
+ *
+ * @return The duplicated file descriptor on success, -1 on failure.
+ */
+static int ve_accelerated_io_pin_fd(int fd, struct stat *stbuf)
+{
+	int errno_bak = errno;
+	int pin;
+
+	pin = syscall(SYS_fcntl, fd, F_DUPFD_CLOEXEC, acc_io_fd_max / 2);
+	if (pin >= 0 && stbuf != NULL
+			&& syscall(SYS_fstat, pin, stbuf) != 0) {
+		syscall(SYS_close, pin);
+		pin = -1;
+	}
+	errno = errno_bak;
+	return pin;
+}
+
+/**
+ * @brief This function closes a file descriptor duplicated by
+ * ve_accelerated_io_pin_fd().
+ *
+ * @param [in] pin Duplicated file descriptor
+ */
+static void ve_accelerated_io_unpin_fd(int pin)
+{
+	int errno_bak = errno;
+
+	if (acc_io_fd_mode != NULL && pin < acc_io_fd_max) {
+		acc_io_fd_mode[pin] = ACC_IO_FD_UNKNOWN;
+	}
+	syscall(SYS_close, pin);
+	errno = errno_bak;
+}
+
+/**
+ * @brief This function waits for completion of writes processed in
+ * background, and writes data in the write-behind buffer.
+ *
+ * The file descriptor can be closed or reused without ve_acc_io_flush(),
+ * e.g. by fclose() or dup2() in the C library. Then the data is written
+ * through the duplicate to the file it was written for, and the state
+ * kept for that file is discarded.
+ *
+ * @param [in] fd File descriptor
+ * @param [in] st Locked state of fd
+ */
+static void ve_accelerated_io_flush_locked(int fd, acc_io_fd_state *st)
+{
+	int errno_bak;
+	int err;
+	int wfd = fd;
+	struct stat stbuf;
+	acc_io_xform xf;
+
+	ve_accelerated_io_async_wait_locked(st);
+	if (st->wb_pin == 0) {
+		return;
+	}
+	errno_bak = errno;
+	if (syscall(SYS_fstat, fd, &stbuf) != 0
+			|| stbuf.st_dev != st->wb_dev
+			|| stbuf.st_ino != st->wb_ino) {
+		/* The duplicate has no transform of fd */
+		wfd = st->wb_pin - 1;
+		xf.func = st->xform;
+		xf.arg = st->xform_arg;
+		err = ve_accelerated_io_transform(&xf, st->wb_buff,
+				st->wb_len, VE_ACC_IO_TRANSFORM_WRITE);
+		if (err != 0) {
+			__sync_bool_compare_and_swap(&st->err, 0, err);
+			st->wb_len = 0;
+		}
+		st->ra_len = 0;
+		st->ra_pos = 0;
+		st->seq = 0;
+		st->is_reg = -1;
+		if (acc_io_fd_mode != NULL) {
+			acc_io_fd_mode[fd] = ACC_IO_FD_UNKNOWN;
+		}
+	}
+	errno = errno_bak;
+	if (st->wb_len > 0) {
+		ve_accelerated_io_write_all(SYS_write, wfd, st, st->wb_buff,
+				st->wb_len, 0);
+		st->wb_len = 0;
+	}
+	ve_accelerated_io_unpin_fd(st->wb_pin - 1);
+	st->wb_pin = 0;
+}
+
+/**
+ * @brief This function completes writes of a file descriptor, and discards
+ * data read ahead for it.
+ * This is called before an IO request which uses or changes the file
+ * offset or the data of the file.
+ *
+ * @param [in] fd File descriptor
+ * @param [in] report 1 to get and clear the error of writes completed
+ *        after returning
+ *
+ * @return errno of write failed, 0 if none or report is 0.
+ */
+static int ve_accelerated_io_sync_fd(int fd, int report)
+{
+	acc_io_fd_state *st;
+	int err = 0;
+
+	st = ve_accelerated_io_lock_fd_state(fd, 0);
+	if (st != NULL) {
+		ve_accelerated_io_flush_locked(fd, st);
+		ve_accelerated_io_invalidate_locked(st);
+		if (report) {
+			err = __sync_lock_test_and_set(&st->err, 0);
+		}
+		ve_accelerated_io_unlock_fd_state(st);
+	}
+	return err;
+}
+
+/**
+ * @brief This function completes writes of all file descriptors, and
+ * discards data read ahead for them.
+ *
+ * @param [in] report 1 to display errors of writes to standard error,
+ *        0 to keep them to be reported by the next request of each fd
+ */
+static void ve_accelerated_io_sync_all(int report)
+{
+	int fd;
+	int err;
+
+	if (acc_io_fds == NULL) {
+		return;
+	}
+	for (fd = 0; fd < acc_io_fd_max; fd++) {
+		if (acc_io_fds[fd] == NULL) {
+			continue;
+		}
+		err = ve_accelerated_io_sync_fd(fd, report);
+		if (err != 0) {
+			fprintf(stderr, "Accelerated IO: writing buffered "
+					"data of fd %d failed: %s\n", fd,
+					strerror(err));
+		}
+	}
+}
+
+/**
+ * @brief This function is the thread which writes data in write-behind
+ * buffers which have not been written for
+ * VE_ACC_IO_WRITE_BEHIND_TIMEOUT milliseconds.
+ *
+ * @param [in] arg Unused
+ */
+static void *ve_accelerated_io_flusher(void *arg)
+{
+	int fd;
+	uint64_t now;
+	acc_io_fd_state *st;
+	struct timespec interval;
+
+	interval.tv_sec = acc_io_write_behind_timeout / 1000;
+	interval.tv_nsec = (acc_io_write_behind_timeout % 1000) * 1000000;
+	for (;;) {
+		nanosleep(&interval, NULL);
+		now = ve_accelerated_io_now_nsec() / 1000000;
+		for (fd = 0; fd < acc_io_fd_max; fd++) {
+			st = acc_io_fds[fd];
+			if (st == NULL || st->wb_len == 0
+				|| now - st->wb_time < acc_io_write_behind_timeout) {
+				continue;
+			}
+			st = ve_accelerated_io_lock_fd_state(fd, 0);
+			if (st != NULL) {
+				ve_accelerated_io_flush_locked(fd, st);
+				ve_accelerated_io_unlock_fd_state(st);
+			}
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief This function creates a thread in which all signals are blocked.
+ *
+ * @param [in] func Function of the thread
+ * @param [out] joinable The thread to be joined, NULL to create a
+ *        detached thread
+ *
+ * @retval 0 on success, -1 on failure.
+ */
+static int ve_accelerated_io_create_thread(void *(*func)(void *),
+		pthread_t *joinable)
+{
+	int ret;
+	pthread_t thread;
+	pthread_attr_t attr;
+	sigset_t sigset_old;
+
+	pthread_attr_init(&attr);
+	if (joinable == NULL) {
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	}
+	pthread_sigmask(SIG_BLOCK, &acc_io_sigset, &sigset_old);
+	ret = pthread_create(joinable != NULL ? joinable : &thread, &attr,
+			func, NULL);
+	pthread_sigmask(SIG_SETMASK, &sigset_old, NULL);
+	pthread_attr_destroy(&attr);
+	return (ret == 0) ? SUCCESS : FAIL;
+}
+
+/**
+ * @brief This function starts the thread which writes data in write-behind
+ * buffers periodically, if not started yet.
+ */
+static void ve_accelerated_io_start_flusher(void)
+{
+	if (acc_io_write_behind_timeout == 0 || acc_io_flusher_started
+		|| !__sync_bool_compare_and_swap(&acc_io_flusher_started, 0, 1)) {
+		return;
+	}
+	ve_accelerated_io_create_thread(ve_accelerated_io_flusher, NULL);
+}
+
+/**
+ * @brief This function is the thread which processes write requests
+ * queued by ve_accelerated_io_async_queue().
+ *
+ * @param [in] arg Unused
+ */
+static void *ve_accelerated_io_async_writer(void *arg)
+{
+	acc_io_async_req *req;
+
+	for (;;) {
+		pthread_mutex_lock(&acc_io_async.lock);
+		while (acc_io_async.head == NULL) {
+			pthread_cond_wait(&acc_io_async.cond,
+					&acc_io_async.lock);
+		}
+		req = acc_io_async.head;
+		acc_io_async.head = req->next;
+		if (acc_io_async.head == NULL) {
+			acc_io_async.tail = NULL;
+		}
+		pthread_mutex_unlock(&acc_io_async.lock);
+
+		ve_accelerated_io_write_all(req->syscall_num, req->fd,
+				req->st, req->data, req->count, req->ofs);
+		ve_accelerated_io_unpin_fd(req->fd);
+		ve_accelerated_io_async_done(req->st, req->count);
+		free(req);
+	}
+	return NULL;
+}
+
+/**
+ * @brief This function copies data to write, and queues it to be written
+ * by the writer thread in background.
+ * It waits on acc_io_async.done while the size of data queued would
+ * exceed VE_ACC_IO_ASYNC_WRITE.
+ * The request keeps a duplicate of the file descriptor, so the data is
+ * written to the file even if the file descriptor is closed or reused
+ * without ve_acc_io_flush(), e.g. by fclose() or dup2(). The data is
+ * transformed here because the duplicate has no transform. It fails if
+ * the file descriptor has been reused for a file which is not regular.
+ *
+ * @param [in] syscall_num SYS_write or SYS_pwrite64
+ * @param [in] fd File descriptor
+ * @param [in] st Locked state of fd
+ * @param [in] buf Buffer
+ * @param [in] count Size of data
+ * @param [in] ofs File offset, it is 0 when write
+ *
+ * @retval 0 on success, -1 on failure.
+ */
+static int ve_accelerated_io_async_queue(int syscall_num, int fd,
+		acc_io_fd_state *st, const void *buf, size_t count, off_t ofs)
+{
+	acc_io_async_req *req;
+	sigset_t sigset_old;
+	acc_io_xform xf;
+	int pin;
+	struct stat stbuf;
+
+	if (!acc_io_async.started) {
+		pthread_mutex_lock(&acc_io_async.lock);
+		if (!acc_io_async.started && SUCCESS ==
+			ve_accelerated_io_create_thread(
+				ve_accelerated_io_async_writer, NULL)) {
+			acc_io_async.started = 1;
+		}
+		pthread_mutex_unlock(&acc_io_async.lock);
+		if (!acc_io_async.started) {
+			return FAIL;
+		}
+	}
+
+	/* Mask signals not to deadlock by IO from a signal handler */
+	pthread_sigmask(SIG_BLOCK, &acc_io_sigset, &sigset_old);
+	pthread_mutex_lock(&acc_io_async.lock);
+	while (acc_io_async_bytes + (ssize_t)count > acc_io_async_write) {
+		pthread_cond_wait(&acc_io_async.done, &acc_io_async.lock);
+	}
+	acc_io_async_bytes += count;
+	pthread_mutex_unlock(&acc_io_async.lock);
+	pthread_sigmask(SIG_SETMASK, &sigset_old, NULL);
+
+	req = malloc(sizeof(acc_io_async_req) + count);
+	if (req == NULL) {
+		ve_accelerated_io_async_done(NULL, count);
+		return FAIL;
+	}
+	ve_accelerated_io_copy_small(req->data, buf, count);
+	ve_accelerated_io_get_xform(fd, &xf);
+	if (0 != ve_accelerated_io_transform(&xf, req->data, count,
+				VE_ACC_IO_TRANSFORM_WRITE)) {
+		free(req);
+		ve_accelerated_io_async_done(NULL, count);
+		return FAIL;
+	}
+	pin = ve_accelerated_io_pin_fd(fd, &stbuf);
+	if (pin >= 0 && !S_ISREG(stbuf.st_mode)) {
+		ve_accelerated_io_unpin_fd(pin);
+		st->is_reg = 0;
+		pin = -1;
+	}
+	if (pin < 0) {
+		free(req);
+		ve_accelerated_io_async_done(NULL, count);
+		return FAIL;
+	}
+	req->next = NULL;
+	req->syscall_num = syscall_num;
+	req->fd = pin;
+	req->ofs = ofs;
+	req->count = count;
+	req->st = st;
+
+	pthread_sigmask(SIG_BLOCK, &acc_io_sigset, &sigset_old);
+	pthread_mutex_lock(&acc_io_async.lock);
+	st->async_pending++;
+	if (acc_io_async.tail == NULL) {
+		acc_io_async.head = req;
+	} else {
+		acc_io_async.tail->next = req;
+	}
+	acc_io_async.tail = req;
+	pthread_cond_signal(&acc_io_async.cond);
+	pthread_mutex_unlock(&acc_io_async.lock);
+	pthread_sigmask(SIG_SETMASK, &sigset_old, NULL);
+	return SUCCESS;
+}
+
+/**
+ * @brief This function writes data to a file descriptor whose state is
+ * locked. The data is written in background when VE_ACC_IO_ASYNC_WRITE
+ * is set and the file descriptor refers to a regular file.
+ *
+ * @param [in] syscall_num SYS_write or SYS_pwrite64
+ * @param [in] fd File descriptor
+ * @param [in] st Locked state of fd
+ * @param [in] buf Buffer
+ * @param [in] count Size of data
+ * @param [in] ofs File offset, it is 0 when write
+ *
+ * @return Total number of write bytes on Success, -1 on Failure.
+ */
+static ssize_t ve_accelerated_io_write_locked(int syscall_num, int fd,
+		acc_io_fd_state *st, const void *buf, size_t count, off_t ofs)
+{
+	if (acc_io_async_write > 0 && count > 0 && buf != NULL
+			&& (ssize_t)count <= acc_io_async_write
+			&& ve_accelerated_io_is_reg_locked(fd, st)
+			&& SUCCESS == ve_accelerated_io_async_queue(syscall_num,
+				fd, st, buf, count, ofs)) {
+		return (ssize_t)count;
+	}
+	ve_accelerated_io_async_wait_locked(st);
+	return ve_accelerated_io_write_pwrite(syscall_num, fd, buf, count,
+			ofs);
+}
+
+/**
+ * @brief This function writes data to a file descriptor in background.
+ * An error is reported by the next write family system call or
+ * ve_acc_io_flush() for the file descriptor.
+ *
+ * @param [in] syscall_num SYS_write or SYS_pwrite64
+ * @param [in] fd File descriptor
+ * @param [in] buf Buffer
+ * @param [in] count Size of data
+ * @param [in] ofs File offset, it is 0 when write
+ *
+ * @return Total number of write bytes on Success, -1 on Failure.
+ */
+static ssize_t ve_accelerated_io_write_async(int syscall_num, int fd,
+		const void *buf, size_t count, off_t ofs)
+{
+	acc_io_fd_state *st;
+	ssize_t ret;
+	int err;
+
+	st = ve_accelerated_io_lock_fd_state(fd, 1);
+	if (st == NULL) {
+		return ve_accelerated_io_write_pwrite(syscall_num, fd, buf,
+				count, ofs);
+	}
+	if (st->wb_len > 0) {
+		ve_accelerated_io_flush_locked(fd, st);
+	}
+	ve_accelerated_io_invalidate_locked(st);
+	err = __sync_lock_test_and_set(&st->err, 0);
+	if (err != 0) {
+		errno = err;
+		ret = FAIL;
+	} else {
+		ret = ve_accelerated_io_write_locked(syscall_num, fd, st, buf,
+				count, ofs);
+	}
+	ve_accelerated_io_unlock_fd_state(st);
+	return ret;
+}
+
+/**
+ * @brief This function sets addresses of each pipeline stage to io_info.
+ *
+ * @param [out] io_info
+ * @param [in] acc_io_res Accelerated IO resources
+ */
+static void ve_accelerated_io_set_info(acc_io_info *io_info,
+		acc_io_resources *acc_io_res)
+{
+	int i;
+	int paras_per_buff;
+	acc_io_buffer *buff;
+
+	io_info->nparas = acc_io_res->nparas;
+	io_info->paras_size = acc_io_res->paras_size;
+	paras_per_buff = VE_BUFF_SIZE / acc_io_res->paras_size;
+
+	for (i = 0; i < io_info->nparas; i++) {
+		buff = acc_io_res->buff[i / paras_per_buff];
+		io_info->ve_buff[i] = (uint64_t)(buff->ve_io_buff)
+			+ io_info->paras_size * (i % paras_per_buff);
+		io_info->vh_vehva[i] = buff->vehva
+			+ io_info->paras_size * (i % paras_per_buff);
+		io_info->ve_vehva[i] = buff->local_vehva
+			+ io_info->paras_size * (i % paras_per_buff);
+
+		/* Set accelerated io bit flag to VHVA */
+		io_info->vh_buff_and_flag[i]
+			= (buff->vh_buff | VE_ACCELERATED_IO_FLAG)
+			+ io_info->paras_size * (i % paras_per_buff);
+	}
+}
+
+/**
+ * @brief This function handle pre-processing of IO request which is
+ * requested while the calling thread is using its buffer, e.g. from
+ * a signal handler.
+ * A buffer set is borrowed from the pool without waiting if the pool is
+ * enabled. Otherwise the secondary resources of the thread are used.
+ * Only one level of nesting is handled as accelerated IO.
+ *
+ * @param [out] struct acc_io_info
+ *
+ * @retval SUCCESS on success
+ * @retval NOBUF when no buffer is available
+ */
+static int ve_accelerated_io_pre_nested(acc_io_info *io_info)
+{
+	int retval;
+	acc_io_resources* acc_io_res;
+
+	retval = __libsysve_a_swap(&ve_nested_buff_using_flag, VE_BUFF_USING);
+	if (retval != VE_BUFF_NOT_USING) {
+		return NOBUF;
+	}
+
+	if (acc_io_pool_size > 0) {
+		retval = ve_accelerated_io_pool_get(&acc_io_res,
+				&io_info->slot, 0);
+		if (SUCCESS != retval) {
+			goto error_unlock_nested;
+		}
+	} else {
+		acc_io_res = pthread_getspecific(acc_io_resources_key);
+		if (acc_io_res == NULL || acc_io_res->nested == NULL) {
+			/* Allocated by the next request which is not nested */
+			acc_io_nested_wanted = 1;
+			retval = NOBUF;
+			goto error_unlock_nested;
+		}
+		acc_io_res = acc_io_res->nested;
+	}
+
+	io_info->nested = 1;
+	ve_accelerated_io_set_info(io_info, acc_io_res);
+	return SUCCESS;
+
+error_unlock_nested:
+	__libsysve_a_swap(&ve_nested_buff_using_flag, VE_BUFF_NOT_USING);
+	return NOBUF;
+}
+
+/**
+ * @brief This function handle pre-processing of IO request.
+ * 
+ * @param [out] struct acc_io_info
+ *
+ * @retval 0 on success, -1 on failure.
+ */
+static int ve_accelerated_io_pre(acc_io_info *io_info)
+{
+	int retval = SUCCESS;
+	int errno_bak = errno;
+	io_info->vh_mask = 1;
+	io_info->slot = NULL;
+	io_info->nested = 0;
+
+	acc_io_resources* acc_io_res;
+
+	pthread_testcancel();
+
+	if (PDMA_IO == constructor_result) {
+		return FAIL;
+	}
+
+	/* Checks VE IO buffer is using or not by flag ve_buff_using_flag */
+	retval = __libsysve_a_swap(&ve_buff_using_flag,VE_BUFF_USING);
+	if(retval != VE_BUFF_NOT_USING){
+		retval = ve_accelerated_io_pre_nested(io_info);
+		if (SUCCESS != retval) {
+			__sync_fetch_and_add(&acc_io_nobuf_count, 1);
+		}
+		errno = errno_bak;
+		return retval;
+	}
+
+	if (acc_io_pool_size > 0) {
+		retval = ve_accelerated_io_pool_get(&acc_io_res,
+				&io_info->slot, acc_io_pool_wait);
+	} else {
+		retval = ve_accelerated_io_get_thread_resource(&acc_io_res);
+	}
+	if (SUCCESS != retval) {
+		goto error_unlock_ve;
+	}
+
+	ve_accelerated_io_set_info(io_info, acc_io_res);
+	return SUCCESS;
+
+error_unlock_ve:
+	/* Free flag ve_buff_using_flag */
+	__libsysve_a_swap(&ve_buff_using_flag,
+			VE_BUFF_NOT_USING);
+	if (NOBUF == retval) {
+		__sync_fetch_and_add(&acc_io_nobuf_count, 1);
+	}
+	errno = errno_bak;
+	return retval;
+}
+
+/**
+ * @brief This function registers a user buffer to DMAATB to transfer data
+ * to/from the user buffer directly.
+ * The registration is cached by ve_register_mem_to_dmaatb_cached(), so
+ * the buffer added by ve_dmaatb_cache_add() and used repeatedly is
+ * registered only once.
+ *
+ * @param [in] buf User buffer
+ * @param [in] count Size of user buffer
+ * @param [in] min Minimum size of user buffer to be registered
+ * @param [out] reg Registered area. reg->vehva is set to 0 when the
+ *              user buffer is not registered.
+ */
+static void ve_accelerated_io_register_user_buff(void *buf, size_t count,
+		ssize_t min, acc_io_user_reg *reg)
+{
+	int errno_bak = errno;
+	uint64_t vehva;
+
+	reg->vehva = 0;
+	if (!acc_io_zero_copy || (ssize_t)count < min) {
+		return;
+	}
+	vehva = ve_register_mem_to_dmaatb_cached(buf, count);
+	if (vehva != (uint64_t)-1) {
+		reg->vehva = vehva;
+		reg->addr = (uint64_t)buf;
+	}
+	errno = errno_bak;
+}
+
+/**
+ * @brief This function releases a user buffer registered to DMAATB.
+ *
+ * @param [in] reg Area registered by ve_accelerated_io_register_user_buff()
+ */
+static void ve_accelerated_io_unregister_user_buff(acc_io_user_reg *reg)
+{
+	int errno_bak = errno;
+
+	if (reg->vehva != 0) {
+		ve_unregister_mem_from_dmaatb_cached(reg->vehva);
+		reg->vehva = 0;
+	}
+	errno = errno_bak;
+}
+
+/**
+ * @brief This function registers large elements of iovec to DMAATB to
+ * transfer data to/from them directly.
+ *
+ * @param [in] iov iovec
+ * @param [in] count Number of elements of iovec
+ * @param [out] regs Registered elements
+ */
+static void ve_accelerated_io_register_iov(const struct iovec *iov,
+		int count, acc_io_iov_regs *regs)
+{
+	int n;
+	acc_io_user_reg *reg;
+
+	regs->nregs = 0;
+	for (n = 0; n < count && regs->nregs < ACC_IO_IOV_REG_MAX; n++) {
+		reg = &regs->reg[regs->nregs];
+		ve_accelerated_io_register_user_buff(iov[n].iov_base,
+				iov[n].iov_len, acc_io_zero_copy_iov_min, reg);
+		if (reg->vehva != 0) {
+			regs->idx[regs->nregs] = n;
+			regs->nregs++;
+		}
+	}
+}
+
+/**
+ * @brief This function releases elements of iovec registered to DMAATB.
+ *
+ * @param [in] regs Elements registered by ve_accelerated_io_register_iov()
+ */
+static void ve_accelerated_io_unregister_iov(acc_io_iov_regs *regs)
+{
+	int i;
+
+	for (i = 0; i < regs->nregs; i++) {
+		ve_accelerated_io_unregister_user_buff(&regs->reg[i]);
+	}
+	regs->nregs = 0;
+}
+
+/**
+ * @brief This function gets the part of a piece of an iovec element which
+ * is transferred directly by DMA.
+ * Both the offset in the pipeline stage and the address of the part are
+ * aligned to 4 bytes.
+ *
+ * @param [in] regs Registered elements
+ * @param [in] n Index of the iovec element
+ * @param [in] addr Address of the piece
+ * @param [in] off Offset of the piece in the pipeline stage
+ * @param [in] len Size of the piece
+ * @param [out] head Size of the head of the piece not transferred directly
+ * @param [out] reg Registered area of the element
+ *
+ * @return Size of the part, 0 if the piece is not transferred directly.
+ */
+static ssize_t ve_accelerated_io_sg_direct(acc_io_iov_regs *regs, int n,
+		uint64_t addr, ssize_t off, ssize_t len, ssize_t *head,
+		acc_io_user_reg **reg)
+{
+	int i;
+	ssize_t h;
+	ssize_t size;
+
+	for (i = 0; i < regs->nregs && regs->idx[i] != n; i++)
+		;
+	if (i == regs->nregs || ((addr - off) & 0x3) != 0) {
+		return 0;
+	}
+	h = (-off) & 0x3;
+	size = (len - h) & ~(ssize_t)0x3;
+	if (size < ACC_IO_SG_PART_MIN) {
+		return 0;
+	}
+	*head = h;
+	*reg = &regs->reg[i];
+	return size;
+}
+
+/**
+ * @brief This function issues asynchronous DMA. It retries while the DMA
+ * descriptor to be used next is in use by DMA not completed yet.
+ *
+ * @param [in] dst VE host virtual address of destination
+ * @param [in] src VE host virtual address of source
+ * @param [in] size Transfer size
+ * @param [out] handle Handle used to inquire DMA completion
+ *
+ * @retval 0 on success, -1 on failure.
+ */
+static int ve_accelerated_io_dma_post(uint64_t dst, uint64_t src,
+		ssize_t size, ve_dma_handle_t *handle)
+{
+	int ret;
+
+	do {
+		ret = ve_dma_post(dst, src, (int)size, handle);
+	} while (ret == -EAGAIN);
+	return (ret == 0) ? SUCCESS : FAIL;
+}
+
+/**
+ * @brief This function waits DMA of a pipeline stage.
+ *
+ * @param [in] handle DMA handles of the stage
+ * @param [in] nhandle Number of DMA handles
+ *
+ * @retval 0 on success, 1 or more on failure.
+ */
+static int ve_accelerated_io_sg_wait(ve_dma_handle_t *handle, int nhandle)
+{
+	int i;
+	int ret = 0;
+
+	for (i = 0; i < nhandle; i++) {
+		if (ve_dma_wait(&handle[i]) != 0) {
+			ret = 1;
+		}
+	}
+	return ret;
+}
+
+/**
+ * @brief This function processes the data of a pipeline stage in iovec.
+ * Large pieces of registered iovec elements are transferred directly by
+ * DMA between the elements and the VH buffer. Other pieces are
+ * transferred via the VE buffer, at the same offset as the VH buffer.
+ *
+ * - ACC_IO_SG_READ_POST posts DMA from the VH buffer.
+ * - ACC_IO_SG_READ_COPY copies data from the VE buffer to iovec.
+ * - ACC_IO_SG_WRITE_COPY copies data from iovec to the VE buffer.
+ * - ACC_IO_SG_WRITE_POST posts DMA to the VH buffer.
+ *
+ * @param [in] op Operation
+ * @param [in] iov iovec
+ * @param [in] count Number of elements of iovec
+ * @param [in] regs Registered elements
+ * @param [in,out] pos Position of the stage in iovec, which is moved to
+ *                 the end of the stage.
+ * @param [in] size Size of data of the stage
+ * @param [in] io_info Accelerated IO information
+ * @param [in] j Index of the stage
+ * @param [out] handle DMA handles, which are waited on failure.
+ *              NULL for copy.
+ * @param [out] nhandle Number of DMA handles. NULL for copy.
+ *
+ * @retval 0 on success, -1 on failure of DMA.
+ */
+static int ve_accelerated_io_sg_stage(int op, const struct iovec *iov,
+		int count, acc_io_iov_regs *regs, acc_io_iov_pos *pos,
+		ssize_t size, acc_io_info *io_info, int j,
+		ve_dma_handle_t *handle, int *nhandle)
+{
+	int ret;
+	int ndirect = 0;
+	ssize_t off = 0;
+	ssize_t gap = 0;
+	ssize_t len;
+	ssize_t head = 0;
+	ssize_t direct;
+	uint64_t addr;
+	uint64_t user_vehva;
+	acc_io_user_reg *reg = NULL;
+	int post = (op == ACC_IO_SG_READ_POST || op == ACC_IO_SG_WRITE_POST);
+
+	if (post) {
+		*nhandle = 0;
+	}
+	while (off < size && pos->n < count) {
+		len = MIN((ssize_t)iov[pos->n].iov_len - pos->done,
+				size - off);
+		addr = (uint64_t)iov[pos->n].iov_base + pos->done;
+		direct = 0;
+		if (ndirect < ACC_IO_SG_DIRECT_MAX) {
+			direct = ve_accelerated_io_sg_direct(regs, pos->n,
+					addr, off, len, &head, &reg);
+		}
+		if (direct == 0) {
+			head = len;
+		} else {
+			ndirect++;
+		}
+
+		/* Via the VE buffer */
+		if (op == ACC_IO_SG_READ_COPY) {
+			__libsysve_vec_memcpy((void *)addr,
+					(void *)(io_info->ve_buff[j] + off),
+					head);
+			__libsysve_vec_memcpy(
+					(void *)(addr + head + direct),
+					(void *)(io_info->ve_buff[j] + off
+						+ head + direct),
+					len - head - direct);
+		} else if (op == ACC_IO_SG_WRITE_COPY) {
+			__libsysve_vec_memcpy(
+					(void *)(io_info->ve_buff[j] + off),
+					(void *)addr, head);
+			__libsysve_vec_memcpy(
+					(void *)(io_info->ve_buff[j] + off
+						+ head + direct),
+					(void *)(addr + head + direct),
+					len - head - direct);
+		}
+
+		/* Directly */
+		if (post && direct != 0) {
+			user_vehva = ACC_IO_USER_VEHVA(reg, addr + head);
+			ret = SUCCESS;
+			if (off + head > gap) {
+				ret = (op == ACC_IO_SG_READ_POST)
+					? ve_accelerated_io_dma_post(io_info->ve_vehva[j] + gap,
+						io_info->vh_vehva[j] + gap,
+						off + head - gap,
+						&handle[*nhandle])
+					: ve_accelerated_io_dma_post(io_info->vh_vehva[j] + gap,
+						io_info->ve_vehva[j] + gap,
+						off + head - gap,
+						&handle[*nhandle]);
+				if (SUCCESS == ret) {
+					(*nhandle)++;
+				}
+			}
+			if (SUCCESS == ret) {
+				ret = (op == ACC_IO_SG_READ_POST)
+					? ve_accelerated_io_dma_post(user_vehva,
+						io_info->vh_vehva[j] + off + head,
+						direct, &handle[*nhandle])
+					: ve_accelerated_io_dma_post(
+						io_info->vh_vehva[j] + off + head,
+						user_vehva, direct,
+						&handle[*nhandle]);
+			}
+			if (SUCCESS != ret) {
+				ve_accelerated_io_sg_wait(handle, *nhandle);
+				*nhandle = 0;
+				return FAIL;
+			}
+			(*nhandle)++;
+			gap = off + head + direct;
+		}
+
+		off += len;
+		pos->done += len;
+		if (pos->done >= (ssize_t)iov[pos->n].iov_len) {
+			pos->n++;
+			pos->done = 0;
+		}
+	}
+
+	if (post && size > gap) {
+		ret = (op == ACC_IO_SG_READ_POST)
+			? ve_accelerated_io_dma_post(io_info->ve_vehva[j] + gap,
+				io_info->vh_vehva[j] + gap,
+				GET_DMA_SIZE(size - gap), &handle[*nhandle])
+			: ve_accelerated_io_dma_post(io_info->vh_vehva[j] + gap,
+				io_info->ve_vehva[j] + gap,
+				GET_DMA_SIZE(size - gap), &handle[*nhandle]);
+		if (SUCCESS != ret) {
+			ve_accelerated_io_sg_wait(handle, *nhandle);
+			*nhandle = 0;
+			return FAIL;
+		}
+		(*nhandle)++;
+	}
+	return SUCCESS;
+}
+
+/**
+ * @brief This function is register to pthread_atfork() and called before fork.
+ * */
+static void ve_accelerated_io_atfork_prepare(){
+	/* The file offset is shared with the child */
+	ve_accelerated_io_sync_all(0);
+	pthread_sigmask(SIG_BLOCK, &acc_io_sigset, &acc_io_sigset_old);
+	pthread_mutex_lock(&acc_io_resources_list_lock);
+}
+
+/**
+ * @brief This function is register to pthread_atfork() and called at parent after fork.
+ */
+static void ve_accelerated_io_atfork_parent(){
+	pthread_mutex_unlock(&acc_io_resources_list_lock);
+	pthread_sigmask(SIG_SETMASK, &acc_io_sigset_old, NULL);
+}
+
+/**
+ * @brief This function marks all accelerated IO resources copied from
+ * parent as inherited. They are released lazily when the thread or the
+ * pool slot requests IO, so that a child which does not request IO, e.g.
+ * which calls exec(), does not pay for the release.
+ * This function is register to pthread_atfork() and called at child after fork.
+ */
+ static void ve_accelerated_io_atfork_child(){
+	int i;
+
+	pthread_mutex_unlock(&acc_io_resources_list_lock);
+	pthread_mutex_init(&acc_io_staging_lock, NULL);
+	pthread_mutex_init(&acc_io_conf_lock, NULL);
+
+	acc_io_fork_gen++;
+	acc_io_fork_own = pthread_getspecific(acc_io_resources_key);
+	ve_buff_using_flag = VE_BUFF_NOT_USING;
+	ve_nested_buff_using_flag = VE_BUFF_NOT_USING;
+	acc_io_nested_wanted = 0;
+
+	acc_io_fd_locked = 0;
+	acc_io_flusher_started = 0;
+	pthread_mutex_init(&acc_io_async.lock, NULL);
+	pthread_cond_init(&acc_io_async.cond, NULL);
+	pthread_cond_init(&acc_io_async.done, NULL);
+	acc_io_async.head = NULL;
+	acc_io_async.tail = NULL;
+	acc_io_async.started = 0;
+	acc_io_async_bytes = 0;
+	/* Helper threads of the parent do not exist in the child */
+	pthread_mutex_init(&acc_io_stream.lock, NULL);
+	pthread_cond_init(&acc_io_stream.cond, NULL);
+	pthread_cond_init(&acc_io_stream.done, NULL);
+	acc_io_stream.head = NULL;
+	acc_io_stream.nworkers = 0;
+	acc_io_stream.shutdown = 0;
+	acc_io_stream_part = 0;
+	acc_io_trace_next = 0;
+	acc_io_trace_tid = 0;
+	for (i = 0; acc_io_fds != NULL && i < acc_io_fd_max; i++) {
+		if (acc_io_fds[i] != NULL) {
+			acc_io_fds[i]->lock = VE_BUFF_NOT_USING;
+			acc_io_fds[i]->async_pending = 0;
+			acc_io_fds[i]->tune.lock = VE_BUFF_NOT_USING;
+			acc_io_fds[i]->csum_lock = VE_BUFF_NOT_USING;
+		}
+	}
+	acc_io_csum_cur = NULL;
+	acc_io_csum_busy = 0;
+
+	for (i = 0; i < acc_io_pool_size; i++) {
+		acc_io_pool[i].busy = VE_BUFF_NOT_USING;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &acc_io_sigset_old, NULL);
+}
+
+/**
+ * @brief This function is destructor registered by pthread_key_create with acc_io_resources_key. 
+ * The global variable list_head is the head of “ve_acc_io_ve_resource” list. 
+ * This function removes accelerated IO resource from the list and call ve_accelerated_io_release_resource.
+ * 
+ * @param [in] param
+ */
+static void ve_accelerated_io_dstfunc(void* param){
+	acc_io_resources *res = param;
+
+	ve_accelerated_io_unlink_resource(res);
+	ve_accelerated_io_release_resource(res,
+			res->fork_gen != acc_io_fork_gen);
+}
+
+/**
+ * @brief This function release VE/VH memory and DMAATB.
+ *  Unregistering DMAATB is skipped when this function is called from pthread_atfork handler.
+ * 
+ * @param [in] VE accelerated io resource to be released. 
+ * This includes some resources for user DMA such as VEHVA, VH address. 
+ * @param [in] Set to 1 when this function called from pthread_atfork handler. Otherwise 0.
+ */
+static void ve_accelerated_io_release_resource(acc_io_resources *res, int is_fork){
+	int i;
+	acc_io_buffer *buff;
+
+	if (res->nested != NULL) {
+		ve_accelerated_io_release_resource(res->nested, is_fork);
+	}
+
+	for (i = 0; i < res->nbuffs; i++) {
+		buff = res->buff[i];
+		syscall(SYS_sysve,
+				VE_SYSVE_ACCELERATED_IO_FREE_VH_BUF,
+				buff->vh_buff);
+		if(is_fork == 0){
+			syscall(SYS_sysve,
+					VE_SYSVE_ACCELERATED_IO_UNREGISTER_DMAATB,
+					buff->local_vehva, buff->vehva);
+		}
+		ve_accelerated_io_free_staging(buff);
+		free(buff);
+	}
+	free(res);
+}
+
+
+/**
+ * @brief This function handle post-processing of IO request.
+ *
+ * @param [in] struct acc_io_info
+ */
+static void ve_accelerated_io_post(acc_io_info *io_info)
+{
+	if (io_info->slot != NULL) {
+		ve_accelerated_io_pool_put(io_info->slot);
+		io_info->slot = NULL;
+	}
+	if (io_info->nested) {
+		__libsysve_a_swap(&ve_nested_buff_using_flag,
+				VE_BUFF_NOT_USING);
+	} else {
+		/* Free flag ve_buff_using_flag */
+		__libsysve_a_swap(&ve_buff_using_flag,
+				VE_BUFF_NOT_USING);
+	}
+
+	pthread_testcancel();
+}
+
+/**
+ * @brief This function free the io hook
  */
 static void ve_accelerated_io_free_io_hook(void)
 {
@@ -439,30 +3890,359 @@ static void ve_accelerated_io_free_io_hook(void)
 }
 
 /**
- * @brief The continued processing after DMA transmission is processed for each
- * "8MB / BUFF_NPARAS".
- * This function finds the min number in these continued processing that has
- * not been executed yet.This function ,
+ * @brief The continued processing after DMA transmission is processed for each
+ * "paras_size".
+ * This function finds the min number in these continued processing that has
+ * not been executed yet.This function ,
+ *
+ * @param[in] point of array
+ * @param[in] number of elements of array
+ *
+ * @retval the element number of array.
+ */
+static inline int __ve_find_min_posted(uint64_t *posted, int nparas)
+{
+	int k;
+	int min_k = 0;
+	uint64_t min_v = UINT64_MAX;
+	for (k = 0; k < nparas; k++) {
+		if (posted[k] == -1) {
+			continue;
+		}
+		if (posted[k] < min_v) {
+			min_v = posted[k];
+			min_k = k;
+		}
+	}
+	return min_k;
+}
+
+/**
+ * @brief This function calibrates the maximum size of IO requests handled
+ * as normal IO.
+ * Reading /dev/zero by normal IO and by accelerated IO is timed for sizes
+ * from SMALL_IO_CALIB_MIN to SMALL_IO_CALIB_MAX, and the largest size
+ * below the first size where accelerated IO is faster is used.
+ * The default is kept when the calibration fails.
+ */
+static void ve_accelerated_io_calibrate(void)
+{
+	int i;
+	int fd;
+	int errno_bak = errno;
+	void *buf;
+	ssize_t ret;
+	ssize_t size;
+	ssize_t small_io_max = 0;
+	uint64_t t, t_normal, t_acc;
+
+	buf = malloc(SMALL_IO_CALIB_MAX);
+	fd = syscall(SYS_open, "/dev/zero", O_RDONLY);
+	if (buf == NULL || fd < 0) {
+		goto out;
+	}
+
+	acc_io_calibrating = 1;
+	/* Allocate resources of this thread before timing */
+	ret = ve_accelerated_io_read_pread(SYS_pread64, fd, buf,
+			SMALL_IO_CALIB_MIN, 0);
+	if (ret != SMALL_IO_CALIB_MIN || PDMA_IO == constructor_result) {
+		goto out;
+	}
+	for (size = SMALL_IO_CALIB_MIN; size <= SMALL_IO_CALIB_MAX;
+			size *= 2) {
+		t_normal = UINT64_MAX;
+		t_acc = UINT64_MAX;
+		for (i = 0; i < SMALL_IO_CALIB_ITERS; i++) {
+			t = ve_accelerated_io_now_nsec();
+			ret = syscall(SYS_pread64, fd, buf, size, 0);
+			t = ve_accelerated_io_now_nsec() - t;
+			if (ret != size) {
+				goto out;
+			}
+			t_normal = MIN(t_normal, t);
+
+			t = ve_accelerated_io_now_nsec();
+			ret = ve_accelerated_io_read_pread(SYS_pread64, fd,
+					buf, size, 0);
+			t = ve_accelerated_io_now_nsec() - t;
+			if (ret != size) {
+				goto out;
+			}
+			t_acc = MIN(t_acc, t);
+		}
+		if (t_acc < t_normal) {
+			break;
+		}
+		small_io_max = size;
+	}
+	acc_io_small_io_max = small_io_max;
+
+out:
+	acc_io_calibrating = 0;
+	if (fd >= 0) {
+		syscall(SYS_close, fd);
+	}
+	free(buf);
+	acc_io_calib_state = ACC_IO_CALIB_DONE;
+	errno = errno_bak;
+}
+
+/**
+ * @brief This function checks whether an IO request should be handled as
+ * normal IO because it is small.
+ * The threshold is never measured here, so that no IO request pays for
+ * the calibration. The default is used until ve_acc_io_prewarm()
+ * calibrates the threshold, and by a request of the calibration itself.
+ *
+ * @param[in] count Size of IO request
+ *
+ * @retval 1 if the IO request is small, 0 otherwise.
+ */
+static int ve_accelerated_io_is_small_io(size_t count)
+{
+	if (acc_io_calibrating) {
+		return 0;
+	}
+	return (ssize_t)count <= acc_io_small_io_max;
+}
+
+/**
+ * @brief This function reads a part of a read request processed by
+ * multiple threads.
+ *
+ * @param[in] job Read request
+ * @param[in] p Index of the part
+ */
+static void ve_accelerated_io_stream_read_part(acc_io_stream_job *job, int p)
+{
+	off_t off = (off_t)job->part_size * p;
+	size_t size = MIN(job->part_size, job->count - off);
+	size_t done = 0;
+	ssize_t ret = 0;
+	int errno_bak = errno;
+
+	acc_io_stream_part = 1;
+	while (done < size) {
+		ret = ve_accelerated_io_read_pread(SYS_pread64, job->fd,
+				job->buf + off + done, size - done,
+				job->ofs + off + done);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+		if (ret <= 0) {
+			break;
+		}
+		done += ret;
+	}
+	acc_io_stream_part = 0;
+	job->result[p] = done;
+	job->err[p] = (ret < 0) ? errno : 0;
+	errno = errno_bak;
+}
+
+/**
+ * @brief This function takes a part of a read request not taken yet. The
+ * request is removed from the queue when its last part is taken.
+ * acc_io_stream.lock must be locked.
  *
- * @param[in] point of array
+ * @param[in,out] job Read request to take a part of, or NULL to take a
+ *                part of the first request queued, which is stored
  *
- * @retval the element number of array.
+ * @return Index of the part, -1 if no part is left.
  */
-static inline int __ve_find_min_posted(uint64_t *posted)
+static int ve_accelerated_io_stream_take_locked(acc_io_stream_job **job)
 {
-	int k;
-	int min_k = 0;
-	uint64_t min_v = UINT64_MAX;
-	for (k = 0; k < BUFF_NPARAS; k++) {
-		if (posted[k] == -1) {
+	acc_io_stream_job **pp;
+	int p;
+
+	if (*job == NULL) {
+		*job = acc_io_stream.head;
+	}
+	if (*job == NULL || (*job)->next_part >= (*job)->nparts) {
+		return -1;
+	}
+	p = (*job)->next_part++;
+	if ((*job)->next_part == (*job)->nparts) {
+		for (pp = &acc_io_stream.head; *pp != *job;
+				pp = &(*pp)->next) {
+			;
+		}
+		*pp = (*job)->next;
+	}
+	return p;
+}
+
+/**
+ * @brief This function records that a part of a read request has been
+ * read, and wakes up the requesting thread when all parts are read.
+ * acc_io_stream.lock must be locked.
+ *
+ * @param[in] job Read request
+ */
+static void ve_accelerated_io_stream_done_locked(acc_io_stream_job *job)
+{
+	job->ndone++;
+	if (job->ndone == job->nparts) {
+		pthread_cond_broadcast(&acc_io_stream.done);
+	}
+}
+
+/**
+ * @brief This function is the helper thread which processes parts of read
+ * requests queued by any thread, until ve_accelerated_io_stream_shutdown()
+ * is called.
+ *
+ * @param [in] arg Unused
+ */
+static void *ve_accelerated_io_stream_worker(void *arg)
+{
+	acc_io_stream_job *job;
+	int p;
+
+	pthread_mutex_lock(&acc_io_stream.lock);
+	while (!acc_io_stream.shutdown) {
+		job = NULL;
+		p = ve_accelerated_io_stream_take_locked(&job);
+		if (p < 0) {
+			pthread_cond_wait(&acc_io_stream.cond,
+					&acc_io_stream.lock);
 			continue;
 		}
-		if (posted[k] < min_v) {
-			min_v = posted[k];
-			min_k = k;
+		pthread_mutex_unlock(&acc_io_stream.lock);
+		ve_accelerated_io_stream_read_part(job, p);
+		pthread_mutex_lock(&acc_io_stream.lock);
+		ve_accelerated_io_stream_done_locked(job);
+	}
+	pthread_mutex_unlock(&acc_io_stream.lock);
+	return NULL;
+}
+
+/**
+ * @brief This function stops the helper threads of VE_ACC_IO_STREAMS and
+ * waits for them to exit. A part being read by a helper thread is
+ * completed, and parts not taken are read by the requesting thread.
+ */
+static void ve_accelerated_io_stream_shutdown(void)
+{
+	int i;
+	int n;
+	sigset_t sigset_old;
+
+	pthread_sigmask(SIG_BLOCK, &acc_io_sigset, &sigset_old);
+	pthread_mutex_lock(&acc_io_stream.lock);
+	acc_io_stream.shutdown = 1;
+	n = acc_io_stream.nworkers;
+	pthread_cond_broadcast(&acc_io_stream.cond);
+	pthread_mutex_unlock(&acc_io_stream.lock);
+	pthread_sigmask(SIG_SETMASK, &sigset_old, NULL);
+	for (i = 0; i < n; i++) {
+		pthread_join(acc_io_stream.workers[i], NULL);
+	}
+}
+
+/**
+ * @brief This function reads a large request by VE_ACC_IO_STREAMS threads.
+ * The request is divided into parts, and each part is read by pread at
+ * its own offset with the resources of the thread. The size read is the
+ * sum of parts up to the first part which is not read fully, as a single
+ * read. The file offset is updated for read.
+ * Requests of multiple threads are queued and share the helper threads.
+ * The requesting thread reads parts of its own request too, and waits on
+ * acc_io_stream.done for the parts taken by helper threads.
+ *
+ * @param[in] syscall_num SYS_read or SYS_pread64
+ * @param[in] fd File descriptor
+ * @param[in] buf Buffer
+ * @param[in] count Size of request
+ * @param[in] ofs File offset, it is 0 when read
+ * @param[out] result Total number of read bytes, or -1 on failure
+ *
+ * @retval 0 if processed
+ * @retval 1 if not processed, e.g. when the file offset is not available.
+ */
+static int ve_accelerated_io_stream_read(int syscall_num, int fd, void *buf,
+		size_t count, off_t ofs, ssize_t *result)
+{
+	int p;
+	int err = 0;
+	ssize_t total = 0;
+	sigset_t sigset_old;
+	acc_io_stream_job job;
+	acc_io_stream_job *jp = &job;
+	acc_io_stream_job **pp;
+
+	if (SYS_read == syscall_num) {
+		ofs = syscall(SYS_lseek, fd, 0, SEEK_CUR);
+		if (ofs < 0) {
+			return NOBUF;
 		}
 	}
-	return min_k;
+
+	/* Queue the job */
+	pthread_sigmask(SIG_BLOCK, &acc_io_sigset, &sigset_old);
+	pthread_mutex_lock(&acc_io_stream.lock);
+	while (acc_io_stream.nworkers < acc_io_streams - 1
+			&& !acc_io_stream.shutdown
+			&& SUCCESS == ve_accelerated_io_create_thread(
+				ve_accelerated_io_stream_worker,
+				&acc_io_stream.workers[acc_io_stream.nworkers])) {
+		acc_io_stream.nworkers++;
+	}
+	job.next = NULL;
+	job.fd = fd;
+	job.buf = buf;
+	job.ofs = ofs;
+	job.count = count;
+	job.nparts = acc_io_stream.nworkers + 1;
+	job.part_size = (count + job.nparts - 1) / job.nparts;
+	job.part_size = (job.part_size + PARAS_SIZE_ALIGN - 1)
+		& ~(PARAS_SIZE_ALIGN - 1);
+	job.nparts = (count + job.part_size - 1) / job.part_size;
+	job.next_part = 0;
+	job.ndone = 0;
+	for (pp = &acc_io_stream.head; *pp != NULL; pp = &(*pp)->next) {
+		;
+	}
+	*pp = &job;
+	pthread_cond_broadcast(&acc_io_stream.cond);
+
+	/* Read parts of the job not taken by helper threads */
+	while ((p = ve_accelerated_io_stream_take_locked(&jp)) >= 0) {
+		pthread_mutex_unlock(&acc_io_stream.lock);
+		pthread_sigmask(SIG_SETMASK, &sigset_old, NULL);
+		ve_accelerated_io_stream_read_part(&job, p);
+		pthread_sigmask(SIG_BLOCK, &acc_io_sigset, &sigset_old);
+		pthread_mutex_lock(&acc_io_stream.lock);
+		ve_accelerated_io_stream_done_locked(&job);
+	}
+
+	/* Wait for parts read by helper threads */
+	while (job.ndone < job.nparts) {
+		pthread_cond_wait(&acc_io_stream.done, &acc_io_stream.lock);
+	}
+	pthread_mutex_unlock(&acc_io_stream.lock);
+	pthread_sigmask(SIG_SETMASK, &sigset_old, NULL);
+
+	for (p = 0; p < job.nparts; p++) {
+		total += job.result[p];
+		if (job.result[p] < (ssize_t)MIN(job.part_size,
+					count - job.part_size * p)) {
+			err = job.err[p];
+			break;
+		}
+	}
+
+	if (total == 0 && err != 0) {
+		errno = err;
+		*result = FAIL;
+		return SUCCESS;
+	}
+	if (SYS_read == syscall_num) {
+		syscall(SYS_lseek, fd, ofs + total, SEEK_SET);
+	}
+	*result = total;
+	return SUCCESS;
 }
 
 /**
@@ -483,15 +4263,22 @@ static ssize_t ve_accelerated_io_read_pread(int syscall_num, int fd, void *buf,
 	int ret = 0;
 	int dma_ret = 0;
 	int errno_bak = 0;
-	uint64_t posted[BUFF_NPARAS];
-	uint64_t read_num = 0;
+	uint64_t posted[BUFF_NPARAS_MAX];
+	size_t read_size = 0;
 	int min_k = 0;
 	int data_err = 0;
 	acc_io_info io_info;
-	ssize_t transfer_size = PARAS_SIZE;
-	ssize_t read_out_size[BUFF_NPARAS];
+	acc_io_user_reg user_reg;
+	ssize_t transfer_size;
+	ssize_t read_out_size[BUFF_NPARAS_MAX];
 	ssize_t exit_result = 0;
-	ve_dma_handle_t vedma_handle[BUFF_NPARAS];
+	ve_dma_handle_t vedma_handle[BUFF_NPARAS_MAX];
+	void *user_buff[BUFF_NPARAS_MAX];
+	int direct[BUFF_NPARAS_MAX];
+	uint64_t t_stats;
+	acc_io_xform xf;
+	int err;
+	int direct_io;
 
 	if (0 == count) {
 		SYSCALL_CANCEL(exit_result, syscall_num, fd, buf, count, ofs);
@@ -502,37 +4289,96 @@ static ssize_t ve_accelerated_io_read_pread(int syscall_num, int fd, void *buf,
 		errno = EFAULT;
 		return exit_result;
 	}
+	/* IO of O_DIRECT fd is always transferred via aligned VH buffer */
+	direct_io = acc_io_direct_part || ve_accelerated_io_is_direct(fd,
+			!ve_accelerated_io_is_small_io(count));
+	if (direct_io && !acc_io_direct_part && (SYS_read == syscall_num
+			|| !ACC_IO_DIRECT_ALIGNED(ofs)
+			|| !ACC_IO_DIRECT_ALIGNED(count))) {
+		return ve_accelerated_io_read_direct(syscall_num, fd, buf,
+				count, ofs);
+	}
+	ve_accelerated_io_get_xform(fd, &xf);
+	if (!direct_io && ve_accelerated_io_is_small_io(count)) {
+		ACC_IO_STATS_ADD(syscall_num, fd, small_io, 1);
+		exit_result = ve_accelerated_io_read_normal(syscall_num, fd,
+				buf, count, ofs, &xf);
+		/* fd may have been reopened with O_DIRECT since cached */
+		if (exit_result < 0 && EINVAL == errno
+				&& ve_accelerated_io_is_direct(fd, 1)) {
+			exit_result = ve_accelerated_io_read_direct(
+					syscall_num, fd, buf, count, ofs);
+		}
+		return exit_result;
+	}
+	if (acc_io_streams > 1 && !acc_io_stream_part && !direct_io
+			&& acc_io_csum_cur == NULL && xf.func == NULL
+			&& (ssize_t)count >= acc_io_stream_min
+			&& SUCCESS == ve_accelerated_io_stream_read(syscall_num,
+				fd, buf, count, ofs, &exit_result)) {
+		return exit_result;
+	}
 	/* Pre processing of IO request */
 	ret = ve_accelerated_io_pre(&io_info);
 
 	if (FAIL == ret) {
 		ve_accelerated_io_free_io_hook();
-		SYSCALL_CANCEL(exit_result, syscall_num, fd, buf, count, ofs);
-		return exit_result;
+		ACC_IO_STATS_ADD(syscall_num, fd, disabled, 1);
+		return ve_accelerated_io_read_normal(syscall_num, fd, buf,
+				count, ofs, &xf);
 	} else if (NOBUF == ret) {
-		SYSCALL_CANCEL(exit_result, syscall_num, fd, buf, count, ofs);
-		return exit_result;
+		ACC_IO_STATS_ADD(syscall_num, fd, nobuf, 1);
+		return ve_accelerated_io_read_normal(syscall_num, fd, buf,
+				count, ofs, &xf);
+	}
+	if (direct_io && !ACC_IO_DIRECT_ALIGNED(io_info.vh_buff_and_flag[0])) {
+		ve_accelerated_io_post(&io_info);
+		return ve_accelerated_io_read_normal(syscall_num, fd, buf,
+				count, ofs, &xf);
+	}
+	ve_accelerated_io_tune_begin(fd, &io_info);
+
+	/* Transfer data to the user buffer directly if possible.
+	 * Data to be transformed is always copied via VE buffer. The
+	 * unaligned head of O_DIRECT IO is not split not to make the
+	 * size of the system call unaligned.
+	 */
+	user_reg.vehva = 0;
+	if (xf.func == NULL && (!direct_io || ((uint64_t)buf & 0x3) == 0)) {
+		ve_accelerated_io_register_user_buff(buf, count,
+				acc_io_zero_copy_min, &user_reg);
 	}
 
 	memset(posted, -1, sizeof(posted));
-	read_num = (count + transfer_size - 1)/ transfer_size;
-	for (i = 0; i < read_num; i++) {
+	for (i = 0; read_size < count; i++) {
 		if (i == 1) {
-			for (j = 0; j < BUFF_NPARAS; j++) {
+			for (j = 0; j < io_info.nparas; j++) {
 				io_info.vh_buff_and_flag[j]
 					= io_info.vh_buff_and_flag[j]
 					| VE_SECOND_SYS_CALL_FLAG;
 			}
 		}
-		if (i == read_num - 1) {
-			transfer_size = count - transfer_size * i;
+		transfer_size = MIN(io_info.paras_size, count - read_size);
+		if (i == 0 && user_reg.vehva != 0
+				&& ((uint64_t)buf & 0x3) != 0) {
+			/* Unaligned head is transferred via VE buffer */
+			transfer_size = MIN(4 - ((uint64_t)buf & 0x3),
+					transfer_size);
 		}
+		read_size += transfer_size;
 
-		/* If not last 8MB */
-		j = i % BUFF_NPARAS;
-		if (i >= BUFF_NPARAS) {
+		/* If not last stages */
+		j = i % io_info.nparas;
+		if (i >= io_info.nparas) {
 			/* Wait DMA */
+			ACC_IO_TRACE(syscall_num, fd, DMA_WAIT_BEGIN, j,
+					read_out_size[j]);
+			t_stats = ACC_IO_STATS_NOW();
 			dma_ret = ve_dma_wait(&vedma_handle[j]);
+			ACC_IO_STATS_TIME(syscall_num, fd, dma_wait_ns,
+					t_stats);
+			ACC_IO_TRACE(syscall_num, fd, DMA_WAIT_END, j,
+					read_out_size[j]);
 			if (dma_ret >= 1) {
 				exit_result = FAIL;
 				errno_bak = EIO;
@@ -545,20 +4391,47 @@ static ssize_t ve_accelerated_io_read_pread(int syscall_num, int fd, void *buf,
 				posted[j] = -1;
 				break;
 			}
-			/* Copy data from ve buffer to user buffer */
-			__libsysve_vec_memcpy(buf,
+			err = ve_accelerated_io_transform(&xf,
+					(void *)io_info.ve_buff[j],
+					read_out_size[j],
+					VE_ACC_IO_TRANSFORM_READ);
+			if (err != 0) {
+				exit_result = FAIL;
+				errno_bak = err;
+				data_err = 1;
+				posted[j] = -1;
+				break;
+			}
+			if (!direct[j]) {
+				/* Copy data from ve buffer to user buffer */
+				ACC_IO_TRACE(syscall_num, fd, MEMCPY_BEGIN, j,
+						read_out_size[j]);
+				t_stats = ACC_IO_STATS_NOW();
+				ve_accelerated_io_copy(user_buff[j],
 					(void *)((uint64_t)io_info.ve_buff[j]),
 					read_out_size[j]);
-			buf = (void *)((uint64_t)buf + read_out_size[j]);
+				ACC_IO_STATS_TIME(syscall_num, fd, memcpy_ns,
+						t_stats);
+				ACC_IO_TRACE(syscall_num, fd, MEMCPY_END, j,
+						read_out_size[j]);
+			} else {
+				ve_accelerated_io_csum_direct(user_buff[j],
+						read_out_size[j]);
+			}
 			exit_result += read_out_size[j];
 		}
 
 		/* Execute syscall call and data transfer in 1 set
-		 * and BUFF_NPARAS sets in parallel
+		 * and nparas sets in parallel
 		 */
 		/* Call syscall */
+		ACC_IO_TRACE(syscall_num, fd, SYSCALL_BEGIN, j, transfer_size);
+		t_stats = ACC_IO_STATS_NOW();
 		read_out_size[j] = syscall(syscall_num, fd,
 				io_info.vh_buff_and_flag[j], transfer_size, ofs);
+		ACC_IO_STATS_TIME(syscall_num, fd, syscall_ns, t_stats);
+		ACC_IO_TRACE(syscall_num, fd, SYSCALL_END, j,
+				read_out_size[j]);
 		if (FAIL == read_out_size[j]) {
 			if (0 == i) {
 				errno_bak = errno;
@@ -571,10 +4444,22 @@ static ssize_t ve_accelerated_io_read_pread(int syscall_num, int fd, void *buf,
 			posted[j] = -1;
 			break;
 		}
-		/* Transfer data from VH buffer to VE buffer by VE DMA */
-		ret = ve_dma_post(io_info.ve_vehva[j], io_info.vh_vehva[j],
-				GET_DMA_SIZE(read_out_size[j]),
-				&vedma_handle[j]);
+		user_buff[j] = buf;
+		direct[j] = ACC_IO_CAN_DIRECT(&user_reg, buf, read_out_size[j]);
+		/* Transfer data from VH buffer to VE buffer or user buffer
+		 * by VE DMA
+		 */
+		if (direct[j]) {
+			ret = ve_dma_post(ACC_IO_USER_VEHVA(&user_reg, buf),
+					io_info.vh_vehva[j],
+					read_out_size[j], &vedma_handle[j]);
+		} else {
+			ret = ve_dma_post(io_info.ve_vehva[j],
+					io_info.vh_vehva[j],
+					GET_DMA_SIZE(read_out_size[j]),
+					&vedma_handle[j]);
+		}
+		ACC_IO_TRACE(syscall_num, fd, DMA_POST, j, read_out_size[j]);
 		if (SUCCESS != ret) {
 			exit_result = FAIL;
 			errno_bak = EIO;
@@ -584,6 +4469,7 @@ static ssize_t ve_accelerated_io_read_pread(int syscall_num, int fd, void *buf,
 			break;
 		}
 
+		buf = (void *)((uint64_t)buf + read_out_size[j]);
 		ofs = ofs + read_out_size[j];
 		posted[j] = i;
 		if (transfer_size > read_out_size[j]) {
@@ -591,17 +4477,23 @@ static ssize_t ve_accelerated_io_read_pread(int syscall_num, int fd, void *buf,
 		}
 	}
 
-	/* Last 8MB */
-	min_k =  __ve_find_min_posted(posted);
-	for (k = 0; k < BUFF_NPARAS; k++) {
-		i = posted[(min_k + k) % BUFF_NPARAS];
+	/* Last stages */
+	min_k =  __ve_find_min_posted(posted, io_info.nparas);
+	for (k = 0; k < io_info.nparas; k++) {
+		i = posted[(min_k + k) % io_info.nparas];
 
 		if (i == -1) {
 			continue;
 		}
-		j = i % BUFF_NPARAS;
+		j = i % io_info.nparas;
 		/* Wait DMA */
+		ACC_IO_TRACE(syscall_num, fd, DMA_WAIT_BEGIN, j,
+				read_out_size[j]);
+		t_stats = ACC_IO_STATS_NOW();
 		dma_ret = ve_dma_wait(&vedma_handle[j]);
+		ACC_IO_STATS_TIME(syscall_num, fd, dma_wait_ns, t_stats);
+		ACC_IO_TRACE(syscall_num, fd, DMA_WAIT_END, j,
+				read_out_size[j]);
 		if (dma_ret >= 1) {
 			exit_result = FAIL;
 			errno_bak = EIO;
@@ -613,23 +4505,150 @@ static ssize_t ve_accelerated_io_read_pread(int syscall_num, int fd, void *buf,
 			data_err = 1;
 		}
 		if (!data_err) {
-			/* Copy data from ve buffer to user buffer */
-			__libsysve_vec_memcpy(buf,
+			err = ve_accelerated_io_transform(&xf,
+					(void *)io_info.ve_buff[j],
+					read_out_size[j],
+					VE_ACC_IO_TRANSFORM_READ);
+			if (err != 0) {
+				exit_result = FAIL;
+				errno_bak = err;
+				data_err = 1;
+				continue;
+			}
+			if (!direct[j]) {
+				/* Copy data from ve buffer to user buffer */
+				ACC_IO_TRACE(syscall_num, fd, MEMCPY_BEGIN, j,
+						read_out_size[j]);
+				t_stats = ACC_IO_STATS_NOW();
+				ve_accelerated_io_copy(user_buff[j],
 					(void *)((uint64_t)io_info.ve_buff[j]),
 					read_out_size[j]);
-
-			buf = (void *)((uint64_t)buf + read_out_size[j]);
+				ACC_IO_STATS_TIME(syscall_num, fd, memcpy_ns,
+						t_stats);
+				ACC_IO_TRACE(syscall_num, fd, MEMCPY_END, j,
+						read_out_size[j]);
+			} else {
+				ve_accelerated_io_csum_direct(user_buff[j],
+						read_out_size[j]);
+			}
 			exit_result += read_out_size[j];
 		}
 	}
 
-	ve_accelerated_io_post(io_info.vh_mask);
+	ve_accelerated_io_unregister_user_buff(&user_reg);
+	ve_accelerated_io_tune_end(fd, &io_info, exit_result);
+	ve_accelerated_io_post(&io_info);
 	if (0 != errno_bak) {
 		errno = errno_bak;
 	}
 	return exit_result;
 }
 
+/**
+ * @brief This function reads data via the read-ahead buffer of a file
+ * descriptor.
+ * When pread() is called repeatedly for a regular file at the offset
+ * where the previous pread() ended, the data after the requested data is
+ * read into the read-ahead buffer by pread(), and the following pread()
+ * is served from the buffer without system call. The file offset is
+ * never changed, so lseek() needs no hook.
+ * A request larger than the buffer is read directly.
+ *
+ * @param[in] File descriptor which refer to a file this function reads from
+ * @param[in] Buffer into which this function stores the read data
+ * @param[in] Number of bytes read
+ * @param[in] File offset
+ *
+ * @return Total number of read bytes on Success, -1 on Failure.
+ */
+static ssize_t ve_accelerated_io_read_ahead(int fd, void *buf, size_t count,
+		off_t ofs)
+{
+	acc_io_fd_state *st;
+	ssize_t ret;
+	ssize_t done = 0;
+	ssize_t copy_size;
+	acc_io_csum *cs;
+
+	st = ve_accelerated_io_lock_fd_state(fd, 1);
+	if (st == NULL) {
+		return ve_accelerated_io_read_pread(SYS_pread64, fd, buf,
+				count, ofs);
+	}
+	ve_accelerated_io_flush_locked(fd, st);
+	if (!ve_accelerated_io_is_reg_locked(fd, st) || count == 0
+			|| buf == NULL) {
+		ve_accelerated_io_unlock_fd_state(st);
+		return ve_accelerated_io_read_pread(SYS_pread64, fd, buf,
+				count, ofs);
+	}
+
+	if (ofs != st->ra_off + st->ra_pos) {
+		st->seq = 0;
+	}
+	if (ofs >= st->ra_off && ofs < st->ra_off + st->ra_len) {
+		copy_size = MIN((ssize_t)count,
+				st->ra_off + st->ra_len - ofs);
+		ve_accelerated_io_copy_small(buf,
+				st->ra_buff + (ofs - st->ra_off), copy_size);
+		done = copy_size;
+		st->ra_pos = ofs + done - st->ra_off;
+		if (done == (ssize_t)count) {
+			goto out;
+		}
+	}
+
+	st->seq++;
+	if ((ssize_t)count - done < acc_io_read_ahead
+			&& st->seq >= READ_AHEAD_SEQ_MIN) {
+		if (st->ra_buff == NULL) {
+			st->ra_buff = malloc(acc_io_read_ahead);
+		}
+		if (st->ra_buff != NULL) {
+			/* Data read ahead is checksummed when it is read */
+			cs = acc_io_csum_cur;
+			acc_io_csum_cur = NULL;
+			ret = ve_accelerated_io_read_pread(SYS_pread64, fd,
+					st->ra_buff, acc_io_read_ahead,
+					ofs + done);
+			acc_io_csum_cur = cs;
+			if (ret < 0) {
+				st->ra_off = ofs + done;
+				st->ra_len = 0;
+				st->ra_pos = 0;
+				if (done == 0) {
+					done = ret;
+				}
+				goto out;
+			}
+			st->ra_off = ofs + done;
+			st->ra_len = ret;
+			copy_size = MIN((ssize_t)count - done, ret);
+			ve_accelerated_io_copy_small((char *)buf + done,
+					st->ra_buff, copy_size);
+			st->ra_pos = copy_size;
+			done += copy_size;
+			goto out;
+		}
+	}
+
+	/* Read directly, and remember where the request ended */
+	ret = ve_accelerated_io_read_pread(SYS_pread64, fd, (char *)buf + done,
+			count - done, ofs + done);
+	if (ret > 0) {
+		done += ret;
+	} else if (done == 0) {
+		done = ret;
+	}
+	st->ra_off = ofs + MAX(done, 0);
+	st->ra_len = 0;
+	st->ra_pos = 0;
+
+out:
+	ve_accelerated_io_unlock_fd_state(st);
+	return done;
+}
+
 /**
  * @brief This function starts accelerated read.
  *
@@ -641,7 +4660,15 @@ static ssize_t ve_accelerated_io_read_pread(int syscall_num, int fd, void *buf,
  */
 static ssize_t ve_accelerated_io_read(int fd, void *buf, size_t count)
 {
-	return ve_accelerated_io_read_pread(SYS_read, fd, buf, count, 0);
+	ssize_t ret;
+	acc_io_csum_ctx csum;
+
+	ve_accelerated_io_csum_begin(&csum, fd, 0, 1);
+	ve_accelerated_io_sync_fd(fd, 0);
+	ret = ve_accelerated_io_read_pread(SYS_read, fd, buf, count, 0);
+	ve_accelerated_io_csum_end(&csum, buf, NULL, 0, ret);
+	ACC_IO_STATS_CALL(SYS_read, fd, ret);
+	return ret;
 }
 
 /**
@@ -657,7 +4684,64 @@ static ssize_t ve_accelerated_io_read(int fd, void *buf, size_t count)
 static ssize_t ve_accelerated_io_pread(int fd, void *buf, size_t count,
 		off_t ofs)
 {
-	return ve_accelerated_io_read_pread(SYS_pread64, fd, buf, count, ofs);
+	ssize_t ret;
+	acc_io_csum_ctx csum;
+
+	ve_accelerated_io_csum_begin(&csum, fd, 0, 1);
+	if (acc_io_read_ahead > 0) {
+		ret = ve_accelerated_io_read_ahead(fd, buf, count, ofs);
+	} else {
+		ve_accelerated_io_sync_fd(fd, 0);
+		ret = ve_accelerated_io_read_pread(SYS_pread64, fd, buf,
+				count, ofs);
+	}
+	ve_accelerated_io_csum_end(&csum, buf, NULL, 0, ret);
+	ACC_IO_STATS_CALL(SYS_pread64, fd, ret);
+	return ret;
+}
+
+/**
+ * @brief This function reads data to be transformed by readv or preadv.
+ * Data is read by one read or pread into a temporary buffer, so that it
+ * is transformed in the same chunks as read or pread, and is copied to
+ * the user buffers.
+ *
+ * @param[in] syscall_num SYS_readv or SYS_preadv
+ * @param[in] fd File descriptor
+ * @param[in] iov User buffers
+ * @param[in] count Number of iov
+ * @param[in] total Total size of iov
+ * @param[in] ofs File offset, it is 0 when readv
+ *
+ * @return Total number of read bytes on Success, -1 on Failure.
+ */
+static ssize_t ve_accelerated_io_readv_xform(int syscall_num, int fd,
+		const struct iovec *iov, int count, size_t total, off_t ofs)
+{
+	int i;
+	int errno_bak;
+	char *tmp;
+	ssize_t ret;
+	ssize_t done = 0;
+	size_t size;
+
+	tmp = malloc(total);
+	if (tmp == NULL) {
+		errno = ENOMEM;
+		return FAIL;
+	}
+	ret = ve_accelerated_io_read_pread(
+			(SYS_readv == syscall_num) ? SYS_read : SYS_pread64,
+			fd, tmp, total, ofs);
+	for (i = 0; i < count && done < ret; i++) {
+		size = MIN(iov[i].iov_len, (size_t)(ret - done));
+		memcpy(iov[i].iov_base, tmp + done, size);
+		done += size;
+	}
+	errno_bak = errno;
+	free(tmp);
+	errno = errno_bak;
+	return ret;
 }
 
 /**
@@ -674,28 +4758,28 @@ static ssize_t ve_accelerated_io_pread(int fd, void *buf, size_t count,
 static ssize_t ve_accelerated_io_readv_preadv(int syscall_num, int fd,
 		const struct iovec *iov, int count, off_t ofs)
 {
-	int i,j,k,n;
+	int i,j,k;
 	int ret = 0;
 	int dma_ret = 0;
 	int errno_bak = 0;
-	uint64_t posted[BUFF_NPARAS];
+	uint64_t posted[BUFF_NPARAS_MAX];
 	uint64_t read_num = 0;
 	int min_k = 0;
 	int data_err = 0;
 	acc_io_info io_info;
 	ssize_t total_size = 0;
-	ssize_t transfer_size = PARAS_SIZE;
-	ssize_t read_out_size[BUFF_NPARAS];
+	ssize_t transfer_size;
+	ssize_t read_out_size[BUFF_NPARAS_MAX];
 	ssize_t exit_result = 0;
 	int read_syscall_type = SYS_read;
+	uint64_t t_stats;
+	acc_io_xform xf;
 
-	int next_iov_num = 0;
-	ssize_t iov_len_done = 0;
-	ssize_t iov_len_less = 0;
-	ssize_t ve_buff_size_less = 0;
-	ssize_t iov_copy_size = 0;
-	uint64_t source_buff;
-	ve_dma_handle_t vedma_handle[BUFF_NPARAS];
+	acc_io_iov_regs regs;
+	acc_io_iov_pos post_pos = {0, 0};
+	acc_io_iov_pos copy_pos = {0, 0};
+	ve_dma_handle_t vedma_handle[BUFF_NPARAS_MAX][ACC_IO_SG_HANDLE_MAX];
+	int nhandle[BUFF_NPARAS_MAX];
 
 	if (0 == count) {
 		SYSCALL_CANCEL(exit_result, syscall_num, fd, iov, count, ofs);
@@ -706,32 +4790,46 @@ static ssize_t ve_accelerated_io_readv_preadv(int syscall_num, int fd,
 		errno = EFAULT;
 		return exit_result;
 	}
+	/* get total size */
+	for (i = 0; i < count; i++) {
+		total_size = total_size + iov[i].iov_len; 
+	}
+	if (acc_io_xform_fds != 0 && total_size > 0
+			&& ve_accelerated_io_get_xform(fd, &xf)) {
+		return ve_accelerated_io_readv_xform(syscall_num, fd, iov,
+				count, total_size, ofs);
+	}
+	if (ve_accelerated_io_is_small_io(total_size)) {
+		ACC_IO_STATS_ADD(syscall_num, fd, small_io, 1);
+		SYSCALL_CANCEL(exit_result, syscall_num, fd, iov, count, ofs);
+		return exit_result;
+	}
 	/* Pre processing of IO request */
 	ret = ve_accelerated_io_pre(&io_info);
 
 	if (FAIL == ret) {
 		ve_accelerated_io_free_io_hook();
+		ACC_IO_STATS_ADD(syscall_num, fd, disabled, 1);
 		SYSCALL_CANCEL(exit_result, syscall_num, fd, iov, count, ofs);
 		return exit_result;
 	} else if (NOBUF == ret) {
+		ACC_IO_STATS_ADD(syscall_num, fd, nobuf, 1);
 		SYSCALL_CANCEL(exit_result, syscall_num, fd, iov, count, ofs);
 		return exit_result;
 	}
+	ve_accelerated_io_tune_begin(fd, &io_info);
 
 	if (SYS_preadv == syscall_num) {
 		read_syscall_type = SYS_pread64;
 	}
+	ve_accelerated_io_register_iov(iov, count, &regs);
 
-	/* get total size */
-	for (i = 0; i < count; i++) {
-		total_size = total_size + iov[i].iov_len; 
-	}
-
+	transfer_size = io_info.paras_size;
 	memset(posted, -1, sizeof(posted));
 	read_num = (total_size + transfer_size - 1)/ transfer_size;
 	for (i = 0; i < read_num; i++) {
 		if (i == 1) {
-			for (j = 0; j < BUFF_NPARAS; j++) {
+			for (j = 0; j < io_info.nparas; j++) {
 				io_info.vh_buff_and_flag[j]
 					= io_info.vh_buff_and_flag[j]
 					| VE_SECOND_SYS_CALL_FLAG;
@@ -741,11 +4839,19 @@ static ssize_t ve_accelerated_io_readv_preadv(int syscall_num, int fd,
 			transfer_size = total_size - transfer_size * i;
 		}
 
-		j = i % BUFF_NPARAS;
-		/* If not last 8MB */
-		if (i >= BUFF_NPARAS) {
+		j = i % io_info.nparas;
+		/* If not last stages */
+		if (i >= io_info.nparas) {
 			/* Wait DMA */
-			dma_ret = ve_dma_wait(&vedma_handle[j]);
+			ACC_IO_TRACE(syscall_num, fd, DMA_WAIT_BEGIN, j,
+					read_out_size[j]);
+			t_stats = ACC_IO_STATS_NOW();
+			dma_ret = ve_accelerated_io_sg_wait(vedma_handle[j],
+					nhandle[j]);
+			ACC_IO_STATS_TIME(syscall_num, fd, dma_wait_ns,
+					t_stats);
+			ACC_IO_TRACE(syscall_num, fd, DMA_WAIT_END, j,
+					read_out_size[j]);
 			if (dma_ret >= 1) {
 				exit_result = FAIL;
 				errno_bak = EIO;
@@ -759,42 +4865,29 @@ static ssize_t ve_accelerated_io_readv_preadv(int syscall_num, int fd,
 				break;
 			}
 
-			ve_buff_size_less = read_out_size[j];
-			source_buff = io_info.ve_buff[j];
-			for (n = next_iov_num; n < count; n++) {
-				iov_len_less = iov[n].iov_len - iov_len_done;
-				iov_copy_size = MIN (iov_len_less, ve_buff_size_less);
-				__libsysve_vec_memcpy(
-						(void *)((uint64_t)iov[n].iov_base
-							+ iov_len_done),
-						(void *)source_buff, iov_copy_size);
-				if (0 >= (ve_buff_size_less - iov_copy_size)) {
-					/* We have copied All data from the VE buffer to
-					 * the user buffers.
-					 */
-					if (iov_len_less > ve_buff_size_less) {
-						iov_len_done = iov_len_done
-										+ ve_buff_size_less;
-						next_iov_num = n;
-					} else {
-						iov_len_done = 0;
-						next_iov_num = n + 1;
-					}
-					break;
-				}
-				iov_len_done = 0;
-				ve_buff_size_less = ve_buff_size_less - iov_copy_size;
-				source_buff = source_buff + iov_copy_size;
-			}
+			ACC_IO_TRACE(syscall_num, fd, MEMCPY_BEGIN, j,
+					read_out_size[j]);
+			t_stats = ACC_IO_STATS_NOW();
+			ve_accelerated_io_sg_stage(ACC_IO_SG_READ_COPY, iov,
+					count, &regs, &copy_pos, read_out_size[j],
+					&io_info, j, NULL, NULL);
+			ACC_IO_STATS_TIME(syscall_num, fd, memcpy_ns, t_stats);
+			ACC_IO_TRACE(syscall_num, fd, MEMCPY_END, j,
+					read_out_size[j]);
 			exit_result += read_out_size[j];
 		}
 
 		/* Execute syscall call and data transfer in 1 set
-		 * and BUFF_NPARAS sets in parallel
+		 * and nparas sets in parallel
 		 */
 		/* Call syscall */
+		ACC_IO_TRACE(syscall_num, fd, SYSCALL_BEGIN, j, transfer_size);
+		t_stats = ACC_IO_STATS_NOW();
 		read_out_size[j] = syscall(read_syscall_type, fd,
 				io_info.vh_buff_and_flag[j], transfer_size, ofs);
+		ACC_IO_STATS_TIME(syscall_num, fd, syscall_ns, t_stats);
+		ACC_IO_TRACE(syscall_num, fd, SYSCALL_END, j,
+				read_out_size[j]);
 		if (FAIL == read_out_size[j]) {
 			if (0 == i) {
 				errno_bak = errno;
@@ -807,10 +4900,13 @@ static ssize_t ve_accelerated_io_readv_preadv(int syscall_num, int fd,
 			posted[j] = -1;
 			break;
 		}
-		/* Transfer data from VH buffer to VE buffer by VE DMA */
-		ret = ve_dma_post(io_info.ve_vehva[j], io_info.vh_vehva[j],
-				GET_DMA_SIZE(read_out_size[j]),
-				&vedma_handle[j]);
+		/* Transfer data from VH buffer to VE buffer or user buffers
+		 * by VE DMA
+		 */
+		ret = ve_accelerated_io_sg_stage(ACC_IO_SG_READ_POST, iov,
+				count, &regs, &post_pos, read_out_size[j],
+				&io_info, j, vedma_handle[j], &nhandle[j]);
+		ACC_IO_TRACE(syscall_num, fd, DMA_POST, j, read_out_size[j]);
 
 		if (SUCCESS != ret) {
 			exit_result = FAIL;
@@ -828,17 +4924,24 @@ static ssize_t ve_accelerated_io_readv_preadv(int syscall_num, int fd,
 		}
 	}
 
-	/* Last 8MB */
-	min_k =  __ve_find_min_posted(posted);
-	for (k = 0; k < BUFF_NPARAS; k++) {
-		i = posted[(min_k + k) % BUFF_NPARAS];
+	/* Last stages */
+	min_k =  __ve_find_min_posted(posted, io_info.nparas);
+	for (k = 0; k < io_info.nparas; k++) {
+		i = posted[(min_k + k) % io_info.nparas];
 		if (i == -1) {
 			continue;
 		}
-		j = i % BUFF_NPARAS;
+		j = i % io_info.nparas;
 
 		/* Wait DMA */
-		dma_ret = ve_dma_wait(&vedma_handle[j]);
+		ACC_IO_TRACE(syscall_num, fd, DMA_WAIT_BEGIN, j,
+				read_out_size[j]);
+		t_stats = ACC_IO_STATS_NOW();
+		dma_ret = ve_accelerated_io_sg_wait(vedma_handle[j],
+				nhandle[j]);
+		ACC_IO_STATS_TIME(syscall_num, fd, dma_wait_ns, t_stats);
+		ACC_IO_TRACE(syscall_num, fd, DMA_WAIT_END, j,
+				read_out_size[j]);
 		if (dma_ret >= 1) {
 			exit_result = FAIL;
 			errno_bak = EIO;
@@ -851,41 +4954,22 @@ static ssize_t ve_accelerated_io_readv_preadv(int syscall_num, int fd,
 		}
 
 		if (!data_err) {
-			ve_buff_size_less = read_out_size[j];
-			source_buff = io_info.ve_buff[j];
-			for (n = next_iov_num; n < count; n++) {
-				iov_len_less = iov[n].iov_len - iov_len_done;
-				iov_copy_size = MIN (iov_len_less,
-						ve_buff_size_less);
-				__libsysve_vec_memcpy(
-						(void *)((uint64_t)iov[n].iov_base
-							+ iov_len_done),
-						(void *)source_buff,
-						iov_copy_size);
-				if (0 >= (ve_buff_size_less - iov_copy_size)) {
-					/* We have copied All data from the VE buffer to
-					 * the user buffers.
-					 */
-					if (iov_len_less > ve_buff_size_less) {
-						iov_len_done = iov_len_done
-							+ ve_buff_size_less;
-						next_iov_num = n;
-					} else {
-						iov_len_done = 0;
-						next_iov_num = n + 1;
-					}
-					break;
-				}
-				iov_len_done = 0;
-				ve_buff_size_less = ve_buff_size_less
-					- iov_copy_size;
-				source_buff = source_buff + iov_copy_size;
-			}
+			ACC_IO_TRACE(syscall_num, fd, MEMCPY_BEGIN, j,
+					read_out_size[j]);
+			t_stats = ACC_IO_STATS_NOW();
+			ve_accelerated_io_sg_stage(ACC_IO_SG_READ_COPY, iov,
+					count, &regs, &copy_pos, read_out_size[j],
+					&io_info, j, NULL, NULL);
+			ACC_IO_STATS_TIME(syscall_num, fd, memcpy_ns, t_stats);
+			ACC_IO_TRACE(syscall_num, fd, MEMCPY_END, j,
+					read_out_size[j]);
 			exit_result += read_out_size[j];
 		}
 	}
 
-	ve_accelerated_io_post(io_info.vh_mask);
+	ve_accelerated_io_unregister_iov(&regs);
+	ve_accelerated_io_tune_end(fd, &io_info, exit_result);
+	ve_accelerated_io_post(&io_info);
 	if (0 != errno_bak) {
 		errno = errno_bak;
 	}
@@ -904,7 +4988,15 @@ static ssize_t ve_accelerated_io_readv_preadv(int syscall_num, int fd,
 static ssize_t ve_accelerated_io_readv(int fd, const struct iovec *iov,
 		int count)
 {
-	return ve_accelerated_io_readv_preadv(SYS_readv, fd, iov, count, 0);
+	ssize_t ret;
+	acc_io_csum_ctx csum;
+
+	ve_accelerated_io_csum_begin(&csum, fd, 0, 0);
+	ve_accelerated_io_sync_fd(fd, 0);
+	ret = ve_accelerated_io_readv_preadv(SYS_readv, fd, iov, count, 0);
+	ve_accelerated_io_csum_end(&csum, NULL, iov, count, ret);
+	ACC_IO_STATS_CALL(SYS_readv, fd, ret);
+	return ret;
 }
 
 /**
@@ -920,7 +5012,15 @@ static ssize_t ve_accelerated_io_readv(int fd, const struct iovec *iov,
 static ssize_t ve_accelerated_io_preadv(int fd, const struct iovec *iov,
 		int count, off_t ofs)
 {
-	return ve_accelerated_io_readv_preadv(SYS_preadv, fd, iov, count, ofs);
+	ssize_t ret;
+	acc_io_csum_ctx csum;
+
+	ve_accelerated_io_csum_begin(&csum, fd, 0, 0);
+	ve_accelerated_io_sync_fd(fd, 0);
+	ret = ve_accelerated_io_readv_preadv(SYS_preadv, fd, iov, count, ofs);
+	ve_accelerated_io_csum_end(&csum, NULL, iov, count, ret);
+	ACC_IO_STATS_CALL(SYS_preadv, fd, ret);
+	return ret;
 }
 
 /**
@@ -942,16 +5042,21 @@ static ssize_t ve_accelerated_io_write_pwrite(int syscall_num, int fd,
 	int ret = 0;
 	int dma_ret = 0;
 	int errno_bak = 0;
-	uint64_t posted[BUFF_NPARAS];
-	uint64_t write_num = 0;
+	uint64_t posted[BUFF_NPARAS_MAX];
+	size_t write_size = 0;
 	int min_k = 0;
 	int data_err = 0;
 	acc_io_info io_info;
-	ssize_t transfer_size = PARAS_SIZE;
-	ssize_t need_write_in_size[BUFF_NPARAS] = {0};
+	acc_io_user_reg user_reg;
+	ssize_t transfer_size;
+	ssize_t need_write_in_size[BUFF_NPARAS_MAX] = {0};
 	ssize_t write_in_size;
 	ssize_t exit_result = 0;
-	ve_dma_handle_t vedma_handle[BUFF_NPARAS];
+	ve_dma_handle_t vedma_handle[BUFF_NPARAS_MAX];
+	uint64_t t_stats;
+	acc_io_xform xf;
+	int err;
+	int direct_io;
 
 	if (0 == count) {
 		SYSCALL_CANCEL(exit_result, syscall_num, fd, buf, count, ofs);
@@ -962,35 +5067,88 @@ static ssize_t ve_accelerated_io_write_pwrite(int syscall_num, int fd,
 		errno = EFAULT;
 		return exit_result;
 	}
+	/* IO of O_DIRECT fd is always transferred via aligned VH buffer */
+	direct_io = acc_io_direct_part || ve_accelerated_io_is_direct(fd,
+			!ve_accelerated_io_is_small_io(count));
+	if (direct_io && !acc_io_direct_part && (SYS_write == syscall_num
+			|| !ACC_IO_DIRECT_ALIGNED(ofs)
+			|| !ACC_IO_DIRECT_ALIGNED(count))) {
+		return ve_accelerated_io_write_direct(syscall_num, fd, buf,
+				count, ofs);
+	}
+	ve_accelerated_io_get_xform(fd, &xf);
+	if (!direct_io && ve_accelerated_io_is_small_io(count)) {
+		ACC_IO_STATS_ADD(syscall_num, fd, small_io, 1);
+		exit_result = ve_accelerated_io_write_normal(syscall_num, fd,
+				buf, count, ofs, &xf);
+		/* fd may have been reopened with O_DIRECT since cached */
+		if (exit_result < 0 && EINVAL == errno
+				&& ve_accelerated_io_is_direct(fd, 1)) {
+			exit_result = ve_accelerated_io_write_direct(
+					syscall_num, fd, buf, count, ofs);
+		}
+		return exit_result;
+	}
 	/* Pre processing of IO request */
 	ret = ve_accelerated_io_pre(&io_info);
 	if (FAIL == ret) {
 		ve_accelerated_io_free_io_hook();
-		SYSCALL_CANCEL(exit_result, syscall_num, fd, buf, count, ofs);
-		return exit_result;
+		ACC_IO_STATS_ADD(syscall_num, fd, disabled, 1);
+		return ve_accelerated_io_write_normal(syscall_num, fd, buf,
+				count, ofs, &xf);
 	} else if (NOBUF == ret) {
-		SYSCALL_CANCEL(exit_result, syscall_num, fd, buf, count, ofs);
-		return exit_result;
+		ACC_IO_STATS_ADD(syscall_num, fd, nobuf, 1);
+		return ve_accelerated_io_write_normal(syscall_num, fd, buf,
+				count, ofs, &xf);
+	}
+	if (direct_io && !ACC_IO_DIRECT_ALIGNED(io_info.vh_buff_and_flag[0])) {
+		ve_accelerated_io_post(&io_info);
+		return ve_accelerated_io_write_normal(syscall_num, fd, buf,
+				count, ofs, &xf);
+	}
+	ve_accelerated_io_tune_begin(fd, &io_info);
+
+	/* Transfer data from the user buffer directly if possible.
+	 * Data to be transformed is always copied via VE buffer not to
+	 * change the user buffer. The unaligned head of O_DIRECT IO is
+	 * not split not to make the size of the system call unaligned.
+	 */
+	user_reg.vehva = 0;
+	if (xf.func == NULL && (!direct_io || ((uint64_t)buf & 0x3) == 0)) {
+		ve_accelerated_io_register_user_buff((void *)buf, count,
+				acc_io_zero_copy_min, &user_reg);
 	}
 
 	memset(posted, -1, sizeof(posted));
-	write_num = (count + transfer_size - 1)/ transfer_size;
-	for (i = 0; i < write_num; i++) {
+	for (i = 0; write_size < count; i++) {
 		if (i == 1) {
-			for (j = 0; j < BUFF_NPARAS; j++) {
+			for (j = 0; j < io_info.nparas; j++) {
 				io_info.vh_buff_and_flag[j]
 					= io_info.vh_buff_and_flag[j]
 					| VE_SECOND_SYS_CALL_FLAG;
 			}
 		}
-		if (i == write_num - 1) {
-			transfer_size = count - transfer_size * i;
+		transfer_size = MIN(io_info.paras_size, count - write_size);
+		if (i == 0 && user_reg.vehva != 0
+				&& ((uint64_t)buf & 0x3) != 0) {
+			/* Unaligned head is transferred via VE buffer */
+			transfer_size = MIN(4 - ((uint64_t)buf & 0x3),
+					transfer_size);
 		}
-		j = i % BUFF_NPARAS;
-		/* If not last 8MB */
-		if (i >= BUFF_NPARAS) {
+		write_size += transfer_size;
+
+		j = i % io_info.nparas;
+		/* If not last stages */
+		if (i >= io_info.nparas) {
 			/* Wait DMA */
+			ACC_IO_TRACE(syscall_num, fd, DMA_WAIT_BEGIN, j,
+					need_write_in_size[j]);
+			t_stats = ACC_IO_STATS_NOW();
 			dma_ret = ve_dma_wait(&vedma_handle[j]);
+			ACC_IO_STATS_TIME(syscall_num, fd, dma_wait_ns,
+					t_stats);
+			ACC_IO_TRACE(syscall_num, fd, DMA_WAIT_END, j,
+					need_write_in_size[j]);
 			if (dma_ret >= 1) {
 				exit_result = FAIL;
 				errno_bak = EIO;
@@ -1005,9 +5163,16 @@ static ssize_t ve_accelerated_io_write_pwrite(int syscall_num, int fd,
 			}
 
 			/* Call syscall */
+			ACC_IO_TRACE(syscall_num, fd, SYSCALL_BEGIN, j,
+					need_write_in_size[j]);
+			t_stats = ACC_IO_STATS_NOW();
 			write_in_size = syscall(syscall_num, fd,
 					io_info.vh_buff_and_flag[j],
-					PARAS_SIZE, ofs);
+					need_write_in_size[j], ofs);
+			ACC_IO_STATS_TIME(syscall_num, fd, syscall_ns,
+					t_stats);
+			ACC_IO_TRACE(syscall_num, fd, SYSCALL_END, j,
+					write_in_size);
 			if (FAIL == write_in_size) {
 				if (0 == posted[j]) {
 					errno_bak = errno;
@@ -1029,22 +5194,53 @@ static ssize_t ve_accelerated_io_write_pwrite(int syscall_num, int fd,
 			}
 			exit_result += write_in_size;
 			ofs += write_in_size;
-			if (PARAS_SIZE > write_in_size) {
+			if (need_write_in_size[j] > write_in_size) {
 				data_err = 1;
 				posted[j] = -1;
 				break;
 			}
 		}
 		/* Execute memory copy and data transfer in 1 set
-		 * and BUFF_NPARAS sets in parallel
+		 * and nparas sets in parallel
 		 */
-		/* Copy data from user buffer to VE buffer */
-		__libsysve_vec_memcpy((void *)io_info.ve_buff[j],
-				(void *)buf, transfer_size);
-		/* Transfer data from VE buffer to VH buffer by VE DMA */
-		ret = ve_dma_post(io_info.vh_vehva[j], io_info.ve_vehva[j],
-				GET_DMA_SIZE(transfer_size),
-				&vedma_handle[j]);
+		if (ACC_IO_CAN_DIRECT(&user_reg, buf, transfer_size)) {
+			ve_accelerated_io_csum_direct(buf, transfer_size);
+			/* Transfer data from user buffer to VH buffer
+			 * by VE DMA
+			 */
+			ret = ve_dma_post(io_info.vh_vehva[j],
+					ACC_IO_USER_VEHVA(&user_reg, buf),
+					transfer_size, &vedma_handle[j]);
+		} else {
+			/* Copy data from user buffer to VE buffer */
+			ACC_IO_TRACE(syscall_num, fd, MEMCPY_BEGIN, j,
+					transfer_size);
+			t_stats = ACC_IO_STATS_NOW();
+			ve_accelerated_io_copy((void *)io_info.ve_buff[j],
+					buf, transfer_size);
+			ACC_IO_STATS_TIME(syscall_num, fd, memcpy_ns, t_stats);
+			ACC_IO_TRACE(syscall_num, fd, MEMCPY_END, j,
+					transfer_size);
+			err = ve_accelerated_io_transform(&xf,
+					(void *)io_info.ve_buff[j],
+					transfer_size,
+					VE_ACC_IO_TRANSFORM_WRITE);
+			if (err != 0) {
+				exit_result = FAIL;
+				errno_bak = err;
+				posted[j] = -1;
+				data_err = 1;
+				break;
+			}
+			/* Transfer data from VE buffer to VH buffer
+			 * by VE DMA
+			 */
+			ret = ve_dma_post(io_info.vh_vehva[j],
+					io_info.ve_vehva[j],
+					GET_DMA_SIZE(transfer_size),
+					&vedma_handle[j]);
+		}
+		ACC_IO_TRACE(syscall_num, fd, DMA_POST, j, transfer_size);
 		if (SUCCESS != ret) {
 			exit_result = FAIL;
 			errno_bak = EIO;
@@ -1058,16 +5254,22 @@ static ssize_t ve_accelerated_io_write_pwrite(int syscall_num, int fd,
 		need_write_in_size[j] = transfer_size;
 	}
 
-	/* Last 8MB */
-	min_k =  __ve_find_min_posted(posted);
-	for (k = 0; k < BUFF_NPARAS; k++) {
-		i = posted[(min_k + k) % BUFF_NPARAS];
+	/* Last stages */
+	min_k =  __ve_find_min_posted(posted, io_info.nparas);
+	for (k = 0; k < io_info.nparas; k++) {
+		i = posted[(min_k + k) % io_info.nparas];
 		if (i == -1) {
 			continue;
 		}
-		j = i % BUFF_NPARAS;
+		j = i % io_info.nparas;
 		/* Wait DMA */
+		ACC_IO_TRACE(syscall_num, fd, DMA_WAIT_BEGIN, j,
+				need_write_in_size[j]);
+		t_stats = ACC_IO_STATS_NOW();
 		dma_ret = ve_dma_wait(&vedma_handle[j]);
+		ACC_IO_STATS_TIME(syscall_num, fd, dma_wait_ns, t_stats);
+		ACC_IO_TRACE(syscall_num, fd, DMA_WAIT_END, j,
+				need_write_in_size[j]);
 		if (dma_ret >= 1) {
 			exit_result = FAIL;
 			errno_bak = EIO;
@@ -1080,9 +5282,16 @@ static ssize_t ve_accelerated_io_write_pwrite(int syscall_num, int fd,
 		}
 		if (!data_err) {
 			/* Call syscall */
+			ACC_IO_TRACE(syscall_num, fd, SYSCALL_BEGIN, j,
+					need_write_in_size[j]);
+			t_stats = ACC_IO_STATS_NOW();
 			write_in_size = syscall(syscall_num, fd,
 					io_info.vh_buff_and_flag[j],
 					need_write_in_size[j], ofs);
+			ACC_IO_STATS_TIME(syscall_num, fd, syscall_ns,
+					t_stats);
+			ACC_IO_TRACE(syscall_num, fd, SYSCALL_END, j,
+					write_in_size);
 			if (FAIL == write_in_size) {
 				if (0 == i) {
 					errno_bak = errno;
@@ -1104,13 +5313,98 @@ static ssize_t ve_accelerated_io_write_pwrite(int syscall_num, int fd,
 		}
 	}
 
-	ve_accelerated_io_post(io_info.vh_mask);
+	ve_accelerated_io_unregister_user_buff(&user_reg);
+	ve_accelerated_io_tune_end(fd, &io_info, exit_result);
+	ve_accelerated_io_post(&io_info);
 	if (0 != errno_bak) {
 		errno = errno_bak;
 	}
 	return exit_result;
 }
 
+/**
+ * @brief This function writes data via the write-behind buffer of a file
+ * descriptor.
+ * Data written to a regular file by write() is stored in the write-behind
+ * buffer, and written by one system call when the buffer becomes full,
+ * when the file is accessed in other ways, or when
+ * VE_ACC_IO_WRITE_BEHIND_TIMEOUT milliseconds pass.
+ * A request larger than the buffer is written directly.
+ * An error of writing the buffer is reported by the next write family
+ * system call or ve_acc_io_flush() for the file descriptor.
+ *
+ * @param[in] File descriptor which refer to a file this function writes to
+ * @param[in] Buffer from which this function gets the data to write
+ * @param[in] Number of bytes written
+ *
+ * @return Total number of write bytes on Success, -1 on Failure.
+ */
+static ssize_t ve_accelerated_io_write_behind(int fd, const void *buf,
+		size_t count)
+{
+	acc_io_fd_state *st;
+	ssize_t ret;
+	int direct;
+	int err;
+	int pin = -1;
+	struct stat stbuf;
+
+	st = ve_accelerated_io_lock_fd_state(fd, 1);
+	if (st == NULL) {
+		return ve_accelerated_io_write_pwrite(SYS_write, fd, buf,
+				count, 0);
+	}
+	ve_accelerated_io_invalidate_locked(st);
+	direct = (!ve_accelerated_io_is_reg_locked(fd, st) || count == 0
+			|| buf == NULL || (ssize_t)count >= acc_io_write_behind);
+	if (!direct && st->wb_buff == NULL) {
+		st->wb_buff = malloc(acc_io_write_behind);
+		direct = (st->wb_buff == NULL);
+	}
+	if (st->wb_len > 0 && (direct
+			|| st->wb_len + (ssize_t)count > acc_io_write_behind)) {
+		ve_accelerated_io_flush_locked(fd, st);
+		/* fd may refer to another file now */
+		direct = direct || !ve_accelerated_io_is_reg_locked(fd, st);
+	}
+	err = __sync_lock_test_and_set(&st->err, 0);
+	if (err != 0) {
+		errno = err;
+		ret = FAIL;
+		goto out;
+	}
+	if (!direct && st->wb_len == 0) {
+		pin = ve_accelerated_io_pin_fd(fd, &stbuf);
+		/* fd may have been reused for a file which is not regular */
+		if (pin >= 0 && !S_ISREG(stbuf.st_mode)) {
+			ve_accelerated_io_unpin_fd(pin);
+			st->is_reg = 0;
+			pin = -1;
+		}
+		direct = (pin < 0);
+	}
+	if (direct) {
+		ret = ve_accelerated_io_write_locked(SYS_write, fd, st, buf,
+				count, 0);
+		goto out;
+	}
+
+	if (st->wb_len == 0) {
+		st->wb_time = ve_accelerated_io_now_nsec() / 1000000;
+		st->wb_pin = pin + 1;
+		st->wb_dev = stbuf.st_dev;
+		st->wb_ino = stbuf.st_ino;
+	}
+	ve_accelerated_io_copy_small(st->wb_buff + st->wb_len, buf, count);
+	st->wb_len += count;
+	ret = count;
+	ve_accelerated_io_start_flusher();
+
+out:
+	ve_accelerated_io_unlock_fd_state(st);
+	return ret;
+}
+
 /**
  * @brief This function starts accelerated write.
  *
@@ -1122,7 +5416,29 @@ static ssize_t ve_accelerated_io_write_pwrite(int syscall_num, int fd,
  */
 static ssize_t ve_accelerated_io_write(int fd, const void *buf, size_t count)
 {
-	return ve_accelerated_io_write_pwrite(SYS_write, fd, buf, count, 0);
+	int err;
+	ssize_t ret;
+	acc_io_csum_ctx csum;
+
+	ve_accelerated_io_csum_begin(&csum, fd, 1, 1);
+	if (acc_io_write_behind > 0) {
+		ret = ve_accelerated_io_write_behind(fd, buf, count);
+	} else if (acc_io_async_write > 0) {
+		ret = ve_accelerated_io_write_async(SYS_write, fd, buf, count,
+				0);
+	} else {
+		err = ve_accelerated_io_sync_fd(fd, 1);
+		if (err != 0) {
+			errno = err;
+			ret = FAIL;
+		} else {
+			ret = ve_accelerated_io_write_pwrite(SYS_write, fd,
+					buf, count, 0);
+		}
+	}
+	ve_accelerated_io_csum_end(&csum, buf, NULL, 0, ret);
+	ACC_IO_STATS_CALL(SYS_write, fd, ret);
+	return ret;
 }
 
 /**
@@ -1138,7 +5454,69 @@ static ssize_t ve_accelerated_io_write(int fd, const void *buf, size_t count)
 static ssize_t ve_accelerated_io_pwrite(int fd, const void *buf, size_t count,
 		off_t ofs)
 {
-	return ve_accelerated_io_write_pwrite(SYS_pwrite64, fd, buf, count, ofs);
+	int err;
+	ssize_t ret;
+	acc_io_csum_ctx csum;
+
+	ve_accelerated_io_csum_begin(&csum, fd, 1, 1);
+	if (acc_io_async_write > 0) {
+		ret = ve_accelerated_io_write_async(SYS_pwrite64, fd, buf,
+				count, ofs);
+	} else {
+		err = ve_accelerated_io_sync_fd(fd, 1);
+		if (err != 0) {
+			errno = err;
+			ret = FAIL;
+		} else {
+			ret = ve_accelerated_io_write_pwrite(SYS_pwrite64, fd,
+					buf, count, ofs);
+		}
+	}
+	ve_accelerated_io_csum_end(&csum, buf, NULL, 0, ret);
+	ACC_IO_STATS_CALL(SYS_pwrite64, fd, ret);
+	return ret;
+}
+
+/**
+ * @brief This function writes data to be transformed by writev or
+ * pwritev. Data is gathered into a temporary buffer, and is written by
+ * one write or pwrite, so that it is transformed in the same chunks as
+ * write or pwrite.
+ *
+ * @param[in] syscall_num SYS_writev or SYS_pwritev
+ * @param[in] fd File descriptor
+ * @param[in] iov User buffers
+ * @param[in] count Number of iov
+ * @param[in] total Total size of iov
+ * @param[in] ofs File offset, it is 0 when writev
+ *
+ * @return Total number of write bytes on Success, -1 on Failure.
+ */
+static ssize_t ve_accelerated_io_writev_xform(int syscall_num, int fd,
+		const struct iovec *iov, int count, size_t total, off_t ofs)
+{
+	int i;
+	int errno_bak;
+	char *tmp;
+	ssize_t ret;
+	size_t done = 0;
+
+	tmp = malloc(total);
+	if (tmp == NULL) {
+		errno = ENOMEM;
+		return FAIL;
+	}
+	for (i = 0; i < count; i++) {
+		memcpy(tmp + done, iov[i].iov_base, iov[i].iov_len);
+		done += iov[i].iov_len;
+	}
+	ret = ve_accelerated_io_write_pwrite(
+			(SYS_writev == syscall_num) ? SYS_write : SYS_pwrite64,
+			fd, tmp, total, ofs);
+	errno_bak = errno;
+	free(tmp);
+	errno = errno_bak;
+	return ret;
 }
 
 /**
@@ -1155,29 +5533,29 @@ static ssize_t ve_accelerated_io_pwrite(int fd, const void *buf, size_t count,
 static ssize_t ve_accelerated_io_writev_pwritev(int syscall_num, int fd,
 		const struct iovec *iov, int count, off_t ofs)
 {
-	int i,j,k,n;
+	int i,j,k;
 	int ret = 0;
 	int dma_ret = 0;
 	int errno_bak = 0;
-	uint64_t posted[BUFF_NPARAS];
+	uint64_t posted[BUFF_NPARAS_MAX];
 	uint64_t write_num = 0;
 	int min_k = 0;
 	int data_err = 0;
 	acc_io_info io_info;
 	ssize_t total_size = 0;
-	ssize_t transfer_size = PARAS_SIZE;
-	ssize_t need_write_in_size[BUFF_NPARAS] = {0};
+	ssize_t transfer_size;
+	ssize_t need_write_in_size[BUFF_NPARAS_MAX] = {0};
 	ssize_t write_in_size;
 	ssize_t exit_result = 0;
 	int write_syscall_type = SYS_write;
+	uint64_t t_stats;
+	acc_io_xform xf;
 
-	int next_iov_num = 0;
-	ssize_t iov_len_done = 0;
-	ssize_t iov_len_less = 0;
-	ssize_t ve_buff_size_less = 0;
-	ssize_t iov_copy_size = 0;
-	uint64_t target_buff;
-	ve_dma_handle_t vedma_handle[BUFF_NPARAS];
+	acc_io_iov_regs regs;
+	acc_io_iov_pos pos = {0, 0};
+	acc_io_iov_pos copy_pos;
+	ve_dma_handle_t vedma_handle[BUFF_NPARAS_MAX][ACC_IO_SG_HANDLE_MAX];
+	int nhandle[BUFF_NPARAS_MAX];
 
 	if (0 == count) {
 		SYSCALL_CANCEL(exit_result, syscall_num, fd, iov, count, ofs);
@@ -1188,32 +5566,46 @@ static ssize_t ve_accelerated_io_writev_pwritev(int syscall_num, int fd,
 		errno = EFAULT;
 		return exit_result;
 	}
+	/* get total size */
+	for (i = 0; i < count; i++) {
+		total_size = total_size + iov[i].iov_len; 
+	}
+	if (acc_io_xform_fds != 0 && total_size > 0
+			&& ve_accelerated_io_get_xform(fd, &xf)) {
+		return ve_accelerated_io_writev_xform(syscall_num, fd, iov,
+				count, total_size, ofs);
+	}
+	if (ve_accelerated_io_is_small_io(total_size)) {
+		ACC_IO_STATS_ADD(syscall_num, fd, small_io, 1);
+		SYSCALL_CANCEL(exit_result, syscall_num, fd, iov, count, ofs);
+		return exit_result;
+	}
 	/* Pre processing of IO request */
 	ret = ve_accelerated_io_pre(&io_info);
 
 	if (FAIL == ret) {
 		ve_accelerated_io_free_io_hook();
+		ACC_IO_STATS_ADD(syscall_num, fd, disabled, 1);
 		SYSCALL_CANCEL(exit_result, syscall_num, fd, iov, count, ofs);
 		return exit_result;
 	} else if (NOBUF == ret) {
+		ACC_IO_STATS_ADD(syscall_num, fd, nobuf, 1);
 		SYSCALL_CANCEL(exit_result, syscall_num, fd, iov, count, ofs);
 		return exit_result;
 	}
+	ve_accelerated_io_tune_begin(fd, &io_info);
 
 	if (SYS_pwritev == syscall_num) {
 		write_syscall_type = SYS_pwrite64;
 	}
+	ve_accelerated_io_register_iov(iov, count, &regs);
 
-	/* get total size */
-	for (i = 0; i < count; i++) {
-		total_size = total_size + iov[i].iov_len; 
-	}
-
+	transfer_size = io_info.paras_size;
 	memset(posted, -1, sizeof(posted));
 	write_num = (total_size + transfer_size - 1)/ transfer_size;
 	for (i = 0; i < write_num; i++) {
 		if (i == 1) {
-			for (j = 0; j < BUFF_NPARAS; j++) {
+			for (j = 0; j < io_info.nparas; j++) {
 				io_info.vh_buff_and_flag[j]
 					= io_info.vh_buff_and_flag[j]
 					| VE_SECOND_SYS_CALL_FLAG;
@@ -1223,11 +5615,19 @@ static ssize_t ve_accelerated_io_writev_pwritev(int syscall_num, int fd,
 			transfer_size = total_size - transfer_size * i;
 		}
 
-		/* If not last 8MB */
-		j = i % BUFF_NPARAS;
-		if (i >= BUFF_NPARAS) {
+		/* If not last stages */
+		j = i % io_info.nparas;
+		if (i >= io_info.nparas) {
 			/* Wait DMA */
-			dma_ret = ve_dma_wait(&vedma_handle[j]);
+			ACC_IO_TRACE(syscall_num, fd, DMA_WAIT_BEGIN, j,
+					need_write_in_size[j]);
+			t_stats = ACC_IO_STATS_NOW();
+			dma_ret = ve_accelerated_io_sg_wait(vedma_handle[j],
+					nhandle[j]);
+			ACC_IO_STATS_TIME(syscall_num, fd, dma_wait_ns,
+					t_stats);
+			ACC_IO_TRACE(syscall_num, fd, DMA_WAIT_END, j,
+					need_write_in_size[j]);
 			if (dma_ret >= 1) {
 				exit_result = FAIL;
 				errno_bak = EIO;
@@ -1242,9 +5642,16 @@ static ssize_t ve_accelerated_io_writev_pwritev(int syscall_num, int fd,
 			}
 
 			/* Call syscall */
+			ACC_IO_TRACE(syscall_num, fd, SYSCALL_BEGIN, j,
+					need_write_in_size[j]);
+			t_stats = ACC_IO_STATS_NOW();
 			write_in_size = syscall(write_syscall_type, fd,
 					io_info.vh_buff_and_flag[j],
-					PARAS_SIZE, ofs);
+					io_info.paras_size, ofs);
+			ACC_IO_STATS_TIME(syscall_num, fd, syscall_ns,
+					t_stats);
+			ACC_IO_TRACE(syscall_num, fd, SYSCALL_END, j,
+					write_in_size);
 			if (FAIL == write_in_size) {
 				if (0 == posted[j]) {
 					errno_bak = errno;
@@ -1261,53 +5668,31 @@ static ssize_t ve_accelerated_io_writev_pwritev(int syscall_num, int fd,
 			}
 			exit_result += write_in_size;
 			ofs += write_in_size;
-			if (PARAS_SIZE > write_in_size) {
+			if (io_info.paras_size > write_in_size) {
 				data_err = 1;
 				posted[j] = -1;
 				break;
 			}			
 		}
 		/* Execute memory copy and data transfer in 1 set
-		 * and BUFF_NPARAS sets in parallel
+		 * and nparas sets in parallel
 		 */
-		ve_buff_size_less = transfer_size;
-		target_buff = io_info.ve_buff[j];
-		for (n = next_iov_num; n < count; n++) {
-			iov_len_less = iov[n].iov_len - iov_len_done;
-			iov_copy_size = MIN (iov_len_less, ve_buff_size_less);
-			__libsysve_vec_memcpy((void *)target_buff,
-					(void *)((uint64_t)iov[n].iov_base
-						+ iov_len_done),
-					iov_copy_size);
-			if (0 >= (ve_buff_size_less - iov_copy_size)) {
-				/* We have copied All data from the user buffers
-				 * to the VE buffer.
-				 */
-				if (iov_len_less > ve_buff_size_less) {
-					iov_len_done = iov_len_done
-						+ ve_buff_size_less;
-					next_iov_num = n;
-				} else {
-					iov_len_done = 0;
-					next_iov_num = n + 1;
-				}
-				/* This loop breaks always here
-				 * because the user-specified buffer should be
-				 * larger than the data in the VE buffer
-				 */
-				ve_buff_size_less = ve_buff_size_less
-					- iov_copy_size;
-				break;
-			}
-			iov_len_done = 0;
-			ve_buff_size_less = ve_buff_size_less - iov_copy_size;
-			target_buff = target_buff + iov_copy_size;
-		}
+		copy_pos = pos;
+		ACC_IO_TRACE(syscall_num, fd, MEMCPY_BEGIN, j, transfer_size);
+		t_stats = ACC_IO_STATS_NOW();
+		ve_accelerated_io_sg_stage(ACC_IO_SG_WRITE_COPY, iov, count,
+				&regs, &copy_pos, transfer_size, &io_info, j,
+				NULL, NULL);
+		ACC_IO_STATS_TIME(syscall_num, fd, memcpy_ns, t_stats);
+		ACC_IO_TRACE(syscall_num, fd, MEMCPY_END, j, transfer_size);
 
-		/* Transfer data from VE buffer to VH buffer by VE DMA */
-		ret = ve_dma_post(io_info.vh_vehva[j], io_info.ve_vehva[j],
-				GET_DMA_SIZE(transfer_size),
-				&vedma_handle[j]);
+		/* Transfer data from VE buffer or user buffers to VH buffer
+		 * by VE DMA
+		 */
+		ret = ve_accelerated_io_sg_stage(ACC_IO_SG_WRITE_POST, iov,
+				count, &regs, &pos, transfer_size, &io_info, j,
+				vedma_handle[j], &nhandle[j]);
+		ACC_IO_TRACE(syscall_num, fd, DMA_POST, j, transfer_size);
 		if (SUCCESS != ret) {
 			exit_result = FAIL;
 			errno_bak = EIO;
@@ -1317,19 +5702,26 @@ static ssize_t ve_accelerated_io_writev_pwritev(int syscall_num, int fd,
 		}
 
 		posted[j] = i;
-		need_write_in_size[j] = transfer_size - ve_buff_size_less;
+		need_write_in_size[j] = transfer_size;
 	}
 
-	/* Last 8MB */
-	min_k =  __ve_find_min_posted(posted);
-	for (k = 0; k < BUFF_NPARAS; k++) {
-		i = posted[(min_k + k) % BUFF_NPARAS];
+	/* Last stages */
+	min_k =  __ve_find_min_posted(posted, io_info.nparas);
+	for (k = 0; k < io_info.nparas; k++) {
+		i = posted[(min_k + k) % io_info.nparas];
 		if (i == -1) {
 			continue;
 		}
-		j = i % BUFF_NPARAS;
+		j = i % io_info.nparas;
 		/* Wait DMA */
-		dma_ret = ve_dma_wait(&vedma_handle[j]);
+		ACC_IO_TRACE(syscall_num, fd, DMA_WAIT_BEGIN, j,
+				need_write_in_size[j]);
+		t_stats = ACC_IO_STATS_NOW();
+		dma_ret = ve_accelerated_io_sg_wait(vedma_handle[j],
+				nhandle[j]);
+		ACC_IO_STATS_TIME(syscall_num, fd, dma_wait_ns, t_stats);
+		ACC_IO_TRACE(syscall_num, fd, DMA_WAIT_END, j,
+				need_write_in_size[j]);
 		if (dma_ret >= 1) {
 			exit_result = FAIL;
 			errno_bak = EIO;
@@ -1342,9 +5734,16 @@ static ssize_t ve_accelerated_io_writev_pwritev(int syscall_num, int fd,
 		}
 		/* Call syscall */
 		if (!data_err) {
+			ACC_IO_TRACE(syscall_num, fd, SYSCALL_BEGIN, j,
+					need_write_in_size[j]);
+			t_stats = ACC_IO_STATS_NOW();
 			write_in_size = syscall(write_syscall_type, fd,
 					io_info.vh_buff_and_flag[j],
 					need_write_in_size[j], ofs);
+			ACC_IO_STATS_TIME(syscall_num, fd, syscall_ns,
+					t_stats);
+			ACC_IO_TRACE(syscall_num, fd, SYSCALL_END, j,
+					write_in_size);
 			if (FAIL == write_in_size) {
 				if (0 == i) {
 					errno_bak = errno;
@@ -1366,7 +5765,9 @@ static ssize_t ve_accelerated_io_writev_pwritev(int syscall_num, int fd,
 		}
 	}
 
-	ve_accelerated_io_post(io_info.vh_mask);
+	ve_accelerated_io_unregister_iov(&regs);
+	ve_accelerated_io_tune_end(fd, &io_info, exit_result);
+	ve_accelerated_io_post(&io_info);
 	if (0 != errno_bak) {
 		errno = errno_bak;
 	}
@@ -1385,7 +5786,22 @@ static ssize_t ve_accelerated_io_writev_pwritev(int syscall_num, int fd,
 static ssize_t ve_accelerated_io_writev(int fd, const struct iovec *iov,
 		int count)
 {
-	return ve_accelerated_io_writev_pwritev(SYS_writev, fd, iov, count, 0);
+	int err;
+	ssize_t ret;
+	acc_io_csum_ctx csum;
+
+	ve_accelerated_io_csum_begin(&csum, fd, 1, 0);
+	err = ve_accelerated_io_sync_fd(fd, 1);
+	if (err != 0) {
+		errno = err;
+		ret = FAIL;
+	} else {
+		ret = ve_accelerated_io_writev_pwritev(SYS_writev, fd, iov, count,
+				0);
+	}
+	ve_accelerated_io_csum_end(&csum, NULL, iov, count, ret);
+	ACC_IO_STATS_CALL(SYS_writev, fd, ret);
+	return ret;
 }
 
 /**
@@ -1401,7 +5817,537 @@ static ssize_t ve_accelerated_io_writev(int fd, const struct iovec *iov,
 static ssize_t ve_accelerated_io_pwritev(int fd, const struct iovec *iov,
 		int count, off_t ofs)
 {
-	return ve_accelerated_io_writev_pwritev(SYS_pwritev, fd, iov, count, ofs);
+	int err;
+	ssize_t ret;
+	acc_io_csum_ctx csum;
+
+	ve_accelerated_io_csum_begin(&csum, fd, 1, 0);
+	err = ve_accelerated_io_sync_fd(fd, 1);
+	if (err != 0) {
+		errno = err;
+		ret = FAIL;
+	} else {
+		ret = ve_accelerated_io_writev_pwritev(SYS_pwritev, fd, iov, count,
+				ofs);
+	}
+	ve_accelerated_io_csum_end(&csum, NULL, iov, count, ret);
+	ACC_IO_STATS_CALL(SYS_pwritev, fd, ret);
+	return ret;
+}
+
+/**
+ * @brief This function completes IO of a file descriptor buffered by
+ * accelerated IO. It waits for writes processed in background by
+ * VE_ACC_IO_ASYNC_WRITE, writes data in the write-behind buffer of
+ * VE_ACC_IO_WRITE_BEHIND, discards data read ahead by
+ * VE_ACC_IO_READ_AHEAD, and forgets the state cached for the file, e.g.
+ * whether it is opened with O_DIRECT.
+ *
+ * @note Only read/write family system calls are hooked by accelerated
+ *       IO. When the features above are enabled, call this function
+ *       before lseek(), fsync(), fdatasync(), close() or dup2() of the
+ *       file descriptor, or before the file is accessed via another file
+ *       descriptor, so that they see the data and the file offset
+ *       written by the user.
+ * @note The checksums and the transform of the file descriptor are kept.
+ *       Disable them by ve_acc_io_set_checksum() and
+ *       ve_acc_io_set_transform() before closing the file descriptor.
+ * @note Data buffered for a file descriptor already closed is written to
+ *       the file it was written for.
+ *
+ * @param[in] fd File descriptor
+ *
+ * @retval 0 on success
+ * @retval -1 on failure and set errno
+ * - EBADF Bad file descriptor
+ * - EBUSY Called during IO of the file descriptor, e.g. from a signal
+ *   handler
+ * - Other errno of a write of buffered data which failed, which is
+ *   cleared by reporting it
+ */
+int ve_acc_io_flush(int fd)
+{
+	acc_io_fd_state *st;
+	int err = 0;
+
+	if (fd < 0 || fd >= acc_io_fd_max) {
+		errno = EBADF;
+		return FAIL;
+	}
+	if (acc_io_fd_locked == fd + 1) {
+		errno = EBUSY;
+		return FAIL;
+	}
+	st = ve_accelerated_io_lock_fd_state(fd, 0);
+	if (st != NULL) {
+		ve_accelerated_io_flush_locked(fd, st);
+		ve_accelerated_io_invalidate_locked(st);
+		err = __sync_lock_test_and_set(&st->err, 0);
+		st->is_reg = -1;
+		ve_accelerated_io_unlock_fd_state(st);
+	}
+	if (acc_io_fd_mode != NULL) {
+		acc_io_fd_mode[fd] = ACC_IO_FD_UNKNOWN;
+	}
+	if (err != 0) {
+		errno = err;
+		return FAIL;
+	}
+	return SUCCESS;
+}
+
+/**
+ * @brief This function sets the pipeline configuration of accelerated IO.
+ *
+ * @note The configuration is applied to the next IO request of each thread.
+ *
+ * @param[in] depth Number of pipeline stages (2-16)
+ * @param[in] chunk_size Size of each pipeline stage, which is a multiple of
+ *            4KB, 64KB or more and 8MB or less.
+ *
+ * @retval 0 on success
+ * @retval -1 on failure and set errno
+ * - EINVAL Invalid argument
+ */
+int ve_acc_io_set_pipeline(int depth, size_t chunk_size)
+{
+	if (chunk_size > PARAS_SIZE_MAX
+		|| SUCCESS != ve_accelerated_io_check_pipeline(depth,
+						(ssize_t)chunk_size)) {
+		errno = EINVAL;
+		return FAIL;
+	}
+	pthread_mutex_lock(&acc_io_conf_lock);
+	if (acc_io_conf.nparas != depth
+		|| acc_io_conf.paras_size != (ssize_t)chunk_size) {
+		acc_io_conf.nparas = depth;
+		acc_io_conf.paras_size = (ssize_t)chunk_size;
+		acc_io_conf.generation++;
+	}
+	pthread_mutex_unlock(&acc_io_conf_lock);
+	return SUCCESS;
+}
+
+/**
+ * @brief This function gets the pipeline configuration of accelerated IO.
+ *
+ * @param[out] depth Number of pipeline stages
+ * @param[out] chunk_size Size of each pipeline stage
+ *
+ * @retval 0 on success
+ * @retval -1 on failure and set errno
+ * - EFAULT Bad address
+ */
+int ve_acc_io_get_pipeline(int *depth, size_t *chunk_size)
+{
+	if (depth == NULL || chunk_size == NULL) {
+		errno = EFAULT;
+		return FAIL;
+	}
+	pthread_mutex_lock(&acc_io_conf_lock);
+	*depth = acc_io_conf.nparas;
+	*chunk_size = (size_t)acc_io_conf.paras_size;
+	pthread_mutex_unlock(&acc_io_conf_lock);
+	return SUCCESS;
+}
+
+/**
+ * @brief This function gets the number of IO requests which were handled
+ * as normal IO instead of accelerated IO due to lack of buffers.
+ *
+ * @note This happens when all buffer sets of the pool are used, when
+ *       registration of a buffer fails, or when an IO request is
+ *       nested more than once, e.g. IO from a signal handler
+ *       interrupting IO from another signal handler.
+ * @note The first nested IO request in a thread is also counted when
+ *       VE_ACC_IO_POOL_SIZE is not set, because the secondary buffer of
+ *       the thread is allocated by the next IO request which is not
+ *       nested.
+ *
+ * @return The number of IO requests
+ */
+uint64_t ve_acc_io_get_nobuf_count(void)
+{
+	return acc_io_nobuf_count;
+}
+
+/**
+ * @brief This function gets the statistics of a read/write family system
+ * call hooked by accelerated IO.
+ *
+ * @note Statistics are collected when the environment variable
+ *       VE_ACC_IO_STATS=1 or VE_ACC_IO_STATS_FILE is set. Otherwise,
+ *       all fields are 0.
+ *
+ * @param[in] hook System call (enum ve_acc_io_hook)
+ * @param[out] stats Statistics of the system call
+ *
+ * @retval 0 on success
+ * @retval -1 on failure and set errno
+ * - EINVAL Invalid argument
+ * - EFAULT Bad address
+ */
+int ve_acc_io_get_stats(int hook, struct ve_acc_io_stats *stats)
+{
+	if (hook < 0 || hook >= VE_ACC_IO_HOOK_NUM) {
+		errno = EINVAL;
+		return FAIL;
+	}
+	if (stats == NULL) {
+		errno = EFAULT;
+		return FAIL;
+	}
+	*stats = acc_io_hook_stats[hook];
+	return SUCCESS;
+}
+
+/**
+ * @brief This function gets the statistics of read/write family system
+ * calls for a file descriptor.
+ *
+ * @note Statistics are collected when the environment variable
+ *       VE_ACC_IO_STATS=1 or VE_ACC_IO_STATS_FILE is set. Otherwise,
+ *       all fields are 0, except the fields of auto-tuning which are
+ *       set when VE_ACC_IO_AUTO_TUNE=1 is set.
+ * @note Statistics are kept for each number of file descriptor, and not
+ *       cleared when it is closed. They include requests for files
+ *       previously opened with the same number.
+ *
+ * @param[in] fd File descriptor
+ * @param[out] stats Statistics of the file descriptor
+ *
+ * @retval 0 on success
+ * @retval -1 on failure and set errno
+ * - EINVAL Invalid argument
+ * - EFAULT Bad address
+ */
+int ve_acc_io_get_fd_stats(int fd, struct ve_acc_io_stats *stats)
+{
+	acc_io_fd_state *st;
+
+	if (fd < 0) {
+		errno = EINVAL;
+		return FAIL;
+	}
+	if (stats == NULL) {
+		errno = EFAULT;
+		return FAIL;
+	}
+	st = ve_accelerated_io_get_fd_state(fd, 0);
+	if (st == NULL) {
+		memset(stats, 0, sizeof(*stats));
+		return SUCCESS;
+	}
+	*stats = st->stats;
+	return SUCCESS;
+}
+
+/**
+ * @brief This function enables or disables checksums of data read from
+ * and written to a file descriptor by read/write family system calls.
+ * Data is added to the checksums while accelerated IO copies it, so that
+ * data is not read again to compute the checksums.
+ *
+ * @note Data is added in order of system calls, which are serialized for
+ *       the file descriptor while checksums are enabled. Data of readv
+ *       family system calls is added in a separate pass.
+ * @note Only data the system call reports as read or written is added.
+ *       Data of a write which failed or wrote partially is removed from
+ *       the checksum. Data kept in the write-behind buffer or written in
+ *       background is reported as written and added, and a later failure
+ *       of writing it is reported by ve_acc_io_flush().
+ * @note The checksums are computed by the scalar unit of VE, while data is
+ *       copied by the vector unit in blocks, so they are several times
+ *       slower than the copy and bound the throughput of accelerated IO
+ *       of the file descriptor. Requests of the file descriptor are also
+ *       serialized, and not read in parallel by VE_ACC_IO_STREAMS.
+ * @note close() is not hooked, so checksums are kept for the number of
+ *       the file descriptor after it is closed. Get them and disable
+ *       them by VE_ACC_IO_CSUM_NONE before closing it.
+ * @note Checksums are cleared whenever this function is called.
+ *
+ * @param[in] fd File descriptor
+ * @param[in] algorithm VE_ACC_IO_CSUM_CRC32C, VE_ACC_IO_CSUM_XXH64, or
+ *            VE_ACC_IO_CSUM_NONE to disable checksums
+ *
+ * @retval 0 on success
+ * @retval -1 on failure and set errno
+ * - EINVAL Invalid argument
+ * - EBADF Bad file descriptor
+ * - EBUSY Called during IO of a file descriptor checksummed, e.g. from a
+ *   signal handler
+ * - ENOMEM Out of memory
+ */
+int ve_acc_io_set_checksum(int fd, int algorithm)
+{
+	acc_io_fd_state *st;
+
+	if (algorithm < VE_ACC_IO_CSUM_NONE
+			|| algorithm > VE_ACC_IO_CSUM_XXH64) {
+		errno = EINVAL;
+		return FAIL;
+	}
+	if (fd < 0 || fd >= acc_io_fd_max
+			|| syscall(SYS_fcntl, fd, F_GETFD) < 0) {
+		errno = EBADF;
+		return FAIL;
+	}
+	if (acc_io_csum_busy) {
+		errno = EBUSY;
+		return FAIL;
+	}
+	st = ve_accelerated_io_alloc_fd_state(fd,
+			algorithm != VE_ACC_IO_CSUM_NONE);
+	if (st == NULL) {
+		if (algorithm == VE_ACC_IO_CSUM_NONE) {
+			return SUCCESS;
+		}
+		errno = ENOMEM;
+		return FAIL;
+	}
+	ve_accelerated_io_set_csum(st, algorithm);
+	return SUCCESS;
+}
+
+/**
+ * @brief This function sets a transform of data read from and written to
+ * a file descriptor, e.g. conversion of endianness.
+ * Data read is transformed in the internal VE buffer after it is
+ * transferred from VH and before it is copied to the user buffer. Data
+ * to write is transformed in the internal VE buffer after it is copied
+ * from the user buffer and before it is transferred to VH. So the
+ * transform of a chunk runs while other chunks are transferred, and the
+ * user buffer of a write is not changed.
+ *
+ * @note func is called with pieces of data of a request in order, and
+ *       must keep the size of data. A request is split at multiples of
+ *       the chunk size from its start, except a read returning less
+ *       data. Data read ahead by VE_ACC_IO_READ_AHEAD is split from the
+ *       start of the read-ahead buffer, and data of readv/writev family
+ *       system calls is split as a read/write of the total size.
+ * @note Data to be transformed is not transferred by zero copy, and
+ *       data of a read is not read by VE_ACC_IO_STREAMS threads.
+ * @note Do not change the transform while a request for the file
+ *       descriptor is processed. close() is not hooked, so the
+ *       transform is kept for the number of the file descriptor after
+ *       it is closed. Remove it before closing the file descriptor.
+ *
+ * @param[in] fd File descriptor
+ * @param[in] func Transform, NULL to remove the transform
+ * @param[in] arg Argument passed to func
+ *
+ * @retval 0 on success
+ * @retval -1 on failure and set errno
+ * - EBADF Bad file descriptor
+ * - EBUSY Called during IO of the file descriptor, e.g. from a signal
+ *   handler
+ * - ENOMEM Out of memory
+ */
+int ve_acc_io_set_transform(int fd, ve_acc_io_transform_t func, void *arg)
+{
+	acc_io_fd_state *st;
+
+	if (fd < 0 || fd >= acc_io_fd_max
+			|| syscall(SYS_fcntl, fd, F_GETFD) < 0) {
+		errno = EBADF;
+		return FAIL;
+	}
+	st = ve_accelerated_io_alloc_fd_state(fd, func != NULL);
+	if (st == NULL) {
+		if (func == NULL) {
+			return SUCCESS;
+		}
+		errno = ENOMEM;
+		return FAIL;
+	}
+	st = ve_accelerated_io_lock_fd_state(fd, 0);
+	if (st == NULL) {
+		errno = EBUSY;
+		return FAIL;
+	}
+	/* Data buffered is written and read by the previous transform */
+	ve_accelerated_io_flush_locked(fd, st);
+	ve_accelerated_io_invalidate_locked(st);
+	ve_accelerated_io_set_xform(st, func, arg);
+	ve_accelerated_io_unlock_fd_state(st);
+	return SUCCESS;
+}
+
+/**
+ * @brief This function gets checksums of data read from and written to
+ * a file descriptor since ve_acc_io_set_checksum() enabled them.
+ * The digest of CRC-32C is stored in the lower 32 bits.
+ *
+ * @param[in] fd File descriptor
+ * @param[out] csum Checksums of the file descriptor, whose algorithm is
+ *             VE_ACC_IO_CSUM_NONE if not enabled
+ *
+ * @retval 0 on success
+ * @retval -1 on failure and set errno
+ * - EINVAL Invalid argument
+ * - EFAULT Bad address
+ * - EBUSY Called during IO of a file descriptor checksummed, e.g. from a
+ *   signal handler
+ */
+int ve_acc_io_get_checksum(int fd, struct ve_acc_io_checksum *csum)
+{
+	acc_io_fd_state *st;
+
+	if (fd < 0) {
+		errno = EINVAL;
+		return FAIL;
+	}
+	if (csum == NULL) {
+		errno = EFAULT;
+		return FAIL;
+	}
+	if (acc_io_csum_busy) {
+		errno = EBUSY;
+		return FAIL;
+	}
+	memset(csum, 0, sizeof(*csum));
+	st = ve_accelerated_io_get_fd_state(fd, 0);
+	if (st == NULL) {
+		return SUCCESS;
+	}
+	while (__libsysve_a_swap(&st->csum_lock, VE_BUFF_USING)
+			!= VE_BUFF_NOT_USING) {
+		sched_yield();
+	}
+	csum->algorithm = st->csum_algorithm;
+	if (st->csum_algorithm != VE_ACC_IO_CSUM_NONE) {
+		csum->read_digest = ve_accelerated_io_csum_digest(
+				&st->csum_read);
+		csum->read_bytes = st->csum_read.total;
+		csum->write_digest = ve_accelerated_io_csum_digest(
+				&st->csum_write);
+		csum->write_bytes = st->csum_write.total;
+	}
+	__libsysve_a_swap(&st->csum_lock, VE_BUFF_NOT_USING);
+	return SUCCESS;
+}
+
+/**
+ * @brief This function allocates resources of accelerated IO before the
+ * first IO request, so that the first request does not pay for the
+ * initialization of DMA, the allocation of buffers on VE and VH and their
+ * registration to DMAATB.
+ *
+ * @note Resources of the calling thread and nthreads - 1 spare resources
+ *       are allocated. A thread takes spare resources at its first IO
+ *       request, so that threads of an OpenMP team can be prepared by
+ *       the master thread, e.g. ve_acc_io_prewarm(omp_get_max_threads())
+ *       before the parallel region. When VE_ACC_IO_POOL_SIZE is set,
+ *       resources of nthreads slots of the pool are allocated instead.
+ * @note Spare resources use as much memory as resources of a thread
+ *       until they are taken, and they are not released when the
+ *       pipeline is changed by ve_acc_io_set_pipeline() until a thread
+ *       takes them.
+ * @note Call this function in the child after fork() to replace the
+ *       resources inherited from the parent, which are otherwise released
+ *       and allocated again by the first IO request of the child.
+ * @note The threshold of small IO requests handled as normal IO is also
+ *       measured at the first call unless VE_ACC_IO_SMALL_IO_MAX is set,
+ *       which takes some milliseconds. Requests use the default
+ *       threshold until then.
+ *
+ * @param[in] nthreads Number of threads requesting IO at the same time,
+ *            0 or 1 for the calling thread only
+ *
+ * @retval 0 on success
+ * @retval -1 on failure and set errno
+ * - EINVAL Invalid argument
+ * - ENOTSUP Accelerated IO is disabled
+ * - ENOMEM Out of memory
+ * - EAGAIN Buffers on VH are not available, or slots of the pool are
+ *   used by other threads
+ * - EIO Failed to initialize DMA or to allocate buffers
+ */
+int ve_acc_io_prewarm(int nthreads)
+{
+	int i;
+	int n;
+	int ret = SUCCESS;
+	acc_io_resources *res;
+	acc_io_pool_slot **slots;
+
+	if (nthreads < 0) {
+		errno = EINVAL;
+		return FAIL;
+	}
+	if (PDMA_IO == constructor_result
+			|| PDMA_IO == ve_accelerated_io_chk_env_init_dma()) {
+		errno = ENOTSUP;
+		return FAIL;
+	}
+	if (acc_io_pool_size > 0) {
+		n = MAX(MIN(nthreads, acc_io_pool_size), 1);
+		slots = calloc(n, sizeof(*slots));
+		if (slots == NULL) {
+			errno = ENOMEM;
+			return FAIL;
+		}
+		/* Hold the slots, so that each iteration uses another slot */
+		for (i = 0; i < n && SUCCESS == ret; i++) {
+			ret = ve_accelerated_io_pool_get(&res, &slots[i], 0);
+		}
+		for (i = 0; i < n; i++) {
+			if (slots[i] != NULL) {
+				ve_accelerated_io_pool_put(slots[i]);
+			}
+		}
+		free(slots);
+	} else {
+		ret = ve_accelerated_io_get_thread_resource(&res);
+		for (n = nthreads - 1 - acc_io_nspares;
+				n > 0 && SUCCESS == ret; n--) {
+			ret = ve_accelerated_io_alloc_resource(&res, 0);
+			if (SUCCESS == ret) {
+				ve_accelerated_io_put_spare(res);
+			}
+		}
+	}
+	if (SUCCESS != ret) {
+		errno = (NOBUF == ret) ? EAGAIN : EIO;
+		return FAIL;
+	}
+
+	/* Measure the threshold of small IO unless VE_ACC_IO_SMALL_IO_MAX
+	 * is set */
+	if (VE_BUFF_NOT_USING == ve_buff_using_flag
+			&& PDMA_IO != constructor_result
+			&& __sync_bool_compare_and_swap(&acc_io_calib_state,
+				ACC_IO_CALIB_NONE, ACC_IO_CALIB_RUNNING)) {
+		ve_accelerated_io_calibrate();
+	}
+	return SUCCESS;
+}
+
+/**
+ * @brief This function allocates resources of accelerated IO at startup
+ * if VE_ACC_IO_PREWARM is set. A failure is reported to standard error
+ * here, and accelerated IO is disabled if DMA is not available, instead
+ * of at the first IO request.
+ */
+static void ve_accelerated_io_init_prewarm(void)
+{
+	ssize_t val;
+
+	if (PDMA_IO == constructor_result
+			|| SUCCESS != ve_accelerated_io_getenv_size(
+				ENV_KEY_PREWARM, &val)
+			|| val <= 0 || val > INT_MAX) {
+		return;
+	}
+	if (SUCCESS == ve_acc_io_prewarm((int)val)) {
+		return;
+	}
+	if (EIO == errno) {
+		constructor_result = PDMA_IO;
+		ve_accelerated_io_free_io_hook();
+	}
+	fprintf(stderr, "Accelerated IO: %s=%ld failed: %s\n",
+			ENV_KEY_PREWARM, (long)val, strerror(errno));
 }
 
 /**
@@ -1434,6 +6380,226 @@ __attribute__((constructor)) void ve_accelerated_io_init(void)
 		constructor_result = PDMA_IO;
         }
 
+	ve_accelerated_io_init_pipeline();
+	ve_accelerated_io_init_pool();
+	ve_accelerated_io_init_staging();
+	ve_accelerated_io_init_fd_state();
+	ve_accelerated_io_init_trace();
+	ve_accelerated_io_init_prewarm();
+
+}
+
+/**
+ * @brief This function makes the path of a file written at exit.
+ * "%p" in the path is replaced with the process ID.
+ *
+ * @param[in] fmt Path specified by an environment variable
+ * @param[out] path Buffer of PATH_MAX bytes
+ */
+static void ve_accelerated_io_expand_path(const char *fmt, char *path)
+{
+	size_t len = 0;
+
+	for (; *fmt != '\0' && len < PATH_MAX - 1; fmt++) {
+		if (fmt[0] == '%' && fmt[1] == 'p') {
+			len += snprintf(path + len, PATH_MAX - len, "%d",
+					(int)getpid());
+			len = MIN(len, PATH_MAX - 1);
+			fmt++;
+		} else {
+			path[len++] = *fmt;
+		}
+	}
+	path[len] = '\0';
+}
+
+/**
+ * @brief This function writes data to a file by system calls invoked
+ * directly, not to be hooked.
+ *
+ * @param[in] fd File descriptor
+ * @param[in] buf Data
+ * @param[in] size Size of data
+ *
+ * @retval 0 on success
+ * @retval -1 on failure
+ */
+static int ve_accelerated_io_write_raw(int fd, const void *buf, size_t size)
+{
+	ssize_t ret;
+
+	while (size > 0) {
+		ret = syscall(SYS_write, fd, buf, size);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+		if (ret <= 0) {
+			return FAIL;
+		}
+		buf = (const char *)buf + ret;
+		size -= ret;
+	}
+	return SUCCESS;
+}
+
+/**
+ * @brief This function writes statistics in JSON to a file.
+ *
+ * @param[in] fd File descriptor of the file
+ * @param[in] name Name of the statistics
+ * @param[in] stats Statistics
+ * @param[in] last 1 if this is the last member of the object
+ */
+static void ve_accelerated_io_write_stats(int fd, const char *name,
+		const struct ve_acc_io_stats *stats, int last)
+{
+	char buf[512];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "    \"%s\": {\"calls\": %lu, "
+			"\"bytes\": %lu, \"small_io\": %lu, \"nobuf\": %lu, "
+			"\"disabled\": %lu, \"dma_wait_ns\": %lu, "
+			"\"syscall_ns\": %lu, \"memcpy_ns\": %lu, "
+			"\"chunk_size\": %lu, \"vh_chunk_ns\": %lu, "
+			"\"ve_chunk_ns\": %lu}%s\n",
+			name, (unsigned long)stats->calls,
+			(unsigned long)stats->bytes,
+			(unsigned long)stats->small_io,
+			(unsigned long)stats->nobuf,
+			(unsigned long)stats->disabled,
+			(unsigned long)stats->dma_wait_ns,
+			(unsigned long)stats->syscall_ns,
+			(unsigned long)stats->memcpy_ns,
+			(unsigned long)stats->chunk_size,
+			(unsigned long)stats->vh_chunk_ns,
+			(unsigned long)stats->ve_chunk_ns, last ? "" : ",");
+	if (len > 0) {
+		ve_accelerated_io_write_raw(fd, buf, MIN(len, sizeof(buf) - 1));
+	}
+}
+
+/**
+ * @brief This function writes statistics of each hook and each file
+ * descriptor used in JSON to the file VE_ACC_IO_STATS_FILE.
+ * "%p" in the path is replaced with the process ID.
+ * System calls are invoked directly not to update the statistics.
+ */
+static void ve_accelerated_io_dump_stats(void)
+{
+	static const char *hook_names[VE_ACC_IO_HOOK_NUM] = {
+		"read", "pread", "readv", "preadv",
+		"write", "pwrite", "writev", "pwritev",
+	};
+	char path[PATH_MAX];
+	char buf[64];
+	const char *p;
+	size_t len;
+	int fd;
+	int i;
+	int last;
+
+	ve_accelerated_io_expand_path(acc_io_stats_file, path);
+	fd = syscall(SYS_open, path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return;
+	}
+	len = snprintf(buf, sizeof(buf), "{\n  \"pid\": %d,\n  \"hooks\": {\n",
+			(int)getpid());
+	ve_accelerated_io_write_raw(fd, buf, len);
+	for (i = 0; i < VE_ACC_IO_HOOK_NUM; i++) {
+		ve_accelerated_io_write_stats(fd, hook_names[i],
+				&acc_io_hook_stats[i], i == VE_ACC_IO_HOOK_NUM - 1);
+	}
+	p = "  },\n  \"fds\": {\n";
+	ve_accelerated_io_write_raw(fd, p, strlen(p));
+	for (last = acc_io_fd_max - 1; last >= 0; last--) {
+		if (acc_io_fds[last] != NULL
+				&& acc_io_fds[last]->stats.calls != 0) {
+			break;
+		}
+	}
+	for (i = 0; i <= last; i++) {
+		if (acc_io_fds[i] == NULL || acc_io_fds[i]->stats.calls == 0) {
+			continue;
+		}
+		snprintf(buf, sizeof(buf), "%d", i);
+		ve_accelerated_io_write_stats(fd, buf, &acc_io_fds[i]->stats,
+				i == last);
+	}
+	p = "  }\n}\n";
+	ve_accelerated_io_write_raw(fd, p, strlen(p));
+	syscall(SYS_close, fd);
+}
+
+/**
+ * @brief This function writes events in the trace ring buffer to the file
+ * VE_ACC_IO_TRACE, from the oldest one.
+ * "%p" in the path is replaced with the process ID.
+ * The file can be converted to the Chrome trace format by
+ * examples/veaccio/trace2json.
+ */
+static void ve_accelerated_io_dump_trace(void)
+{
+	struct ve_acc_io_trace_header hdr;
+	char path[PATH_MAX];
+	uint64_t next = acc_io_trace_next;
+	uint64_t first;
+	int fd;
+
+	ve_accelerated_io_expand_path(acc_io_trace_file, path);
+	fd = syscall(SYS_open, path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return;
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, VE_ACC_IO_TRACE_MAGIC, sizeof(hdr.magic));
+	hdr.version = VE_ACC_IO_TRACE_VERSION;
+	hdr.event_size = sizeof(struct ve_acc_io_trace_event);
+	hdr.nevents = MIN(next, acc_io_trace_size);
+	hdr.dropped = next - hdr.nevents;
+	hdr.pid = (int32_t)getpid();
+	if (SUCCESS != ve_accelerated_io_write_raw(fd, &hdr, sizeof(hdr))) {
+		goto out;
+	}
+	if (hdr.dropped != 0) {
+		/* The ring buffer wrapped, and the oldest event is next to
+		 * the newest one */
+		first = next % acc_io_trace_size;
+		if (SUCCESS != ve_accelerated_io_write_raw(fd,
+					&acc_io_trace[first],
+					(acc_io_trace_size - first)
+					* hdr.event_size)) {
+			goto out;
+		}
+		ve_accelerated_io_write_raw(fd, acc_io_trace,
+				first * hdr.event_size);
+	} else {
+		ve_accelerated_io_write_raw(fd, acc_io_trace,
+				next * hdr.event_size);
+	}
+out:
+	syscall(SYS_close, fd);
+}
+
+/**
+ * @brief This function writes data in write-behind buffers and waits for
+ * writes in background, because the file and its offset can be shared
+ * with other processes.
+ * Errors of writes not reported yet are displayed to standard error.
+ * Helper threads of VE_ACC_IO_STREAMS are stopped and joined.
+ * Statistics are written to VE_ACC_IO_STATS_FILE, and trace events to
+ * VE_ACC_IO_TRACE if they are set.
+ */
+__attribute__((destructor)) void ve_accelerated_io_fini(void)
+{
+	ve_accelerated_io_sync_all(1);
+	ve_accelerated_io_stream_shutdown();
+	if (acc_io_stats_file != NULL) {
+		ve_accelerated_io_dump_stats();
+	}
+	if (acc_io_trace_file != NULL) {
+		ve_accelerated_io_dump_trace();
+	}
 }
 
 #endif
@@ -0,0 +1,315 @@
+/* Copyright (C) 2018-2022 by NEC Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+/**
+ * @file accelerated_io_csum.c
+ * @brief Running checksums computed while accelerated IO copies data.
+ * @internal
+ *
+ * CRC-32C (Castagnoli) and xxHash64 (seed 0) are computed incrementally,
+ * so data can be fed in pieces of any size. The copy variant copies data
+ * by the vector unit in blocks, and checksums each block by the scalar
+ * unit while it is still in the cache. The checksums run on the scalar
+ * unit, because each of them is a chain of dependent operations: only the
+ * 4 lanes of xxHash64 are independent. They are several times slower than
+ * the vector copy, so they bound the throughput of accelerated IO of a
+ * checksummed file descriptor.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "veaccio.h"
+#include "libsysve_utils.h"
+#include "accelerated_io_csum.h"
+
+#define CRC32C_POLY 0x82f63b78	/* reversed polynomial of CRC-32C */
+
+#define XXH_PRIME64_1 0x9e3779b185ebca87ULL
+#define XXH_PRIME64_2 0xc2b2ae3d27d4eb4fULL
+#define XXH_PRIME64_3 0x165667b19e3779f9ULL
+#define XXH_PRIME64_4 0x85ebca77c2b2ae63ULL
+#define XXH_PRIME64_5 0x27d4eb2f165667c5ULL
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+#define CSUM_COPY_BLOCK (256*1024)	/* bytes copied before checksummed */
+#define CSUM_COPY_VEC_MIN 4096	/* minimum size copied by vector unit */
+
+/* Tables of CRC-32C to process 8 bytes at once (slicing-by-8) */
+static uint32_t crc32c_table[8][256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief This function makes tables of CRC-32C.
+ */
+static void crc32c_init_table(void)
+{
+	int i, j;
+	uint32_t c;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++) {
+			c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+		}
+		crc32c_table[0][i] = c;
+	}
+	for (i = 0; i < 256; i++) {
+		for (j = 1; j < 8; j++) {
+			c = crc32c_table[j - 1][i];
+			crc32c_table[j][i] = (c >> 8)
+				^ crc32c_table[0][c & 0xff];
+		}
+	}
+}
+
+static inline uint64_t load64(const unsigned char *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t load32(const unsigned char *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+	acc += input * XXH_PRIME64_2;
+	acc = ROTL64(acc, 31);
+	return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge_round(uint64_t acc, uint64_t val)
+{
+	acc ^= xxh64_round(0, val);
+	return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+/**
+ * @brief This function updates CRC-32C.
+ */
+static void crc32c_run(acc_io_csum *cs, const unsigned char *src, size_t size)
+{
+	uint32_t crc = cs->crc;
+	uint64_t w;
+	uint32_t hi;
+
+	for (; size >= 8; size -= 8, src += 8) {
+		w = load64(src);
+		crc ^= (uint32_t)w;
+		hi = (uint32_t)(w >> 32);
+		crc = crc32c_table[7][crc & 0xff]
+			^ crc32c_table[6][(crc >> 8) & 0xff]
+			^ crc32c_table[5][(crc >> 16) & 0xff]
+			^ crc32c_table[4][crc >> 24]
+			^ crc32c_table[3][hi & 0xff]
+			^ crc32c_table[2][(hi >> 8) & 0xff]
+			^ crc32c_table[1][(hi >> 16) & 0xff]
+			^ crc32c_table[0][hi >> 24];
+	}
+	for (; size > 0; size--, src++) {
+		crc = crc32c_table[0][(crc ^ *src) & 0xff] ^ (crc >> 8);
+	}
+	cs->crc = crc;
+}
+
+/**
+ * @brief This function updates xxHash64. Data less than a stripe is kept
+ * in the state until the stripe is filled.
+ * The 4 lanes of a stripe are independent, so each stripe is processed by
+ * a loop over the lanes, which the compiler vectorizes. A lane depends on
+ * the previous stripe, so stripes are processed in order.
+ */
+static void xxh64_run(acc_io_csum *cs, const unsigned char *src, size_t size)
+{
+	int l;
+	size_t n;
+	uint64_t v[4];
+
+	for (l = 0; l < 4; l++) {
+		v[l] = cs->acc[l];
+	}
+	if (cs->buf_len > 0) {
+		n = ACC_IO_CSUM_STRIPE - cs->buf_len;
+		if (n > size) {
+			n = size;
+		}
+		memcpy(cs->buf + cs->buf_len, src, n);
+		cs->buf_len += n;
+		src += n;
+		size -= n;
+		if (cs->buf_len < ACC_IO_CSUM_STRIPE) {
+			return;
+		}
+		for (l = 0; l < 4; l++) {
+			v[l] = xxh64_round(v[l], load64(cs->buf + l * 8));
+		}
+		cs->buf_len = 0;
+	}
+	for (; size >= ACC_IO_CSUM_STRIPE;
+			size -= ACC_IO_CSUM_STRIPE, src += ACC_IO_CSUM_STRIPE) {
+		for (l = 0; l < 4; l++) {
+			v[l] = xxh64_round(v[l], load64(src + l * 8));
+		}
+	}
+	if (size > 0) {
+		memcpy(cs->buf, src, size);
+		cs->buf_len = size;
+	}
+	for (l = 0; l < 4; l++) {
+		cs->acc[l] = v[l];
+	}
+}
+
+/**
+ * @brief This function initializes a running checksum.
+ *
+ * @param[out] cs State of the checksum
+ * @param[in] algorithm VE_ACC_IO_CSUM_CRC32C or VE_ACC_IO_CSUM_XXH64
+ */
+void ve_accelerated_io_csum_init(acc_io_csum *cs, int algorithm)
+{
+	memset(cs, 0, sizeof(*cs));
+	cs->algorithm = algorithm;
+	if (algorithm == VE_ACC_IO_CSUM_CRC32C) {
+		pthread_once(&crc32c_once, crc32c_init_table);
+		cs->crc = 0xffffffff;
+	} else if (algorithm == VE_ACC_IO_CSUM_XXH64) {
+		cs->acc[0] = XXH_PRIME64_1 + XXH_PRIME64_2;
+		cs->acc[1] = XXH_PRIME64_2;
+		cs->acc[2] = 0;
+		cs->acc[3] = -XXH_PRIME64_1;
+	}
+}
+
+/**
+ * @brief This function adds data to a running checksum.
+ *
+ * @param[in,out] cs State of the checksum
+ * @param[in] buf Data
+ * @param[in] size Size of data
+ */
+void ve_accelerated_io_csum_update(acc_io_csum *cs, const void *buf,
+		size_t size)
+{
+	cs->total += size;
+	if (cs->algorithm == VE_ACC_IO_CSUM_CRC32C) {
+		crc32c_run(cs, buf, size);
+	} else if (cs->algorithm == VE_ACC_IO_CSUM_XXH64) {
+		xxh64_run(cs, buf, size);
+	}
+}
+
+/**
+ * @brief This function copies data and adds it to a running checksum.
+ * Data is copied by the vector unit in blocks of CSUM_COPY_BLOCK bytes,
+ * and each block is checksummed from the destination while it is in the
+ * cache, so the copy keeps the speed of the vector unit and data is read
+ * from memory once.
+ *
+ * @param[in,out] cs State of the checksum
+ * @param[out] dst Destination
+ * @param[in] src Source, which does not overlap dst
+ * @param[in] size Size of data
+ */
+void ve_accelerated_io_csum_copy(acc_io_csum *cs, void *dst, const void *src,
+		size_t size)
+{
+	size_t n;
+	size_t done;
+
+	for (done = 0; done < size; done += n) {
+		n = size - done;
+		if (n > CSUM_COPY_BLOCK) {
+			n = CSUM_COPY_BLOCK;
+		}
+		if (n >= CSUM_COPY_VEC_MIN) {
+			__libsysve_vec_memcpy((char *)dst + done,
+					(char *)src + done, n);
+		} else {
+			memcpy((char *)dst + done, (const char *)src + done,
+					n);
+		}
+		ve_accelerated_io_csum_update(cs, (char *)dst + done, n);
+	}
+}
+
+/**
+ * @brief This function gets the digest of data added to a running
+ * checksum so far. The state is not changed, so more data can be added.
+ *
+ * @param[in] cs State of the checksum
+ *
+ * @return The digest, CRC-32C in the lower 32 bits or xxHash64.
+ */
+uint64_t ve_accelerated_io_csum_digest(const acc_io_csum *cs)
+{
+	uint64_t h;
+	const unsigned char *p = cs->buf;
+	size_t len = cs->buf_len;
+
+	if (cs->algorithm == VE_ACC_IO_CSUM_CRC32C) {
+		return (uint64_t)(~cs->crc);
+	}
+	if (cs->algorithm != VE_ACC_IO_CSUM_XXH64) {
+		return 0;
+	}
+
+	if (cs->total >= ACC_IO_CSUM_STRIPE) {
+		h = ROTL64(cs->acc[0], 1) + ROTL64(cs->acc[1], 7)
+			+ ROTL64(cs->acc[2], 12) + ROTL64(cs->acc[3], 18);
+		h = xxh64_merge_round(h, cs->acc[0]);
+		h = xxh64_merge_round(h, cs->acc[1]);
+		h = xxh64_merge_round(h, cs->acc[2]);
+		h = xxh64_merge_round(h, cs->acc[3]);
+	} else {
+		h = XXH_PRIME64_5;
+	}
+	h += cs->total;
+
+	for (; len >= 8; len -= 8, p += 8) {
+		h ^= xxh64_round(0, load64(p));
+		h = ROTL64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+	}
+	if (len >= 4) {
+		h ^= (uint64_t)load32(p) * XXH_PRIME64_1;
+		h = ROTL64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+		len -= 4;
+		p += 4;
+	}
+	for (; len > 0; len--, p++) {
+		h ^= (uint64_t)*p * XXH_PRIME64_5;
+		h = ROTL64(h, 11) * XXH_PRIME64_1;
+	}
+
+	h ^= h >> 33;
+	h *= XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH_PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
@@ -0,0 +1,49 @@
+/* Copyright (C) 2018-2022 by NEC Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+/**
+ * @file accelerated_io_csum.h
+ * @brief Running checksums computed while accelerated IO copies data.
+ * @internal
+ */
+#ifndef __VE_ACCELERATED_IO_CSUM_H
+#define __VE_ACCELERATED_IO_CSUM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ACC_IO_CSUM_STRIPE 32	/* bytes processed at once by xxHash64 */
+
+/* State of a running checksum */
+typedef struct {
+	int algorithm;	/*!< enum ve_acc_io_csum_algorithm */
+	uint64_t total;	/*!< number of bytes processed */
+	uint32_t crc;	/*!< CRC-32C before the final inversion */
+	uint64_t acc[4];	/*!< accumulators of xxHash64 */
+	unsigned char buf[ACC_IO_CSUM_STRIPE];	/*!< partial stripe */
+	size_t buf_len;	/*!< number of bytes in buf */
+} acc_io_csum;
+
+void ve_accelerated_io_csum_init(acc_io_csum *, int);
+void ve_accelerated_io_csum_update(acc_io_csum *, const void *, size_t);
+void ve_accelerated_io_csum_copy(acc_io_csum *, void *, const void *, size_t);
+uint64_t ve_accelerated_io_csum_digest(const acc_io_csum *);
+
+#endif
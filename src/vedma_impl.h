@@ -27,6 +27,79 @@
 #define VEDMA_NDESC	128
 #define VEDMA_DESC_SIZE	32
 
+#define VEDMA_DESC_SYNC		(8UL << 32)	/* SYNC flag in the size word */
+#define VEDMA_DESC_DONE		0x2		/* completion in the status word */
+#define VEDMA_DESC_EXC_SHIFT	48		/* exception in the status word */
+
+/* vedma_status[] of a descriptor used by ve_dma_post_wait() */
+#define VEDMA_STATUS_SYNC	((int *)1)
+/* vedma_status[] of a descriptor being written in lock-free mode */
+#define VEDMA_STATUS_CLAIMED	((int *)2)
+
+/**
+ * @struct vedma_vars
+ * @brief This structure hold the state of the DMA descriptor table.
+ * @note The offsets of the members are also defined in vedma_main.S.
+ */
+struct vedma_vars {
+	uint64_t	vedma_desc; /*! VE host virtual address of DMA
+				      descriptor table */
+	uint64_t	vedma_lock; /*! A spin lock for exclusive control.
+				      Set to 0 when it is not locked 
+				      and non-0 to lock it */
+	uint64_t	vedma_index; /*! The index number of the DMA
+				       descriptor to be used next.
+				       The value is 0-127. */
+	int		*vedma_status[VEDMA_NDESC]; /*! DMA status */
+	uint64_t	vedma_ticket; /*! The next ticket in lock-free
+					mode, see vedma_lockfree.c */
+	uint64_t	vedma_turn[VEDMA_NDESC]; /*! The ticket which may
+						   write each descriptor
+						   next in lock-free mode */
+};
+
+extern struct vedma_vars vedma_vars;
+
+/* Set to 1 when VE_DMA_LOCK_FREE=1, see vedma_lockfree.c */
+extern int vedma_lockfree;
+
+/* ve_dma_post(), ve_dma_poll() and ve_dma_post_wait() with vedma_lock,
+ * implemented in vedma_main.S */
+int vedma_post_locked(uint64_t dst, uint64_t src, int size,
+		ve_dma_handle_t *handle);
+int vedma_poll_locked(ve_dma_handle_t *handle);
+int vedma_post_wait_locked(uint64_t dst, uint64_t src, int size);
+
+int vedma_post_lockfree(uint64_t dst, uint64_t src, int size,
+		ve_dma_handle_t *handle);
+int vedma_poll_lockfree(ve_dma_handle_t *handle);
+
+/**
+ * @struct vedma_waiter
+ * @brief This structure holds the state of a thread waiting for DMA
+ *        according to the wait policy, see vedma_wait.c.
+ */
+struct vedma_waiter {
+	int		policy;		/*! enum ve_dma_wait_policy */
+	int		slept;		/*! set to 1 after sleeping once */
+	uint64_t	delay;		/*! iterations of the next backoff */
+	uint64_t	start_ns;	/*! time the wait started, 0 if not yet */
+	uint64_t	expect_ns;	/*! expected time of the DMA */
+	uint64_t	polls;		/*! polls of DMA completion */
+	uint64_t	spins;		/*! iterations of backoff */
+	uint64_t	yields;		/*! calls of sched_yield() */
+	uint64_t	sleeps;		/*! calls of nanosleep() */
+};
+
+extern int vedma_wait_policy;
+
+void vedma_wait_begin(struct vedma_waiter *w, uint64_t size);
+void vedma_wait_pause(struct vedma_waiter *w);
+void vedma_wait_end(struct vedma_waiter *w);
+uint64_t vedma_desc_size(int index);
+void vedma_wait_policy_init(void);
+void vedma_xfer_init(void);
+
 #define vedma_spin_lock(p)					\
 do {								\
 	uint64_t	*lp = (p);				\
@@ -52,17 +125,19 @@ do {								\
 		: "s63", "memory");				\
 } while(0)
 
+/* size needs to include VEDMA_DESC_SYNC. The layout of a descriptor is
+ * the same as written by ve_dma_post() in vedma_main.S. */
 #define vedma_write_dmadesc(desc, dst, src, size)		\
 do {								\
 	asm volatile(						\
 		" # vedma_write_dmadesc\n"			\
-		"	shm.l	%0, 0x08(%3)\n"			\
+		"	shm.l	%0, 0x18(%3)\n"			\
 		"	shm.l	%1, 0x10(%3)\n"			\
-		"	shm.l	%2, 0x18(%3)\n"			\
+		"	shm.l	%2, 0x08(%3)\n"			\
 		"	or	%%s63, 0, (63)0\n"		\
 		"	shm.l	%%s63, 0(%3)\n"			\
 		:: "r"(dst), "r"(src), "r"(size), "r"(desc)	\
-		: "s63");					\
+		: "s63", "memory");				\
 } while(0)
 
 static inline uint64_t vedma_lhm64(uint64_t p) __attribute__((always_inline));
@@ -20,6 +20,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <pthread.h>
 #include <errno.h>
@@ -44,21 +45,7 @@ ve_map_dmades(uint64_t *vehva_dmades, uint64_t *vehva_dmactl)
 static pthread_mutex_t init_lock = PTHREAD_MUTEX_INITIALIZER;
 static int ve_dma_initialized = 0;
 
-/**
- * @struct vedma_vars
- * @brief This structure hold the state of the DMA descriptor table.
- */
-struct vedma_vars {
-	uint64_t	vedma_desc; /*! VE host virtual address of DMA
-				      descriptor table */
-	uint64_t	vedma_lock; /*! A spin lock for exclusive control.
-				      Set to 0 when it is not locked 
-				      and non-0 to lock it */
-	uint64_t	vedma_index; /*! The index number of the DMA
-				       descriptor to be used next.
-				       The value is 0-127. */
-	int		*vedma_status[VEDMA_NDESC]; /*! DMA status */
-} vedma_vars;
+struct vedma_vars vedma_vars;
 uint64_t	vedma_ctrl;
 
 int 
@@ -66,6 +53,7 @@ ve_dma_init(void)
 {
 	int	ret = SUCCESS;
 	int	i;
+	char	*env;
 
 	if (pthread_mutex_lock(&init_lock) != 0) {
 		return FAIL;
@@ -81,9 +69,13 @@ ve_dma_init(void)
 	}
 	vedma_vars.vedma_index = 0;
 	vedma_vars.vedma_lock = 0;
+	vedma_vars.vedma_ticket = 0;
 	for (i = 0; i < VEDMA_NDESC; i++) {
 		vedma_vars.vedma_status[i] = NULL;
+		vedma_vars.vedma_turn[i] = i;
 	}
+	env = getenv("VE_DMA_LOCK_FREE");
+	vedma_lockfree = (env != NULL && strcmp(env, "1") == 0);
 	ve_dma_initialized = 1;
 
 init_unlock:
@@ -94,9 +86,17 @@ init_unlock:
 	return ret;
 }
 
+/*
+ * The DMA descriptor table mapped by ve_map_dmades() belongs to the process
+ * and is not inherited by a child, so DMA has to be initialized again in
+ * the child. This only clears the flag: ve_dma_init() runs at the first
+ * use of DMA in the child, e.g. the first request of accelerated IO, so a
+ * child which does no DMA does not pay for it.
+ */
 static void
 ve_dma_clear_skip_flag(void)
 {
+	pthread_mutex_init(&init_lock, NULL);
 	ve_dma_initialized = 0;
 }
 
@@ -106,17 +106,28 @@ init(void)
 	if (pthread_atfork(NULL, NULL, ve_dma_clear_skip_flag)) {
 		exit(1);
 	}
+	vedma_wait_policy_init();
+	vedma_xfer_init();
 }
 
 int ve_dma_wait(ve_dma_handle_t *handle)
 {
 	int ret;
+	struct vedma_waiter w;
+
+	ret = ve_dma_poll(handle);
+	if (ret != -EAGAIN) {
+		return ret;
+	}
+	vedma_wait_begin(&w, vedma_desc_size(handle->index));
 	do {
+		vedma_wait_pause(&w);
 		ret = ve_dma_poll(handle);
 			if (ret >= 1) {
 			break;
 		}
 	} while (ret == -EAGAIN);
+	vedma_wait_end(&w);
 	return ret;
 }
 
@@ -0,0 +1,288 @@
+/* Copyright (C) 2018 by NEC Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+/**
+ * @file  vedma_lockfree.c
+ * @brief VE DMA without the spin lock of the DMA descriptor table
+ *
+ * When VE_DMA_LOCK_FREE=1 is set, threads post DMA and poll its
+ * completion without vedma_lock. A thread posting DMA takes a ticket by
+ * atomic fetch-and-add of vedma_ticket, and the ticket selects the
+ * descriptor (ticket % VEDMA_NDESC), so threads do not wait for each
+ * other to claim descriptors. vedma_turn[] of a descriptor is the ticket
+ * which may write it next, and is advanced by VEDMA_NDESC when the
+ * descriptor is written, so descriptors are written in order of the ring
+ * even when a thread holding an earlier ticket is delayed.
+ *
+ * vedma_status[] of each descriptor is changed as follows:
+ *
+ * - NULL -> CLAIMED: the thread holding the ticket claims the free
+ *   descriptor.
+ * - handle -> CLAIMED: same as above, after the previous DMA using the
+ *   descriptor is completed. Its result is saved to the handle.
+ * - CLAIMED -> handle: the descriptor is written.
+ * - handle -> NULL: ve_dma_poll() finds the DMA completed.
+ *
+ * Only the thread holding the ticket changes vedma_status[] from a
+ * handle to another value but NULL, so a handle is never given back to
+ * its descriptor after being replaced.
+ */
+#include <stdlib.h>
+#include <errno.h>
+#include "vedma_impl.h"
+
+int vedma_lockfree = 0;
+
+/**
+ * @brief This function checks whether a DMA descriptor can be reused
+ * without waiting.
+ *
+ * @retval 1 The descriptor is free or its DMA is completed
+ * @retval 0 The descriptor is busy
+ */
+static int vedma_desc_reusable(int index)
+{
+	int *old = *(int * volatile *)&vedma_vars.vedma_status[index];
+	uint64_t desc;
+
+	if (old == NULL) {
+		return 1;
+	}
+	if (old == VEDMA_STATUS_SYNC || old == VEDMA_STATUS_CLAIMED) {
+		return 0;
+	}
+	desc = vedma_lhm64(vedma_vars.vedma_desc + index * VEDMA_DESC_SIZE);
+	return (desc & VEDMA_DESC_DONE) != 0;
+}
+
+/**
+ * @brief This function takes a ticket and claims its DMA descriptor.
+ *
+ * A ticket is not taken when the next descriptor is busy, as
+ * ve_dma_post() with vedma_lock returns -EAGAIN. Once taken, the
+ * descriptor must be written not to stop the DMA engine at it, so the
+ * thread waits according to the wait policy while the thread holding the
+ * previous ticket of the descriptor writes it and its DMA completes.
+ *
+ * @param[out] ticket Ticket taken
+ *
+ * @retval 0-127 Index of the descriptor claimed
+ * @retval -EAGAIN The next descriptor is busy
+ */
+static int vedma_claim_desc(uint64_t *ticket)
+{
+	int index;
+	int *old;
+	uint64_t t;
+	uint64_t desc;
+	int * volatile *status;
+	struct vedma_waiter w;
+	int waiting = 0;
+
+	t = *(volatile uint64_t *)&vedma_vars.vedma_ticket;
+	index = (int)(t % VEDMA_NDESC);
+	if (*(volatile uint64_t *)&vedma_vars.vedma_turn[index] != t
+			|| !vedma_desc_reusable(index)) {
+		return -EAGAIN;
+	}
+
+	t = __sync_fetch_and_add(&vedma_vars.vedma_ticket, 1);
+	index = (int)(t % VEDMA_NDESC);
+	status = &vedma_vars.vedma_status[index];
+	for (;;) {
+		if (*(volatile uint64_t *)&vedma_vars.vedma_turn[index] == t) {
+			old = *status;
+			if (old == NULL) {
+				if (__sync_bool_compare_and_swap(status, NULL,
+						VEDMA_STATUS_CLAIMED)) {
+					break;
+				}
+				continue;
+			}
+			if (old != VEDMA_STATUS_SYNC
+					&& old != VEDMA_STATUS_CLAIMED) {
+				desc = vedma_lhm64(vedma_vars.vedma_desc
+						+ index * VEDMA_DESC_SIZE);
+				if ((desc & VEDMA_DESC_DONE) != 0
+					&& __sync_bool_compare_and_swap(status,
+						old, VEDMA_STATUS_CLAIMED)) {
+					/* Polling the handle returns this */
+					*(volatile int *)old =
+						(int)(desc >> VEDMA_DESC_EXC_SHIFT);
+					break;
+				}
+				if ((desc & VEDMA_DESC_DONE) != 0) {
+					/* The handle is polled, retry */
+					continue;
+				}
+			}
+		}
+		if (!waiting) {
+			vedma_wait_begin(&w, 0);
+			waiting = 1;
+		}
+		vedma_wait_pause(&w);
+	}
+	if (waiting) {
+		vedma_wait_end(&w);
+	}
+	*ticket = t;
+	return index;
+}
+
+/**
+ * @brief This function writes a DMA transfer request to the descriptor
+ * claimed, sets vedma_status[] of the descriptor, and passes the
+ * descriptor to the next ticket.
+ */
+static void vedma_start_desc(int index, uint64_t ticket, uint64_t dst,
+		uint64_t src, int size, int *status)
+{
+	uint64_t desc = vedma_vars.vedma_desc + index * VEDMA_DESC_SIZE;
+
+	vedma_write_dmadesc(desc, dst, src,
+			(uint32_t)size | VEDMA_DESC_SYNC);
+	__sync_synchronize();
+	*(int * volatile *)&vedma_vars.vedma_status[index] = status;
+	__sync_synchronize();
+	*(volatile uint64_t *)&vedma_vars.vedma_turn[index] =
+		ticket + VEDMA_NDESC;
+}
+
+int vedma_post_lockfree(uint64_t dst, uint64_t src, int size,
+		ve_dma_handle_t *handle)
+{
+	int index;
+	uint64_t ticket;
+
+	index = vedma_claim_desc(&ticket);
+	if (index < 0) {
+		return index;
+	}
+	handle->status = -1;
+	handle->index = index;
+	vedma_start_desc(index, ticket, dst, src, size, &handle->status);
+	return 0;
+}
+
+int vedma_poll_lockfree(ve_dma_handle_t *handle)
+{
+	int ret;
+	int index = handle->index;
+	int *status = &handle->status;
+	uint64_t desc;
+
+	ret = *(volatile int *)status;
+	if (ret != -1) {
+		return ret;
+	}
+	if (*(int * volatile *)&vedma_vars.vedma_status[index] != status) {
+		/* A thread posting DMA is saving the result to the handle */
+		ret = *(volatile int *)status;
+		return (ret == -1) ? -EAGAIN : ret;
+	}
+	desc = vedma_lhm64(vedma_vars.vedma_desc + index * VEDMA_DESC_SIZE);
+	if ((desc & VEDMA_DESC_DONE) == 0) {
+		return -EAGAIN;
+	}
+	if (!__sync_bool_compare_and_swap(&vedma_vars.vedma_status[index],
+				status, NULL)) {
+		/* A thread posting DMA reclaimed the descriptor */
+		ret = *(volatile int *)status;
+		return (ret == -1) ? -EAGAIN : ret;
+	}
+	return (int)(desc >> VEDMA_DESC_EXC_SHIFT);
+}
+
+static int vedma_post_wait_lockfree(uint64_t dst, uint64_t src, int size)
+{
+	int index;
+	uint64_t ticket;
+	uint64_t desc;
+	struct vedma_waiter w;
+
+	vedma_wait_begin(&w, (uint64_t)size);
+	while ((index = vedma_claim_desc(&ticket)) < 0) {
+		vedma_wait_pause(&w);
+	}
+	vedma_start_desc(index, ticket, dst, src, size, VEDMA_STATUS_SYNC);
+	for (;;) {
+		desc = vedma_lhm64(vedma_vars.vedma_desc
+				+ index * VEDMA_DESC_SIZE);
+		if ((desc & VEDMA_DESC_DONE) != 0) {
+			break;
+		}
+		vedma_wait_pause(&w);
+	}
+	vedma_wait_end(&w);
+	__sync_synchronize();
+	*(int * volatile *)&vedma_vars.vedma_status[index] = NULL;
+	return (int)(desc >> VEDMA_DESC_EXC_SHIFT);
+}
+
+int ve_dma_post(uint64_t dst, uint64_t src, int size, ve_dma_handle_t *handle)
+{
+	if (vedma_lockfree) {
+		return vedma_post_lockfree(dst, src, size, handle);
+	}
+	return vedma_post_locked(dst, src, size, handle);
+}
+
+int ve_dma_poll(ve_dma_handle_t *handle)
+{
+	int ret;
+
+	if (vedma_lockfree) {
+		ret = vedma_poll_lockfree(handle);
+	} else {
+		ret = vedma_poll_locked(handle);
+	}
+	/* The descriptor is no longer owned by the handle, so keep the
+	 * result in it for ve_dma_test_some() and later polls */
+	if (ret != -EAGAIN) {
+		handle->status = ret;
+	}
+	return ret;
+}
+
+int ve_dma_post_wait(uint64_t dst, uint64_t src, int size)
+{
+	int ret;
+	ve_dma_handle_t handle;
+	struct vedma_waiter w;
+
+	if (vedma_wait_policy != VE_DMA_WAIT_SPIN) {
+		/* Wait by ve_dma_wait() to follow the wait policy */
+		ret = ve_dma_post(dst, src, size, &handle);
+		if (ret == -EAGAIN) {
+			vedma_wait_begin(&w, 0);
+			do {
+				vedma_wait_pause(&w);
+				ret = ve_dma_post(dst, src, size, &handle);
+			} while (ret == -EAGAIN);
+			vedma_wait_end(&w);
+		}
+		return ve_dma_wait(&handle);
+	}
+	if (vedma_lockfree) {
+		return vedma_post_wait_lockfree(dst, src, size);
+	}
+	return vedma_post_wait_locked(dst, src, size);
+}
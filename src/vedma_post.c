@@ -0,0 +1,251 @@
+/* Copyright (C) 2018 by NEC Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+/**
+ * @file  vedma_post.c
+ * @brief Posting multiple DMA requests to the DMA descriptor table
+ */
+#include <stdlib.h>
+#include <errno.h>
+#include "vedma_impl.h"
+
+/* Maximum size of a DMA request issued by ve_dma_post_large() */
+#define VEDMA_XFER_CHUNK	(64UL * 1024 * 1024)
+
+/* Maximum number of descriptors a transfer of ve_dma_post_large() holds */
+static int vedma_xfer_max_desc = VEDMA_NDESC / 2;
+
+/**
+ * @brief This function sets the maximum number of descriptors a transfer
+ * holds from VE_DMA_XFER_MAX_DESC.
+ */
+void vedma_xfer_init(void)
+{
+	char *env = getenv("VE_DMA_XFER_MAX_DESC");
+	char *ptr;
+	long val;
+
+	if (env == NULL || *env == '\0') {
+		return;
+	}
+	val = strtol(env, &ptr, 10);
+	if (*ptr == '\0' && val >= 1 && val <= VE_DMA_XFER_NDESC) {
+		vedma_xfer_max_desc = (int)val;
+	}
+}
+
+/**
+ * @brief This function checks whether a DMA descriptor can be reused.
+ * The result of the DMA using the descriptor is saved to its handle as
+ * ve_dma_post() does.
+ *
+ * @note The caller needs to hold vedma_lock.
+ *
+ * @param[in] index Index of the DMA descriptor
+ *
+ * @retval 1 The descriptor is free
+ * @retval 0 The DMA using the descriptor is not yet completed
+ */
+static int vedma_reclaim_desc(int index)
+{
+	int **status = &vedma_vars.vedma_status[index];
+	uint64_t desc;
+
+	if (*status == NULL) {
+		return 1;
+	}
+	if (*status == VEDMA_STATUS_SYNC) {
+		return 0;
+	}
+	desc = vedma_lhm64(vedma_vars.vedma_desc + index * VEDMA_DESC_SIZE);
+	if ((desc & VEDMA_DESC_DONE) == 0) {
+		return 0;
+	}
+	**status = (int)(desc >> VEDMA_DESC_EXC_SHIFT);
+	*status = NULL;
+	return 1;
+}
+
+/*
+ * Descriptors are checked and written in the same way as ve_dma_post()
+ * in vedma_main.S, for up to n descriptors from vedma_index.
+ */
+int ve_dma_post_batch(const struct ve_dma_req *reqs, int n,
+		ve_dma_handle_t *handles)
+{
+	int i;
+	int index;
+	uint64_t desc;
+	uint64_t size;
+
+	if (n < 0 || (n > 0 && (reqs == NULL || handles == NULL))) {
+		return -EINVAL;
+	}
+	if (n > VEDMA_NDESC) {
+		n = VEDMA_NDESC;
+	}
+
+	if (vedma_lockfree) {
+		for (i = 0; i < n; i++) {
+			if (vedma_post_lockfree(reqs[i].dst, reqs[i].src,
+						reqs[i].size, &handles[i]) != 0) {
+				break;
+			}
+		}
+		return (i == 0 && n > 0) ? -EAGAIN : i;
+	}
+
+	vedma_spin_lock(&vedma_vars.vedma_lock);
+	index = (int)vedma_vars.vedma_index;
+	for (i = 0; i < n; i++) {
+		if (!vedma_reclaim_desc(index)) {
+			break;
+		}
+		desc = vedma_vars.vedma_desc + index * VEDMA_DESC_SIZE;
+		size = (uint32_t)reqs[i].size | VEDMA_DESC_SYNC;
+		vedma_write_dmadesc(desc, reqs[i].dst, reqs[i].src, size);
+		handles[i].status = -1;
+		handles[i].index = index;
+		vedma_vars.vedma_status[index] = &handles[i].status;
+		index = (index + 1) % VEDMA_NDESC;
+	}
+	vedma_vars.vedma_index = index;
+	vedma_spin_unlock(&vedma_vars.vedma_lock);
+
+	if (i == 0 && n > 0) {
+		return -EAGAIN;
+	}
+	return i;
+}
+
+/**
+ * @brief This function issues the rest of a transfer to DMA descriptors
+ * while xfer has free handles.
+ *
+ * @param[in,out] xfer State of the transfer
+ */
+static void vedma_xfer_post(ve_dma_xfer_t *xfer)
+{
+	struct ve_dma_req reqs[VE_DMA_XFER_NDESC];
+	uint64_t off;
+	uint64_t size;
+	int tail;
+	int n;
+	int i;
+	int ret;
+
+	while (xfer->posted < xfer->size
+			&& xfer->count < vedma_xfer_max_desc) {
+		/* Handles passed to ve_dma_post_batch() are contiguous */
+		tail = (xfer->head + xfer->count) % VE_DMA_XFER_NDESC;
+		n = vedma_xfer_max_desc - xfer->count;
+		if (n > VE_DMA_XFER_NDESC - tail) {
+			n = VE_DMA_XFER_NDESC - tail;
+		}
+		off = xfer->posted;
+		for (i = 0; i < n && off < xfer->size; i++) {
+			size = xfer->size - off;
+			if (size > VEDMA_XFER_CHUNK) {
+				size = VEDMA_XFER_CHUNK;
+			}
+			reqs[i].dst = xfer->dst + off;
+			reqs[i].src = xfer->src + off;
+			reqs[i].size = (int)size;
+			xfer->chunk[tail + i] = (int)size;
+			off += size;
+		}
+		n = i;
+		ret = ve_dma_post_batch(reqs, n, &xfer->handle[tail]);
+		if (ret <= 0) {
+			return;
+		}
+		for (i = 0; i < ret; i++) {
+			xfer->posted += xfer->chunk[tail + i];
+		}
+		xfer->count += ret;
+		if (ret < n) {
+			return;
+		}
+	}
+}
+
+int ve_dma_post_large(uint64_t dst, uint64_t src, uint64_t size,
+		ve_dma_xfer_t *xfer)
+{
+	if (xfer == NULL || (dst & 3) != 0 || (src & 3) != 0
+			|| (size & 3) != 0) {
+		return -EINVAL;
+	}
+	xfer->dst = dst;
+	xfer->src = src;
+	xfer->size = size;
+	xfer->posted = 0;
+	xfer->done = 0;
+	xfer->status = 0;
+	xfer->head = 0;
+	xfer->count = 0;
+	vedma_xfer_post(xfer);
+	return 0;
+}
+
+int ve_dma_xfer_poll(ve_dma_xfer_t *xfer)
+{
+	int ret;
+
+	/* Requests are completed in order of descriptors */
+	while (xfer->count > 0) {
+		ret = ve_dma_poll(&xfer->handle[xfer->head]);
+		if (ret == -EAGAIN) {
+			break;
+		}
+		xfer->status |= ret;
+		xfer->done += xfer->chunk[xfer->head];
+		xfer->head = (xfer->head + 1) % VE_DMA_XFER_NDESC;
+		xfer->count--;
+	}
+	if (xfer->status == 0) {
+		vedma_xfer_post(xfer);
+		if (xfer->done < xfer->size) {
+			return -EAGAIN;
+		}
+	} else if (xfer->count > 0) {
+		/* Wait for requests issued before the failure */
+		return -EAGAIN;
+	}
+	return xfer->status;
+}
+
+int ve_dma_xfer_wait(ve_dma_xfer_t *xfer)
+{
+	int ret;
+	struct vedma_waiter w;
+
+	ret = ve_dma_xfer_poll(xfer);
+	if (ret != -EAGAIN) {
+		return ret;
+	}
+	vedma_wait_begin(&w, xfer->size - xfer->done);
+	do {
+		vedma_wait_pause(&w);
+		ret = ve_dma_xfer_poll(xfer);
+	} while (ret == -EAGAIN);
+	vedma_wait_end(&w);
+	return ret;
+}
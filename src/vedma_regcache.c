@@ -0,0 +1,546 @@
+/* Copyright (C) 2018 by NEC Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+/**
+ * @file  vedma_regcache.c
+ * @brief Cache of VE local memory registered to DMAATB
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "vedma.h"
+
+#define SUCCESS 0
+#define FAIL -1
+
+#define ENV_KEY_CACHE_ENTRIES "VE_DMAATB_CACHE_ENTRIES"
+
+/* Default number of DMAATB entries the cache may use */
+#define CACHE_ENTRIES_DEFAULT 64
+
+/* Page sizes of VE memory to be tried for registration */
+#define VE_PAGE_SIZE_64M (64*1024*1024UL)
+#define VE_PAGE_SIZE_2M (2*1024*1024UL)
+
+/**
+ * @struct regcache_entry
+ * @brief An area registered to DMAATB
+ */
+struct regcache_entry {
+	uint64_t	addr;	/*! Start address of registered area */
+	uint64_t	size;	/*! Size of registered area */
+	uint64_t	vehva;	/*! VE host virtual address of addr */
+	uint64_t	req_addr; /*! Start address of requested areas */
+	uint64_t	req_end; /*! End address of requested areas */
+	uint64_t	last_use; /*! Tick of last use for LRU eviction */
+	int		npages;	/*! Number of DMAATB entries used */
+	int		refcnt;	/*! Number of users */
+	int		invalid; /*! Set when the memory is released */
+};
+
+/**
+ * @struct vedma_regcache
+ * @brief This structure holds registered areas sorted by the start address.
+ */
+static struct vedma_regcache {
+	pthread_mutex_t	lock;
+	struct regcache_entry *entry; /*! Array sorted by addr */
+	int		nentry;	/*! Number of valid entries */
+	int		capacity; /*! Number of allocated entries */
+	int		npages;	/*! DMAATB entries used by the cache */
+	int		max_pages; /*! Budget of DMAATB entries */
+	uint64_t	max_size; /*! Max size of an entry for lookup */
+	uint64_t	tick;	/*! Counter for LRU */
+	int		initialized;
+} regcache = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.max_pages = CACHE_ENTRIES_DEFAULT,
+};
+
+/* Entries invalidated while in use, unregistered at last release */
+static struct regcache_entry *regcache_zombie;
+static int regcache_nzombie;
+
+/**
+ * @struct regcache_region
+ * @brief An area added by ve_dmaatb_cache_add()
+ */
+struct regcache_region {
+	uint64_t	addr;	/*! Start address of area */
+	uint64_t	end;	/*! End address of area */
+};
+
+/* Areas whose registration may be kept after release */
+static struct regcache_region *regcache_region;
+static int regcache_nregion;
+
+/**
+ * @brief This function is registered to pthread_atfork() and called at
+ *        child after fork.
+ *        DMAATB registrations are not inherited by the child, so all
+ *        entries are dropped without unregistering them. The lock is not
+ *        taken before fork, because prepare handlers of accelerated IO
+ *        write data which can register memory; it is initialized here
+ *        as it can be held by a thread which does not exist in the child.
+ */
+static void
+regcache_atfork_child(void)
+{
+	pthread_mutex_init(&regcache.lock, NULL);
+	regcache.nentry = 0;
+	regcache.npages = 0;
+	regcache.max_size = 0;
+	regcache_nzombie = 0;
+}
+
+/**
+ * @brief This function reads the budget of DMAATB entries from
+ *        environment variable VE_DMAATB_CACHE_ENTRIES.
+ */
+static void
+regcache_init_locked(void)
+{
+	char *env_val;
+	char *ptr;
+	long val;
+
+	if (regcache.initialized) {
+		return;
+	}
+	env_val = getenv(ENV_KEY_CACHE_ENTRIES);
+	if (env_val != NULL) {
+		val = strtol(env_val, &ptr, 10);
+		if (*ptr == '\0' && val >= 0 && val <= INT32_MAX) {
+			regcache.max_pages = (int)val;
+		}
+	}
+	pthread_atfork(NULL, NULL, regcache_atfork_child);
+	regcache.initialized = 1;
+}
+
+/**
+ * @brief This function checks whether [addr, end) is in an area added by
+ *        ve_dmaatb_cache_add().
+ *
+ * @retval 1 if it is, 0 otherwise.
+ */
+static int
+regcache_added_locked(uint64_t addr, uint64_t end)
+{
+	int i;
+
+	for (i = 0; i < regcache_nregion; i++) {
+		if (regcache_region[i].addr <= addr
+				&& end <= regcache_region[i].end)
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * @brief This function finds the first entry whose start address is
+ *        larger than addr by binary search.
+ */
+static int
+regcache_upper_bound(uint64_t addr)
+{
+	int lo = 0;
+	int hi = regcache.nentry;
+	int mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (regcache.entry[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/**
+ * @brief This function finds an entry containing [addr, addr + size).
+ *        Only entries starting in [addr - max_size, addr] can contain the
+ *        area, so this function checks them from the nearest.
+ *
+ * @retval index of the entry, or -1 if not found.
+ */
+static int
+regcache_lookup(uint64_t addr, uint64_t size)
+{
+	int i;
+	struct regcache_entry *e;
+
+	for (i = regcache_upper_bound(addr) - 1; i >= 0; i--) {
+		e = &regcache.entry[i];
+		if (e->addr + regcache.max_size <= addr)
+			break;
+		if (addr + size <= e->addr + e->size)
+			return i;
+	}
+	return -1;
+}
+
+/**
+ * @brief This function adds an entry to the list of entries which are
+ *        unregistered at the last release.
+ *
+ * @retval 0 on success, -1 on failure.
+ */
+static int
+regcache_add_zombie_locked(struct regcache_entry *e)
+{
+	struct regcache_entry *z;
+
+	z = realloc(regcache_zombie,
+		(regcache_nzombie + 1) * sizeof(struct regcache_entry));
+	if (z == NULL)
+		return FAIL;
+	e->invalid = 1;
+	regcache_zombie = z;
+	regcache_zombie[regcache_nzombie++] = *e;
+	return SUCCESS;
+}
+
+/**
+ * @brief This function removes the index-th entry from the array.
+ *        If the entry is not used, it is unregistered from DMAATB.
+ *        Otherwise, it is unregistered at the last release.
+ */
+static void
+regcache_remove_locked(int index)
+{
+	struct regcache_entry e = regcache.entry[index];
+
+	memmove(&regcache.entry[index], &regcache.entry[index + 1],
+		(regcache.nentry - index - 1) * sizeof(struct regcache_entry));
+	regcache.nentry--;
+
+	if (e.refcnt == 0) {
+		ve_unregister_mem_from_dmaatb(e.vehva);
+		regcache.npages -= e.npages;
+		return;
+	}
+	/* Keep the registration rather than breaking in-flight DMA
+	 * if this fails */
+	regcache_add_zombie_locked(&e);
+}
+
+/**
+ * @brief This function evicts least recently used entries which are not
+ *        used until npages DMAATB entries are available.
+ *
+ * @retval 0 on success, -1 if not enough entries can be evicted.
+ */
+static int
+regcache_evict_locked(int npages)
+{
+	int i;
+	int lru;
+
+	while (regcache.npages + npages > regcache.max_pages) {
+		lru = -1;
+		for (i = 0; i < regcache.nentry; i++) {
+			if (regcache.entry[i].refcnt != 0)
+				continue;
+			if (lru < 0 || regcache.entry[i].last_use
+					< regcache.entry[lru].last_use)
+				lru = i;
+		}
+		if (lru < 0)
+			return FAIL;
+		regcache_remove_locked(lru);
+	}
+	return SUCCESS;
+}
+
+/**
+ * @brief This function inserts an entry keeping the array sorted.
+ *
+ * @retval index of the entry on success, -1 on failure.
+ */
+static int
+regcache_insert_locked(struct regcache_entry *e)
+{
+	int index;
+	int capacity;
+	struct regcache_entry *p;
+
+	if (regcache.nentry == regcache.capacity) {
+		capacity = regcache.capacity ? regcache.capacity * 2 : 16;
+		p = realloc(regcache.entry,
+			capacity * sizeof(struct regcache_entry));
+		if (p == NULL)
+			return FAIL;
+		regcache.entry = p;
+		regcache.capacity = capacity;
+	}
+	index = regcache_upper_bound(e->addr);
+	memmove(&regcache.entry[index + 1], &regcache.entry[index],
+		(regcache.nentry - index) * sizeof(struct regcache_entry));
+	regcache.entry[index] = *e;
+	regcache.nentry++;
+	regcache.npages += e->npages;
+	if (e->size > regcache.max_size)
+		regcache.max_size = e->size;
+	return index;
+}
+
+/**
+ * @brief This function registers VE local memory to DMAATB with caching
+ *
+ * @note Unlike ve_register_mem_to_dmaatb(), vemva and size need not be
+ *       aligned. The area is extended to 64MB boundary, or 2MB boundary
+ *       if it fails, and registered.
+ * @note When the area is in an area added by ve_dmaatb_cache_add(), the
+ *       registration is kept after ve_unregister_mem_from_dmaatb_cached()
+ *       and reused by the later call for the same area. Least recently used
+ *       areas are unregistered when the number of DMAATB entries used by
+ *       the cache exceeds the value of environment variable
+ *       VE_DMAATB_CACHE_ENTRIES (default 64). 0 disables caching.
+ *       Otherwise, the area is unregistered at the last release.
+ *
+ * @param[in] vemva An address of memory to be registered
+ * @param[in] size Size of memory
+ *
+ * @retval vehva VE host virtual address corresponding to vemva on success
+ * @retval 0xffffffffffffffff On failure
+ */
+uint64_t
+ve_register_mem_to_dmaatb_cached(void *vemva, size_t size)
+{
+	size_t i;
+	int index;
+	int errno_bak;
+	int cached;
+	uint64_t addr = (uint64_t)vemva;
+	uint64_t vehva = (uint64_t)-1;
+	uint64_t page_size[] = {VE_PAGE_SIZE_64M, VE_PAGE_SIZE_2M};
+	struct regcache_entry e;
+
+	if (size == 0) {
+		errno = EINVAL;
+		return (uint64_t)-1;
+	}
+
+	pthread_mutex_lock(&regcache.lock);
+	regcache_init_locked();
+
+	/* Memory out of added areas can be released and reused at any time,
+	 * so its registration is never looked up nor kept */
+	cached = regcache_added_locked(addr, addr + size);
+	index = cached ? regcache_lookup(addr, size) : -1;
+	if (index >= 0) {
+		e = regcache.entry[index];
+		regcache.entry[index].refcnt++;
+		regcache.entry[index].last_use = ++regcache.tick;
+		if (addr < e.req_addr)
+			regcache.entry[index].req_addr = addr;
+		if (addr + size > e.req_end)
+			regcache.entry[index].req_end = addr + size;
+		pthread_mutex_unlock(&regcache.lock);
+		return e.vehva + (addr - e.addr);
+	}
+
+	errno_bak = errno;
+	for (i = 0; i < sizeof(page_size)/sizeof(page_size[0]); i++) {
+		memset(&e, 0, sizeof(e));
+		e.addr = addr & ~(page_size[i] - 1);
+		e.size = ((addr + size + page_size[i] - 1)
+				& ~(page_size[i] - 1)) - e.addr;
+		e.npages = e.size / page_size[i];
+		if (!cached || regcache_evict_locked(e.npages) != SUCCESS) {
+			/* Over the budget, register without caching */
+			e.npages = 0;
+		}
+		e.vehva = ve_register_mem_to_dmaatb((void *)e.addr, e.size);
+		if (e.vehva != (uint64_t)-1)
+			break;
+	}
+	if (e.vehva == (uint64_t)-1) {
+		pthread_mutex_unlock(&regcache.lock);
+		return (uint64_t)-1;
+	}
+	errno = errno_bak;
+
+	e.req_addr = addr;
+	e.req_end = addr + size;
+	e.refcnt = 1;
+	e.last_use = ++regcache.tick;
+	if (e.npages == 0 || regcache_insert_locked(&e) < 0) {
+		/* Not cached, unregistered at release */
+		e.npages = 0;
+		if (regcache_add_zombie_locked(&e) != SUCCESS) {
+			ve_unregister_mem_from_dmaatb(e.vehva);
+			pthread_mutex_unlock(&regcache.lock);
+			errno = ENOMEM;
+			return (uint64_t)-1;
+		}
+	}
+	vehva = e.vehva + (addr - e.addr);
+	pthread_mutex_unlock(&regcache.lock);
+	return vehva;
+}
+
+/**
+ * @brief This function releases VE local memory registered by
+ *        ve_register_mem_to_dmaatb_cached()
+ *
+ * @note The memory is kept registered to DMAATB for later use.
+ *
+ * @param[in] vehva VE host virtual address returned by
+ *            ve_register_mem_to_dmaatb_cached()
+ *
+ * @retval 0 On success
+ * @retval -1 On failure
+ * - EINVAL Invalid argument
+ */
+int
+ve_unregister_mem_from_dmaatb_cached(uint64_t vehva)
+{
+	int i;
+	int ret = SUCCESS;
+	struct regcache_entry *e;
+
+	pthread_mutex_lock(&regcache.lock);
+	for (i = 0; i < regcache.nentry; i++) {
+		e = &regcache.entry[i];
+		if (e->vehva <= vehva && vehva < e->vehva + e->size
+				&& e->refcnt > 0) {
+			e->refcnt--;
+			goto unlock;
+		}
+	}
+	for (i = 0; i < regcache_nzombie; i++) {
+		e = &regcache_zombie[i];
+		if (e->vehva <= vehva && vehva < e->vehva + e->size) {
+			if (--e->refcnt == 0) {
+				ret = ve_unregister_mem_from_dmaatb(e->vehva);
+				regcache.npages -= e->npages;
+				regcache_zombie[i]
+					= regcache_zombie[--regcache_nzombie];
+			}
+			goto unlock;
+		}
+	}
+	errno = EINVAL;
+	ret = FAIL;
+unlock:
+	pthread_mutex_unlock(&regcache.lock);
+	return ret;
+}
+
+/**
+ * @brief This function removes entries overlapping [addr, end) from the
+ *        cache.
+ */
+static void
+regcache_invalidate_locked(uint64_t addr, uint64_t end)
+{
+	int i;
+	struct regcache_entry *e;
+
+	for (i = regcache_upper_bound(end - 1) - 1; i >= 0; i--) {
+		e = &regcache.entry[i];
+		if (e->addr + regcache.max_size <= addr)
+			break;
+		if (e->req_addr < end && addr < e->req_end)
+			regcache_remove_locked(i);
+	}
+}
+
+/**
+ * @brief This function allows registration of VE local memory by
+ *        ve_register_mem_to_dmaatb_cached() to be cached
+ *
+ * @note The registration of an area in the memory is kept after the last
+ *       release and reused by later registration of the area, until
+ *       ve_dmaatb_cache_invalidate() is called for the memory. The cache
+ *       cannot see the memory released, so call
+ *       ve_dmaatb_cache_invalidate() before releasing it by free(),
+ *       munmap() or others. Otherwise, DMA with the memory allocated
+ *       later at the same address transfers data from/to the memory
+ *       released.
+ *
+ * @param[in] vemva An address of memory to be cached
+ * @param[in] size Size of memory
+ *
+ * @retval 0 On success
+ * @retval -1 On failure
+ * - EINVAL Invalid argument
+ * - ENOMEM Out of memory
+ */
+int
+ve_dmaatb_cache_add(void *vemva, size_t size)
+{
+	struct regcache_region *r;
+
+	if (size == 0 || (uint64_t)vemva + size < (uint64_t)vemva) {
+		errno = EINVAL;
+		return FAIL;
+	}
+	pthread_mutex_lock(&regcache.lock);
+	r = realloc(regcache_region,
+		(regcache_nregion + 1) * sizeof(struct regcache_region));
+	if (r == NULL) {
+		pthread_mutex_unlock(&regcache.lock);
+		errno = ENOMEM;
+		return FAIL;
+	}
+	regcache_region = r;
+	regcache_region[regcache_nregion].addr = (uint64_t)vemva;
+	regcache_region[regcache_nregion].end = (uint64_t)vemva + size;
+	regcache_nregion++;
+	pthread_mutex_unlock(&regcache.lock);
+	return SUCCESS;
+}
+
+/**
+ * @brief This function invalidates cached registration of VE local memory
+ *
+ * @note Call this function before releasing memory added by
+ *       ve_dmaatb_cache_add(). Areas added by ve_dmaatb_cache_add()
+ *       overlapping the memory are removed.
+ *
+ * @param[in] vemva An address of memory to be released
+ * @param[in] size Size of memory
+ */
+void
+ve_dmaatb_cache_invalidate(void *vemva, size_t size)
+{
+	int i;
+	uint64_t addr = (uint64_t)vemva;
+	uint64_t end = (uint64_t)vemva + size;
+
+	if (size == 0) {
+		return;
+	}
+	pthread_mutex_lock(&regcache.lock);
+	for (i = regcache_nregion - 1; i >= 0; i--) {
+		if (regcache_region[i].addr < end
+				&& addr < regcache_region[i].end)
+			regcache_region[i]
+				= regcache_region[--regcache_nregion];
+	}
+	if (regcache.nentry != 0)
+		regcache_invalidate_locked(addr, end);
+	pthread_mutex_unlock(&regcache.lock);
+}
@@ -0,0 +1,331 @@
+/* Copyright (C) 2018 by NEC Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+/**
+ * @file  vedma_wait.c
+ * @brief Waiting for the completion of asynchronous DMA
+ */
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include "vedma_impl.h"
+
+/* Assumed bandwidth of DMA to estimate the time of a transfer */
+#define VEDMA_WAIT_BYTES_PER_US	10000
+/* Time to spin before yielding with VE_DMA_WAIT_YIELD */
+#define VEDMA_WAIT_SPIN_NS	(20 * 1000)
+/* Minimum expected time of a transfer to sleep with VE_DMA_WAIT_YIELD */
+#define VEDMA_WAIT_SLEEP_MIN_NS	(500 * 1000)
+/* Maximum iterations between polls with VE_DMA_WAIT_BACKOFF */
+#define VEDMA_WAIT_BACKOFF_MAX	4096
+
+int vedma_wait_policy = VE_DMA_WAIT_SPIN;
+
+/* Counters of waits for DMA, updated at the end of each wait */
+static struct ve_dma_wait_stats vedma_wait_stats;
+
+static uint64_t vedma_now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief This function inquiries the completion of DMA of handles in one
+ * pass over the DMA descriptor table, acquiring vedma_lock once.
+ * The result of DMA completed is saved to the status of its handle, so
+ * that ve_dma_poll() returns it without checking the descriptor again.
+ *
+ * @param[in,out] handles Handles of DMA
+ * @param[in] n Number of handles
+ *
+ * @return Number of handles whose DMA is completed
+ */
+static int vedma_test_handles(ve_dma_handle_t *handles, int n)
+{
+	int i;
+	int ret;
+	int ndone = 0;
+	uint64_t desc;
+	ve_dma_handle_t *h;
+
+	if (vedma_lockfree) {
+		for (i = 0; i < n; i++) {
+			ret = vedma_poll_lockfree(&handles[i]);
+			if (ret != -EAGAIN) {
+				handles[i].status = ret;
+				ndone++;
+			}
+		}
+		return ndone;
+	}
+
+	vedma_spin_lock(&vedma_vars.vedma_lock);
+	for (i = 0; i < n; i++) {
+		h = &handles[i];
+		if (h->status == -1) {
+			/* The slot can be reused by another DMA */
+			if (vedma_vars.vedma_status[h->index] != &h->status) {
+				continue;
+			}
+			desc = vedma_lhm64(vedma_vars.vedma_desc
+					+ h->index * VEDMA_DESC_SIZE);
+			if ((desc & VEDMA_DESC_DONE) == 0) {
+				continue;
+			}
+			h->status = (int)(desc >> VEDMA_DESC_EXC_SHIFT);
+			vedma_vars.vedma_status[h->index] = NULL;
+		}
+		ndone++;
+	}
+	vedma_spin_unlock(&vedma_vars.vedma_lock);
+	return ndone;
+}
+
+int ve_dma_test_some(ve_dma_handle_t *handles, int n, int *indices,
+		int *statuses)
+{
+	int i;
+	int ndone = 0;
+
+	if (n < 0 || (n > 0 && (handles == NULL || indices == NULL))) {
+		return -EINVAL;
+	}
+	if (vedma_test_handles(handles, n) == 0) {
+		return 0;
+	}
+	for (i = 0; i < n; i++) {
+		if (handles[i].status == -1) {
+			continue;
+		}
+		indices[ndone] = i;
+		if (statuses != NULL) {
+			statuses[ndone] = handles[i].status;
+		}
+		ndone++;
+	}
+	return ndone;
+}
+
+int ve_dma_wait_any(ve_dma_handle_t *handles, int n, int *index)
+{
+	int i;
+	struct vedma_waiter w;
+
+	if (n <= 0 || handles == NULL || index == NULL) {
+		return -EINVAL;
+	}
+	if (vedma_test_handles(handles, n) == 0) {
+		vedma_wait_begin(&w, 0);
+		do {
+			vedma_wait_pause(&w);
+		} while (vedma_test_handles(handles, n) == 0);
+		vedma_wait_end(&w);
+	}
+	for (i = 0; handles[i].status == -1; i++)
+		;
+	*index = i;
+	return handles[i].status;
+}
+
+int ve_dma_wait_all(ve_dma_handle_t *handles, int n)
+{
+	int i;
+	int ret = 0;
+	uint64_t size = 0;
+	struct vedma_waiter w;
+
+	if (n < 0 || (n > 0 && handles == NULL)) {
+		return -EINVAL;
+	}
+	if (vedma_test_handles(handles, n) < n) {
+		for (i = 0; i < n; i++) {
+			if (handles[i].status == -1) {
+				size += vedma_desc_size(handles[i].index);
+			}
+		}
+		vedma_wait_begin(&w, size);
+		do {
+			vedma_wait_pause(&w);
+		} while (vedma_test_handles(handles, n) < n);
+		vedma_wait_end(&w);
+	}
+	for (i = 0; i < n; i++) {
+		ret |= handles[i].status;
+	}
+	return ret;
+}
+
+/**
+ * @brief This function sets the wait policy from VE_DMA_WAIT_POLICY.
+ */
+void vedma_wait_policy_init(void)
+{
+	char *env = getenv("VE_DMA_WAIT_POLICY");
+
+	if (env == NULL) {
+		return;
+	}
+	if (strcmp(env, "spin") == 0) {
+		vedma_wait_policy = VE_DMA_WAIT_SPIN;
+	} else if (strcmp(env, "backoff") == 0) {
+		vedma_wait_policy = VE_DMA_WAIT_BACKOFF;
+	} else if (strcmp(env, "yield") == 0) {
+		vedma_wait_policy = VE_DMA_WAIT_YIELD;
+	}
+}
+
+/**
+ * @brief This function gets the transfer size written to a DMA
+ * descriptor.
+ *
+ * @param[in] index Index of the DMA descriptor
+ */
+uint64_t vedma_desc_size(int index)
+{
+	return (uint32_t)vedma_lhm64(vedma_vars.vedma_desc
+			+ index * VEDMA_DESC_SIZE + 0x08);
+}
+
+/**
+ * @brief This function starts waiting for DMA.
+ *
+ * @param[out] w State of the wait
+ * @param[in] size Size of data being transferred, 0 if unknown
+ */
+void vedma_wait_begin(struct vedma_waiter *w, uint64_t size)
+{
+	w->policy = vedma_wait_policy;
+	w->slept = 0;
+	w->delay = 1;
+	w->start_ns = 0;
+	w->expect_ns = size * 1000 / VEDMA_WAIT_BYTES_PER_US;
+	w->polls = 0;
+	w->spins = 0;
+	w->yields = 0;
+	w->sleeps = 0;
+}
+
+/**
+ * @brief This function is called after each poll which finds DMA not
+ * completed, and waits before the next poll according to the policy.
+ *
+ * @param[in,out] w State of the wait
+ */
+void vedma_wait_pause(struct vedma_waiter *w)
+{
+	uint64_t i;
+	uint64_t now;
+	struct timespec ts;
+
+	w->polls++;
+	switch (w->policy) {
+	case VE_DMA_WAIT_BACKOFF:
+		/* Poll less frequently to leave memory bandwidth to others */
+		for (i = 0; i < w->delay; i++) {
+			asm volatile("" ::: "memory");
+		}
+		w->spins += w->delay;
+		if (w->delay < VEDMA_WAIT_BACKOFF_MAX) {
+			w->delay *= 2;
+		}
+		break;
+	case VE_DMA_WAIT_YIELD:
+		now = vedma_now_nsec();
+		if (w->start_ns == 0) {
+			w->start_ns = now;
+		}
+		if (!w->slept && w->expect_ns >= VEDMA_WAIT_SLEEP_MIN_NS
+				&& now - w->start_ns < w->expect_ns) {
+			/* Sleep for most of the expected time, and poll
+			 * for the rest not to delay the completion */
+			i = (w->expect_ns - (now - w->start_ns)) / 4 * 3;
+			ts.tv_sec = i / 1000000000;
+			ts.tv_nsec = i % 1000000000;
+			nanosleep(&ts, NULL);
+			w->slept = 1;
+			w->sleeps++;
+		} else if (now - w->start_ns >= VEDMA_WAIT_SPIN_NS) {
+			sched_yield();
+			w->yields++;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * @brief This function ends waiting for DMA, and adds the counters of
+ * the wait to the statistics.
+ *
+ * @param[in] w State of the wait
+ */
+void vedma_wait_end(struct vedma_waiter *w)
+{
+	__sync_fetch_and_add(&vedma_wait_stats.waits, 1);
+	__sync_fetch_and_add(&vedma_wait_stats.polls, w->polls + 1);
+	if (w->spins != 0) {
+		__sync_fetch_and_add(&vedma_wait_stats.spins, w->spins);
+	}
+	if (w->yields != 0) {
+		__sync_fetch_and_add(&vedma_wait_stats.yields, w->yields);
+	}
+	if (w->sleeps != 0) {
+		__sync_fetch_and_add(&vedma_wait_stats.sleeps, w->sleeps);
+	}
+}
+
+int ve_dma_set_wait_policy(int policy)
+{
+	if (policy != VE_DMA_WAIT_SPIN && policy != VE_DMA_WAIT_BACKOFF
+			&& policy != VE_DMA_WAIT_YIELD) {
+		return -EINVAL;
+	}
+	vedma_wait_policy = policy;
+	return 0;
+}
+
+int ve_dma_get_wait_policy(void)
+{
+	return vedma_wait_policy;
+}
+
+void ve_dma_get_wait_stats(struct ve_dma_wait_stats *stats)
+{
+	stats->waits = vedma_wait_stats.waits;
+	stats->polls = vedma_wait_stats.polls;
+	stats->spins = vedma_wait_stats.spins;
+	stats->yields = vedma_wait_stats.yields;
+	stats->sleeps = vedma_wait_stats.sleeps;
+}
+
+void ve_dma_reset_wait_stats(void)
+{
+	__sync_lock_test_and_set(&vedma_wait_stats.waits, 0);
+	__sync_lock_test_and_set(&vedma_wait_stats.polls, 0);
+	__sync_lock_test_and_set(&vedma_wait_stats.spins, 0);
+	__sync_lock_test_and_set(&vedma_wait_stats.yields, 0);
+	__sync_lock_test_and_set(&vedma_wait_stats.sleeps, 0);
+}